@@ -0,0 +1,148 @@
+#ifndef MRS_OCTOMAP_SERVER_BOUNDED_QUEUE_H
+#define MRS_OCTOMAP_SERVER_BOUNDED_QUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+namespace mrs_octomap_server
+{
+
+/* class BoundedQueue //{ */
+
+/**
+ * @brief Bounded lock-free queue for multiple producers and consumers (D. Vyukov's array-based queue).
+ *
+ * Each slot carries a sequence number, which tells the producers and the consumers whether the slot is empty or holds an
+ * item. Neither push() nor pop() blocks, they fail when the queue is full or empty. The capacity is rounded up to a
+ * power of two.
+ */
+template <class T>
+class BoundedQueue {
+
+public:
+  explicit BoundedQueue(const size_t capacity) {
+
+    size_t size = 2;
+
+    while (size < capacity) {
+      size *= 2;
+    }
+
+    mask_  = size - 1;
+    cells_ = std::make_unique<Cell_t[]>(size);
+
+    for (size_t i = 0; i < size; i++) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    enqueue_pos_.store(0, std::memory_order_relaxed);
+    dequeue_pos_.store(0, std::memory_order_relaxed);
+  }
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  size_t capacity() const {
+    return mask_ + 1;
+  }
+
+  /**
+   * @brief moves the item into the queue
+   *
+   * @return false when the queue is full, the item is left untouched
+   */
+  bool push(T&& item) {
+
+    Cell_t* cell;
+    size_t  pos = enqueue_pos_.load(std::memory_order_relaxed);
+
+    while (true) {
+
+      cell = &cells_[pos & mask_];
+
+      const size_t   sequence = cell->sequence.load(std::memory_order_acquire);
+      const intptr_t diff     = intptr_t(sequence) - intptr_t(pos);
+
+      if (diff == 0) {
+        // the slot is empty, try to claim it
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        // the slot still holds an item from the previous lap
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+
+    cell->data = std::move(item);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+
+    return true;
+  }
+
+  /**
+   * @brief moves the oldest item out of the queue
+   *
+   * @return false when the queue is empty
+   */
+  bool pop(T& item) {
+
+    Cell_t* cell;
+    size_t  pos = dequeue_pos_.load(std::memory_order_relaxed);
+
+    while (true) {
+
+      cell = &cells_[pos & mask_];
+
+      const size_t   sequence = cell->sequence.load(std::memory_order_acquire);
+      const intptr_t diff     = intptr_t(sequence) - intptr_t(pos + 1);
+
+      if (diff == 0) {
+        // the slot holds an item, try to claim it
+        if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        // the slot has not been filled yet
+        return false;
+      } else {
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+
+    item = std::move(cell->data);
+    cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+
+    return true;
+  }
+
+  /**
+   * @brief approximate check, the result may be outdated as soon as it is returned
+   */
+  bool empty() const {
+    return enqueue_pos_.load(std::memory_order_relaxed) == dequeue_pos_.load(std::memory_order_relaxed);
+  }
+
+private:
+  typedef struct
+  {
+    std::atomic<size_t> sequence;
+    T                   data;
+  } Cell_t;
+
+  std::unique_ptr<Cell_t[]> cells_;
+  size_t                    mask_;
+
+  // the positions are on separate cache lines, the producers and the consumers do not share them
+  alignas(64) std::atomic<size_t> enqueue_pos_;
+  alignas(64) std::atomic<size_t> dequeue_pos_;
+};
+
+//}
+
+}  // namespace mrs_octomap_server
+
+#endif
@@ -0,0 +1,264 @@
+#ifndef MRS_OCTOMAP_SERVER_KEY_BUFFER_H
+#define MRS_OCTOMAP_SERVER_KEY_BUFFER_H
+
+#include <octomap/OcTreeKey.h>
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+namespace mrs_octomap_server
+{
+
+typedef uint64_t morton_t;
+
+// a log-odds update of a single voxel, batches of these are sorted by the Morton code
+typedef struct
+{
+  morton_t code;
+  float    delta;
+} KeyUpdate_t;
+
+/* spreadBits() //{ */
+
+/**
+ * @brief spreads the lower 16 bits of the value such that there are two zero bits between each of them
+ */
+inline uint64_t spreadBits(uint64_t x) {
+
+  x &= 0xffff;
+  x = (x | x << 16) & 0x0000ff0000ff;
+  x = (x | x << 8) & 0x00f00f00f00f;
+  x = (x | x << 4) & 0x0c30c30c30c3;
+  x = (x | x << 2) & 0x249249249249;
+
+  return x;
+}
+
+//}
+
+/* compactBits() //{ */
+
+/**
+ * @brief inverse of spreadBits()
+ */
+inline uint64_t compactBits(uint64_t x) {
+
+  x &= 0x249249249249;
+  x = (x ^ (x >> 2)) & 0x0c30c30c30c3;
+  x = (x ^ (x >> 4)) & 0x00f00f00f00f;
+  x = (x ^ (x >> 8)) & 0x0000ff0000ff;
+  x = (x ^ (x >> 16)) & 0xffff;
+
+  return x;
+}
+
+//}
+
+/* mortonEncode() //{ */
+
+/**
+ * @brief interleaves the octree key into a 48-bit Morton code
+ *
+ * The three bits of each tree level are ordered as in octomap::computeChildIdx() (x is the lowest one),
+ * therefore, sorted Morton codes follow the depth-first order of the octree.
+ *
+ * @param key
+ *
+ * @return the Morton code
+ */
+inline morton_t mortonEncode(const uint32_t x, const uint32_t y, const uint32_t z) {
+
+  return spreadBits(x) | (spreadBits(y) << 1) | (spreadBits(z) << 2);
+}
+
+inline morton_t mortonEncode(const octomap::OcTreeKey& key) {
+
+  return mortonEncode(key.k[0], key.k[1], key.k[2]);
+}
+
+//}
+
+/* mortonDecode() //{ */
+
+/**
+ * @brief inverse of mortonEncode()
+ *
+ * @param code
+ *
+ * @return the octree key
+ */
+inline octomap::OcTreeKey mortonDecode(const morton_t code) {
+
+  return octomap::OcTreeKey(octomap::key_type(compactBits(code)), octomap::key_type(compactBits(code >> 1)), octomap::key_type(compactBits(code >> 2)));
+}
+
+//}
+
+/* node codes //{ */
+
+/**
+ * @brief encodes an inner node of the octree, the node is given by the code of its first leaf and its level above the leaves
+ *
+ * The level is stored above the 48 bits of the key, therefore, the codes of the leaves (level 0) sort before the codes
+ * of the nodes. The code of a leaf is the same as its mortonEncode().
+ */
+inline morton_t mortonEncodeNode(const morton_t first_leaf_code, const unsigned int level) {
+
+  return first_leaf_code | (morton_t(level) << 48);
+}
+
+inline unsigned int mortonLevel(const morton_t code) {
+
+  return unsigned(code >> 48);
+}
+
+/**
+ * @brief the code of the first leaf of the node
+ */
+inline morton_t mortonFirstLeaf(const morton_t code) {
+
+  return code & 0xffffffffffff;
+}
+
+/**
+ * @brief the depth-first order of the node codes: by the first leaf, a node before the nodes inside of it
+ */
+inline bool mortonNodeLess(const morton_t a, const morton_t b) {
+
+  const morton_t a_leaf = mortonFirstLeaf(a);
+  const morton_t b_leaf = mortonFirstLeaf(b);
+
+  if (a_leaf != b_leaf) {
+    return a_leaf < b_leaf;
+  }
+
+  return mortonLevel(a) > mortonLevel(b);
+}
+
+/**
+ * @brief the order of the updates in a batch, mortonNodeLess() of their codes
+ */
+inline bool keyUpdateLess(const KeyUpdate_t& a, const KeyUpdate_t& b) {
+
+  return mortonNodeLess(a.code, b.code);
+}
+
+//}
+
+/* class KeyBuffer //{ */
+
+/**
+ * @brief Flat buffer of Morton-encoded octree keys, a replacement of octomap::KeySet for the scan insertion.
+ *
+ * The keys are appended in any order, sortUnique() then sorts them and removes the duplicates. The memory is kept
+ * when the buffer is cleared, so refilling it does not allocate once it has grown to the working size.
+ */
+class KeyBuffer {
+
+public:
+  typedef std::vector<morton_t>::const_iterator const_iterator;
+
+  void clear() {
+    codes_.clear();
+  }
+
+  void reserve(const size_t size) {
+    codes_.reserve(size);
+  }
+
+  size_t size() const {
+    return codes_.size();
+  }
+
+  bool empty() const {
+    return codes_.empty();
+  }
+
+  const_iterator begin() const {
+    return codes_.begin();
+  }
+
+  const_iterator end() const {
+    return codes_.end();
+  }
+
+  morton_t operator[](const size_t idx) const {
+    return codes_[idx];
+  }
+
+  const morton_t* data() const {
+    return codes_.data();
+  }
+
+  void push_back(const morton_t code) {
+    codes_.push_back(code);
+  }
+
+  void push_back(const octomap::OcTreeKey& key) {
+    codes_.push_back(mortonEncode(key));
+  }
+
+  /**
+   * @brief appends a range of octomap::OcTreeKey, e.g., a part of octomap::KeyRay
+   */
+  template <class Iterator>
+  void insert(Iterator begin, Iterator end) {
+    for (Iterator it = begin; it != end; ++it) {
+      codes_.push_back(mortonEncode(*it));
+    }
+  }
+
+  /**
+   * @brief appends a range of Morton codes
+   */
+  void append(const morton_t* begin, const morton_t* end) {
+    codes_.insert(codes_.end(), begin, end);
+  }
+
+  /**
+   * @brief appends the content of another buffer
+   */
+  void append(const KeyBuffer& other) {
+    codes_.insert(codes_.end(), other.codes_.begin(), other.codes_.end());
+  }
+
+  /**
+   * @brief sorts the codes (LSD radix sort) and removes the duplicates
+   */
+  void sortUnique();
+
+  /**
+   * @brief merges the codes of another buffer into this one, both buffers have to be sorted by sortUnique()
+   */
+  void mergeUnique(const KeyBuffer& other);
+
+  /**
+   * @brief binary search for the code, the buffer has to be sorted by sortUnique()
+   */
+  bool contains(const morton_t code) const {
+    return std::binary_search(codes_.begin(), codes_.end(), code);
+  }
+
+  bool contains(const octomap::OcTreeKey& key) const {
+    return contains(mortonEncode(key));
+  }
+
+  /**
+   * @brief checks for any code in [first, last), the buffer has to be sorted by sortUnique()
+   */
+  bool containsRange(const morton_t first, const morton_t last) const {
+    auto it = std::lower_bound(codes_.begin(), codes_.end(), first);
+    return it != codes_.end() && *it < last;
+  }
+
+private:
+  std::vector<morton_t> codes_;
+  std::vector<morton_t> scratch_;
+};
+
+//}
+
+}  // namespace mrs_octomap_server
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef MRS_OCTOMAP_SERVER_MAP_COMPRESSION_H
+#define MRS_OCTOMAP_SERVER_MAP_COMPRESSION_H
+
+#include <octomap_msgs/Octomap.h>
+
+#include <mrs_octomap_server/CompressedOctomap.h>
+
+#include <string>
+
+namespace mrs_octomap_server
+{
+
+/**
+ * @brief checks the name of the codec, "lz4" and "zstd" are supported
+ */
+bool isCodecSupported(const std::string& codec);
+
+/**
+ * @brief compresses the data of the map, the rest of the message is copied
+ *
+ * @param map
+ * @param codec "lz4" or "zstd"
+ * @param level the compression level, lz4 uses LZ4 HC for the levels above 1
+ * @param compressed the output
+ *
+ * @return false for an unsupported codec or a failure of the codec
+ */
+bool compressMap(const octomap_msgs::Octomap& map, const std::string& codec, const int level, CompressedOctomap& compressed);
+
+/**
+ * @brief inverse of compressMap()
+ *
+ * @return false for an unsupported codec or corrupted data
+ */
+bool decompressMap(const CompressedOctomap& compressed, octomap_msgs::Octomap& map);
+
+}  // namespace mrs_octomap_server
+
+#endif
@@ -0,0 +1,415 @@
+#ifndef MRS_OCTOMAP_SERVER_MAP_QUERY_H
+#define MRS_OCTOMAP_SERVER_MAP_QUERY_H
+
+#include <octomap/octomap_types.h>
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include <omp.h>
+
+namespace mrs_octomap_server
+{
+
+/* class MapQuery //{ */
+
+/**
+ * @brief Batched occupancy queries of points, boxes and line segments against an octree.
+ *
+ * The boxes and the segments descend the tree from the root. An inner node holds the maximum log-odds of its children,
+ * therefore, a subtree of a free inner node contains no occupied leaf and it is skipped as a whole. The queries of a
+ * batch are evaluated in parallel, the tree is only read.
+ */
+template <class TREE>
+class MapQuery {
+
+public:
+  typedef typename TREE::NodeType NODE;
+
+  typedef enum
+  {
+    FREE     = 0,
+    OCCUPIED = 1,
+    UNKNOWN  = 2,
+  } Occupancy_t;
+
+  // the first occupied (or unknown) point of a segment
+  typedef struct
+  {
+    Occupancy_t      occupancy;
+    octomap::point3d hit;
+  } SegmentResult_t;
+
+  /**
+   * @param n_threads the number of threads evaluating the queries of a batch
+   */
+  explicit MapQuery(const int n_threads = 1) : n_threads_(std::max(1, n_threads)) {
+  }
+
+  /**
+   * @brief the occupancy of the leaves containing the points, UNKNOWN for the points outside of the map
+   */
+  void queryPoints(const TREE& octree, const std::vector<octomap::point3d>& points, std::vector<uint8_t>& results) const {
+
+    results.resize(points.size());
+
+#pragma omp parallel for schedule(dynamic, 256) num_threads(n_threads_)
+    for (size_t i = 0; i < points.size(); i++) {
+
+      const NODE* node = octree.search(points[i]);
+
+      if (!node) {
+        results[i] = UNKNOWN;
+      } else {
+        results[i] = octree.isNodeOccupied(node) ? OCCUPIED : FREE;
+      }
+    }
+  }
+
+  /**
+   * @brief whether the boxes contain an occupied leaf
+   *
+   * @param report_unknown the parts of the boxes outside of the map are reported as UNKNOWN, otherwise they count as
+   * free and the free subtrees are skipped
+   */
+  void queryBoxes(const TREE& octree, const std::vector<octomap::point3d>& mins, const std::vector<octomap::point3d>& maxs, const bool report_unknown,
+                  std::vector<uint8_t>& results) const {
+
+    results.resize(mins.size());
+
+#pragma omp parallel for schedule(dynamic, 16) num_threads(n_threads_)
+    for (size_t i = 0; i < mins.size(); i++) {
+
+      Box_t box;
+
+      for (int j = 0; j < 3; j++) {
+        box.min[j] = mins[i](j);
+        box.max[j] = maxs[i](j);
+      }
+
+      results[i] = queryBox(octree, box, report_unknown);
+    }
+  }
+
+  /**
+   * @brief the first occupied leaf along each of the segments
+   *
+   * @param report_unknown the segments also stop at the unknown space, otherwise it counts as free
+   */
+  void querySegments(const TREE& octree, const std::vector<octomap::point3d>& starts, const std::vector<octomap::point3d>& ends, const bool report_unknown,
+                     std::vector<SegmentResult_t>& results) const {
+
+    results.resize(starts.size());
+
+#pragma omp parallel for schedule(dynamic, 16) num_threads(n_threads_)
+    for (size_t i = 0; i < starts.size(); i++) {
+
+      Segment_t segment;
+
+      for (int j = 0; j < 3; j++) {
+        segment.origin[j]    = starts[i](j);
+        segment.direction[j] = ends[i](j) - starts[i](j);
+      }
+
+      double      t;
+      Occupancy_t occupancy = querySegment(octree, segment, report_unknown, t);
+
+      results[i].occupancy = occupancy;
+
+      if (occupancy == FREE) {
+        results[i].hit = ends[i];
+      } else {
+        results[i].hit = octomap::point3d(float(segment.origin[0] + t * segment.direction[0]), float(segment.origin[1] + t * segment.direction[1]),
+                                          float(segment.origin[2] + t * segment.direction[2]));
+      }
+    }
+  }
+
+private:
+  int n_threads_;
+
+  typedef struct
+  {
+    double min[3];
+    double max[3];
+  } Box_t;
+
+  // the segment is origin + t * direction, t in [0, 1]
+  typedef struct
+  {
+    double origin[3];
+    double direction[3];
+  } Segment_t;
+
+  // a node of the tree with its geometry
+  typedef struct
+  {
+    const NODE* node;
+    double      center[3];
+    double      half_size;
+  } Cell_t;
+
+  /* cells //{ */
+
+  static Cell_t rootCell(const TREE& octree) {
+
+    // the keys are centered at the origin, the root spans 2^(depth - 1) leaves to both sides of it
+    return {octree.getRoot(), {0.0, 0.0, 0.0}, octree.getResolution() * double(1u << (octree.getTreeDepth() - 1))};
+  }
+
+  /**
+   * @brief the geometry of the i-th child, the bits of the index select the upper half in x, y and z, as in
+   * octomap::computeChildIdx()
+   */
+  static Cell_t childCell(const Cell_t& parent, const unsigned int i, const NODE* child) {
+
+    const double half_size = parent.half_size / 2.0;
+
+    Cell_t cell{child, {}, half_size};
+
+    for (int j = 0; j < 3; j++) {
+      cell.center[j] = parent.center[j] + (((i >> j) & 1) ? half_size : -half_size);
+    }
+
+    return cell;
+  }
+
+  //}
+
+  /* queryBox() //{ */
+
+  Occupancy_t queryBox(const TREE& octree, const Box_t& box, const bool report_unknown) const {
+
+    if (!octree.getRoot()) {
+      return report_unknown ? UNKNOWN : FREE;
+    }
+
+    const Cell_t root = rootCell(octree);
+
+    Occupancy_t occupancy = FREE;
+
+    // a part of the box outside of the map
+    for (int j = 0; j < 3; j++) {
+      if (report_unknown && (box.min[j] < root.center[j] - root.half_size || box.max[j] >= root.center[j] + root.half_size)) {
+        occupancy = UNKNOWN;
+      }
+    }
+
+    boxRecurs(octree, root, box, report_unknown, occupancy);
+
+    return occupancy;
+  }
+
+  /**
+   * @return true once an occupied leaf was found, the rest of the tree is not visited then
+   */
+  bool boxRecurs(const TREE& octree, const Cell_t& cell, const Box_t& box, const bool report_unknown, Occupancy_t& occupancy) const {
+
+    const bool occupied = octree.isNodeOccupied(cell.node);
+
+    if (!octree.nodeHasChildren(cell.node)) {
+
+      if (occupied) {
+        occupancy = OCCUPIED;
+      }
+
+      return occupied;
+    }
+
+    // no occupied leaf below, only the unknown space can still be found there
+    if (!occupied && (!report_unknown || occupancy == UNKNOWN)) {
+      return false;
+    }
+
+    for (unsigned int i = 0; i < 8; i++) {
+
+      Cell_t child = childCell(cell, i, nullptr);
+
+      if (!intersects(child, box)) {
+        continue;
+      }
+
+      if (!octree.nodeChildExists(cell.node, i)) {
+
+        if (report_unknown) {
+          occupancy = UNKNOWN;
+        }
+
+        continue;
+      }
+
+      child.node = octree.getNodeChild(cell.node, i);
+
+      if (boxRecurs(octree, child, box, report_unknown, occupancy)) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  static bool intersects(const Cell_t& cell, const Box_t& box) {
+
+    for (int j = 0; j < 3; j++) {
+      if (cell.center[j] + cell.half_size <= box.min[j] || cell.center[j] - cell.half_size > box.max[j]) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  //}
+
+  /* querySegment() //{ */
+
+  /**
+   * @param t the parameter of the first hit along the segment
+   */
+  Occupancy_t querySegment(const TREE& octree, const Segment_t& segment, const bool report_unknown, double& t) const {
+
+    t = 0.0;
+
+    if (!octree.getRoot()) {
+      return report_unknown ? UNKNOWN : FREE;
+    }
+
+    const Cell_t root = rootCell(octree);
+
+    double t_in, t_out;
+
+    // the segment misses the map or it starts outside of it
+    if (!clip(root, segment, t_in, t_out) || t_in > 0.0) {
+
+      if (report_unknown) {
+        return UNKNOWN;
+      }
+
+      if (t_in > t_out) {
+        return FREE;
+      }
+    }
+
+    Occupancy_t occupancy = FREE;
+
+    segmentRecurs(octree, root, segment, report_unknown, occupancy, t);
+
+    return occupancy;
+  }
+
+  /**
+   * @brief visits the children crossed by the segment in the order along it, the first hit is therefore the closest one
+   *
+   * @return true once the segment hit
+   */
+  bool segmentRecurs(const TREE& octree, const Cell_t& cell, const Segment_t& segment, const bool report_unknown, Occupancy_t& occupancy, double& t) const {
+
+    const bool occupied = octree.isNodeOccupied(cell.node);
+
+    if (!octree.nodeHasChildren(cell.node)) {
+
+      if (occupied) {
+        double t_out;
+        clip(cell, segment, t, t_out);
+        occupancy = OCCUPIED;
+      }
+
+      return occupied;
+    }
+
+    // no occupied leaf below and the unknown space does not stop the segment
+    if (!occupied && !report_unknown) {
+      return false;
+    }
+
+    typedef struct
+    {
+      double       t_in;
+      unsigned int idx;
+    } Crossing_t;
+
+    Crossing_t crossings[8];
+    int        n_crossings = 0;
+
+    for (unsigned int i = 0; i < 8; i++) {
+
+      double t_in, t_out;
+
+      if (clip(childCell(cell, i, nullptr), segment, t_in, t_out)) {
+        crossings[n_crossings++] = {t_in, i};
+      }
+    }
+
+    std::sort(crossings, crossings + n_crossings, [](const Crossing_t& a, const Crossing_t& b) { return a.t_in < b.t_in; });
+
+    for (int c = 0; c < n_crossings; c++) {
+
+      const unsigned int i = crossings[c].idx;
+
+      if (!octree.nodeChildExists(cell.node, i)) {
+
+        if (report_unknown) {
+          occupancy = UNKNOWN;
+          t         = crossings[c].t_in;
+          return true;
+        }
+
+        continue;
+      }
+
+      if (segmentRecurs(octree, childCell(cell, i, octree.getNodeChild(cell.node, i)), segment, report_unknown, occupancy, t)) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  /**
+   * @brief the slab test, the part of the segment inside of the cell is [t_in, t_out], clamped to [0, 1]
+   *
+   * @return false if the segment misses the cell
+   */
+  static bool clip(const Cell_t& cell, const Segment_t& segment, double& t_in, double& t_out) {
+
+    t_in  = 0.0;
+    t_out = 1.0;
+
+    for (int j = 0; j < 3; j++) {
+
+      const double lo = cell.center[j] - cell.half_size;
+      const double hi = cell.center[j] + cell.half_size;
+
+      if (segment.direction[j] == 0.0) {
+
+        if (segment.origin[j] < lo || segment.origin[j] >= hi) {
+          t_out = -1.0;
+          return false;
+        }
+
+        continue;
+      }
+
+      double t0 = (lo - segment.origin[j]) / segment.direction[j];
+      double t1 = (hi - segment.origin[j]) / segment.direction[j];
+
+      if (t0 > t1) {
+        std::swap(t0, t1);
+      }
+
+      t_in  = std::max(t_in, t0);
+      t_out = std::min(t_out, t1);
+    }
+
+    return t_in <= t_out;
+  }
+
+  //}
+};
+
+//}
+
+}  // namespace mrs_octomap_server
+
+#endif
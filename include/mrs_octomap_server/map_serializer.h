@@ -0,0 +1,295 @@
+#ifndef MRS_OCTOMAP_SERVER_MAP_SERIALIZER_H
+#define MRS_OCTOMAP_SERVER_MAP_SERIALIZER_H
+
+#include <octomap_msgs/Octomap.h>
+
+#include <vector>
+#include <ostream>
+#include <streambuf>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include <omp.h>
+
+namespace mrs_octomap_server
+{
+
+/* class MapSerializer //{ */
+
+/**
+ * @brief Parallel serializer of the octrees into octomap_msgs/Octomap.
+ *
+ * The messages are byte to byte the same as those of octomap_msgs::fullMapToMsg() and octomap_msgs::binaryMapToMsg(), both
+ * formats are depth-first streams of the nodes. The nodes above the split depth are written sequentially, the subtrees
+ * below them are written in parallel into separate buffers, which are concatenated in the depth-first order.
+ */
+template <class TREE>
+class MapSerializer {
+
+public:
+  typedef typename TREE::NodeType NODE;
+
+  /**
+   * @param n_threads the number of threads writing the subtrees
+   * @param split_depth the depth of the roots of the subtrees written in parallel, there are up to 8^split_depth of them
+   */
+  explicit MapSerializer(const int n_threads = 1, const unsigned int split_depth = 3) : n_threads_(std::max(1, n_threads)), split_depth_(split_depth) {
+  }
+
+  /**
+   * @brief the same as octomap_msgs::fullMapToMsg(), the data of all the nodes
+   */
+  bool fullMapToMsg(const TREE& octree, octomap_msgs::Octomap& msg) const {
+
+    msg.resolution = octree.getResolution();
+    msg.id         = octree.getTreeType();
+    msg.binary     = false;
+
+    serialize(octree, false, msg.data);
+
+    return true;
+  }
+
+  /**
+   * @brief the same as octomap_msgs::binaryMapToMsg(), the occupancy of the leaves only
+   */
+  bool binaryMapToMsg(const TREE& octree, octomap_msgs::Octomap& msg) const {
+
+    msg.resolution = octree.getResolution();
+    msg.id         = octree.getTreeType();
+    msg.binary     = true;
+
+    serialize(octree, true, msg.data);
+
+    return true;
+  }
+
+private:
+  int          n_threads_;
+  unsigned int split_depth_;
+
+  // a part of the stream, either the bytes of the nodes above the split depth or a subtree written by a worker
+  typedef struct
+  {
+    std::vector<char> bytes;
+    const NODE*       subtree;
+  } Segment_t;
+
+  // the stream buffer appending to a byte vector, the nodes write their data through std::ostream
+  class ByteBuffer : public std::streambuf {
+
+  public:
+    explicit ByteBuffer(std::vector<char>& bytes) : bytes_(bytes) {
+    }
+
+  protected:
+    int_type overflow(int_type c) override {
+
+      if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        bytes_.push_back(traits_type::to_char_type(c));
+      }
+
+      return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+
+      bytes_.insert(bytes_.end(), s, s + n);
+
+      return n;
+    }
+
+  private:
+    std::vector<char>& bytes_;
+  };
+
+  /* serialize() //{ */
+
+  void serialize(const TREE& octree, const bool binary, std::vector<int8_t>& data) const {
+
+    data.clear();
+
+    const NODE* root = octree.getRoot();
+
+    if (!root) {
+      return;
+    }
+
+    std::vector<Segment_t> segments;
+
+    segments.push_back({{}, nullptr});
+    splitRecurs(octree, root, 0, binary, segments);
+
+#pragma omp parallel for schedule(dynamic, 1) num_threads(n_threads_)
+    for (size_t i = 0; i < segments.size(); i++) {
+
+      if (!segments[i].subtree) {
+        continue;
+      }
+
+      ByteBuffer   buffer(segments[i].bytes);
+      std::ostream s(&buffer);
+
+      if (binary) {
+        writeBinaryNodesRecurs(octree, segments[i].subtree, s);
+      } else {
+        writeNodesRecurs(octree, segments[i].subtree, s);
+      }
+    }
+
+    size_t size = 0;
+
+    for (const Segment_t& segment : segments) {
+      size += segment.bytes.size();
+    }
+
+    data.resize(size);
+
+    size_t offset = 0;
+
+    for (const Segment_t& segment : segments) {
+
+      if (!segment.bytes.empty()) {
+        std::memcpy(data.data() + offset, segment.bytes.data(), segment.bytes.size());
+      }
+
+      offset += segment.bytes.size();
+    }
+  }
+
+  //}
+
+  /* splitRecurs() //{ */
+
+  /**
+   * @brief writes the nodes above the split depth, the subtrees at the split depth are left for the workers
+   */
+  void splitRecurs(const TREE& octree, const NODE* node, const unsigned int depth, const bool binary, std::vector<Segment_t>& segments) const {
+
+    if (depth == split_depth_) {
+      segments.push_back({{}, node});
+      segments.push_back({{}, nullptr});
+      return;
+    }
+
+    {
+      ByteBuffer   buffer(segments.back().bytes);
+      std::ostream s(&buffer);
+
+      if (binary) {
+        writeBinaryNode(octree, node, s);
+      } else {
+        writeNode(octree, node, s);
+      }
+    }
+
+    for (unsigned int i = 0; i < 8; i++) {
+
+      if (!octree.nodeChildExists(node, i)) {
+        continue;
+      }
+
+      const NODE* child = octree.getNodeChild(node, i);
+
+      // the binary format does not continue below the leaves
+      if (!binary || octree.nodeHasChildren(child)) {
+        splitRecurs(octree, child, depth + 1, binary, segments);
+      }
+    }
+  }
+
+  //}
+
+  /* full format //{ */
+
+  /**
+   * @brief as octomap::OcTreeBaseImpl::writeNodesRecurs(), the data of the node followed by a byte of its existing children
+   */
+  void writeNode(const TREE& octree, const NODE* node, std::ostream& s) const {
+
+    node->writeData(s);
+
+    char children = 0;
+
+    for (unsigned int i = 0; i < 8; i++) {
+      if (octree.nodeChildExists(node, i)) {
+        children |= char(1 << i);
+      }
+    }
+
+    s.write(&children, sizeof(char));
+  }
+
+  void writeNodesRecurs(const TREE& octree, const NODE* node, std::ostream& s) const {
+
+    writeNode(octree, node, s);
+
+    for (unsigned int i = 0; i < 8; i++) {
+      if (octree.nodeChildExists(node, i)) {
+        writeNodesRecurs(octree, octree.getNodeChild(node, i), s);
+      }
+    }
+  }
+
+  //}
+
+  /* binary format //{ */
+
+  /**
+   * @brief as octomap::OccupancyOcTreeBase::writeBinaryNode(), two bits per child: 00 unknown, 01 free, 10 occupied,
+   * 11 inner node
+   */
+  void writeBinaryNode(const TREE& octree, const NODE* node, std::ostream& s) const {
+
+    char children[2] = {0, 0};
+
+    for (unsigned int i = 0; i < 8; i++) {
+
+      if (!octree.nodeChildExists(node, i)) {
+        continue;
+      }
+
+      const NODE* child = octree.getNodeChild(node, i);
+
+      int code;
+
+      if (octree.nodeHasChildren(child)) {
+        code = 3;
+      } else if (octree.isNodeOccupied(child)) {
+        code = 2;
+      } else {
+        code = 1;
+      }
+
+      children[i / 4] |= char(code << (2 * (i % 4)));
+    }
+
+    s.write(children, 2);
+  }
+
+  void writeBinaryNodesRecurs(const TREE& octree, const NODE* node, std::ostream& s) const {
+
+    writeBinaryNode(octree, node, s);
+
+    for (unsigned int i = 0; i < 8; i++) {
+
+      if (octree.nodeChildExists(node, i)) {
+
+        const NODE* child = octree.getNodeChild(node, i);
+
+        if (octree.nodeHasChildren(child)) {
+          writeBinaryNodesRecurs(octree, child, s);
+        }
+      }
+    }
+  }
+
+  //}
+};
+
+//}
+
+}  // namespace mrs_octomap_server
+
+#endif
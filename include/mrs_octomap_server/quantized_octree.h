@@ -0,0 +1,132 @@
+#ifndef MRS_OCTOMAP_SERVER_QUANTIZED_OCTREE_H
+#define MRS_OCTOMAP_SERVER_QUANTIZED_OCTREE_H
+
+#include <octomap/OcTreeNode.h>
+#include <octomap/OccupancyOcTreeBase.h>
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+namespace mrs_octomap_server
+{
+
+/* class QuantizedOcTreeNode //{ */
+
+/**
+ * @brief Occupancy node whose log-odds are kept on a fixed-point grid of int16_t steps, a drop-in for octomap::OcTreeNode.
+ *
+ * The node is an octomap::OcTreeNode, its float value always holds the dequantized log-odds exactly (the step is a power
+ * of two). All the code taking octomap::OcTreeNode works with it unchanged and the nodes are written as standard
+ * octomap::OcTreeNode data. The node is as large as octomap::OcTreeNode, the layout of octomap's nodes is kept.
+ */
+class QuantizedOcTreeNode : public octomap::OcTreeNode {
+
+public:
+  // the log-odds of a single quantization step
+  static constexpr float LOG_ODDS_STEP = 1.0f / 256.0f;
+
+  QuantizedOcTreeNode() : octomap::OcTreeNode() {
+  }
+
+  /**
+   * @brief the nearest step, the only rounding used for the values and the sensor model
+   */
+  static inline int16_t quantize(const float log_odds) {
+    return int16_t(std::max(-32768.0f, std::min(32767.0f, std::round(log_odds / LOG_ODDS_STEP))));
+  }
+
+  static inline float dequantize(const int16_t log_odds) {
+    return float(log_odds) * LOG_ODDS_STEP;
+  }
+
+  inline int16_t getQuantizedLogOdds() const {
+    return quantize(value);
+  }
+
+  inline void setQuantizedLogOdds(const int16_t log_odds) {
+    value = dequantize(log_odds);
+  }
+
+  inline void setLogOdds(const float log_odds) {
+    value = dequantize(quantize(log_odds));
+  }
+
+  inline void addValue(const float& log_odds) {
+    setLogOdds(value + log_odds);
+  }
+
+  /**
+   * @brief the maximum of the log-odds of the children, integer comparisons
+   */
+  int16_t getMaxChildQuantizedLogOdds() const;
+
+  inline float getMaxChildLogOdds() const {
+    return dequantize(getMaxChildQuantizedLogOdds());
+  }
+
+  inline void updateOccupancyChildren() {
+    setQuantizedLogOdds(getMaxChildQuantizedLogOdds());
+  }
+
+  /**
+   * @brief reads the float log-odds of octomap::OcTreeNode, they are quantized
+   */
+  std::istream& readData(std::istream& s);
+};
+
+//}
+
+/* class QuantizedOcTree //{ */
+
+/**
+ * @brief Occupancy octree of QuantizedOcTreeNode, selected by the QUANTIZED_OCTOMAP_SERVER compile definition.
+ *
+ * The hit, miss and clamping log-odds are snapped to the quantization steps whenever the sensor model is set, so the
+ * thresholds reported by the tree are the exact values of the clamped nodes. The hit and miss updates are looked up
+ * in tables of the clamped results indexed by the quantized log-odds of the node, the other updates are integer
+ * additions clamped by the quantized thresholds.
+ *
+ * The tree reports itself as "OcTree" and it is written as one, the messages and the map files stay readable by the
+ * standard octomap tools. The data of an octomap::OcTree are read into it through readData().
+ */
+class QuantizedOcTree : public octomap::OccupancyOcTreeBase<QuantizedOcTreeNode> {
+
+public:
+  explicit QuantizedOcTree(const double resolution);
+
+  QuantizedOcTree* create() const {
+    return new QuantizedOcTree(resolution);
+  }
+
+  std::string getTreeType() const {
+    return "OcTree";
+  }
+
+  // the setters of the sensor model snap the values to the steps and refresh the tables
+  void setProbHit(const double prob);
+  void setProbMiss(const double prob);
+  void setClampingThresMin(const double thres);
+  void setClampingThresMax(const double thres);
+
+  virtual void updateNodeLogOdds(QuantizedOcTreeNode* node, const float& update) const override;
+
+private:
+  int16_t quantized_min_;
+  int16_t quantized_max_;
+
+  // the clamped log-odds after a hit and after a miss, indexed by (quantized log-odds - quantized_min_)
+  std::vector<float> hit_table_;
+  std::vector<float> miss_table_;
+
+  void updateQuantizedModel();
+};
+
+//}
+
+}  // namespace mrs_octomap_server
+
+#endif
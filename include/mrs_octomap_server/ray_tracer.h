@@ -0,0 +1,154 @@
+#ifndef MRS_OCTOMAP_SERVER_RAY_TRACER_H
+#define MRS_OCTOMAP_SERVER_RAY_TRACER_H
+
+#include <octomap/octomap_types.h>
+
+#include <mrs_octomap_server/key_buffer.h>
+
+#include <vector>
+#include <cstdint>
+
+namespace mrs_octomap_server
+{
+
+/* class RayBatch //{ */
+
+/**
+ * @brief Keys of a batch of traced rays.
+ *
+ * The Morton codes of each ray are stored in a separate segment of a single shared buffer, in the order from the sensor
+ * origin towards the end point. The object is meant to be reused, the buffers only grow.
+ */
+class RayBatch {
+
+public:
+  size_t size() const {
+    return counts.size();
+  }
+
+  const morton_t* rayBegin(const size_t ray) const {
+    return keys.data() + begins[ray];
+  }
+
+  const morton_t* rayEnd(const size_t ray) const {
+    return keys.data() + begins[ray] + counts[ray];
+  }
+
+  uint32_t rayLength(const size_t ray) const {
+    return counts[ray];
+  }
+
+  // initial state of the traversal of a single ray
+  typedef struct
+  {
+    int32_t  key[3];
+    int32_t  end[3];
+    int32_t  step[3];
+    double   t_max[3];
+    double   t_delta[3];
+    double   length;
+    uint32_t capacity;
+  } RayInit_t;
+
+  std::vector<morton_t>  keys;
+  std::vector<uint32_t>  begins;
+  std::vector<uint32_t>  counts;
+  std::vector<RayInit_t> inits;
+};
+
+//}
+
+/* class RayTracer //{ */
+
+/**
+ * @brief 3D-DDA (Amanatides & Woo) voxel traversal of batches of rays, a replacement of OcTree::computeRayKeys().
+ *
+ * The rays are stepped in packets of 4 SIMD lanes (AVX2 or SSE2), the instruction set is picked at runtime, a scalar
+ * loop is used on other architectures. All the variants perform the same operations as computeRayKeys(), the
+ * traversal is set up and stepped in double precision, therefore, they produce the same keys. Same as
+ * computeRayKeys(), the voxel of the end point is not part of the ray.
+ */
+class RayTracer {
+
+public:
+  typedef enum
+  {
+    SIMD_NONE,
+    SIMD_SSE2,
+    SIMD_AVX2,
+  } SimdLevel_t;
+
+  RayTracer();
+
+  explicit RayTracer(const double resolution);
+
+  void setResolution(const double resolution);
+
+  /**
+   * @brief traces through the nodes the given number of levels above the leaves, the nodes are 2^level leaves wide
+   *
+   * With a level > 0, the keys of the key conversions are the keys of the nodes (the leaf keys shifted right by the
+   * level) and the traced rays contain the codes of mortonEncodeNode().
+   */
+  void setLevel(const unsigned int level);
+
+  unsigned int getLevel() const {
+    return level_;
+  }
+
+  SimdLevel_t getSimdLevel() const {
+    return simd_level_;
+  }
+
+  void setSimdLevel(const SimdLevel_t simd_level);
+
+  static SimdLevel_t detectSimdLevel();
+
+  static const char* simdLevelName(const SimdLevel_t simd_level);
+
+  /**
+   * @brief traces the rays from the origin to each of the end points
+   *
+   * @param origin the common origin of the rays
+   * @param ends the end points
+   * @param n_rays the number of the end points
+   * @param batch the output, ray i of the batch corresponds to ends[i]
+   */
+  void traceRays(const octomap::point3d& origin, const octomap::point3d* ends, const size_t n_rays, RayBatch& batch) const;
+
+  /**
+   * @brief traces the rays from origins[i] to ends[i]
+   */
+  void traceRays(const octomap::point3d* origins, const octomap::point3d* ends, const size_t n_rays, RayBatch& batch) const;
+
+  /**
+   * @brief the key conversions of the octree, the tracer can be used from other threads without access to the tree
+   */
+  bool coordToKeyChecked(const octomap::point3d& coord, octomap::OcTreeKey& key) const;
+
+  octomap::point3d keyToCoord(const octomap::OcTreeKey& key) const;
+
+private:
+  double       resolution_;
+  unsigned int level_;
+  double       node_size_;   // resolution_ * 2^level_
+  int32_t      key_offset_;  // the key of the coordinate 0 at the level
+
+  SimdLevel_t simd_level_;
+
+  void traceRays(const octomap::point3d* origins, const size_t origin_step, const octomap::point3d* ends, const size_t n_rays, RayBatch& batch) const;
+
+  bool coordToKeyChecked(const float coord, int32_t& key) const;
+
+  double keyToCoord(const int32_t key) const;
+
+  void traceScalar(RayBatch& batch) const;
+  void traceSse2(RayBatch& batch) const;
+  void traceAvx2(RayBatch& batch) const;
+};
+
+//}
+
+}  // namespace mrs_octomap_server
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef MRS_OCTOMAP_SERVER_ROLLING_GRID_H
+#define MRS_OCTOMAP_SERVER_ROLLING_GRID_H
+
+#include <octomap/OcTreeKey.h>
+
+#include <mrs_octomap_server/key_buffer.h>
+
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <cstdint>
+
+namespace mrs_octomap_server
+{
+
+/* class RollingGrid //{ */
+
+/**
+ * @brief Dense ring buffer of log-odds in a fixed-size window of octree keys.
+ *
+ * A cell is addressed by its key modulo the size of the window, therefore, moving the window does not move any data.
+ * Only the slabs of cells that leave the window are cleared, the cost of moving is proportional to the distance moved.
+ * The cells outside of the window are unknown and the updates of them are ignored.
+ *
+ * The grid remembers the cells changed since the last export, so that a tree built from it can be kept up to date
+ * by writing only those (exportChanges()).
+ *
+ * For the coarse levels, the grid counts the occupied and the saturated (clamped at the minimum) cells of each aligned
+ * cube of 2^level cells, as the inner nodes of an octree would summarize them. The coarse queries and the free coarse
+ * updates of the saturated cubes then do not visit the cells.
+ */
+class RollingGrid {
+
+public:
+  RollingGrid();
+
+  /**
+   * @brief allocates the grid, all the cells are unknown
+   *
+   * @param size_xy the horizontal size in cells
+   * @param size_z the vertical size in cells
+   * @param clamping_min the minimum log-odds value of a cell
+   * @param clamping_max the maximum log-odds value of a cell
+   * @param occupancy_threshold the log-odds value from which a cell is occupied
+   * @param n_levels the number of the coarse levels with the summaries of the cubes, at most MAX_LEVELS
+   */
+  void initialize(const int size_xy, const int size_z, const float clamping_min, const float clamping_max, const float occupancy_threshold,
+                  const unsigned int n_levels = 0);
+
+  // the cubes of the higher levels do not fit the 16-bit counters
+  static const unsigned int MAX_LEVELS = 5;
+
+  void clear();
+
+  /**
+   * @brief moves the window such that it is centered at the key, the cells leaving the window become unknown
+   */
+  void moveTo(const octomap::OcTreeKey& center);
+
+  /**
+   * @brief moves the contents of the grid by the number of cells along each axis, the window moves with them
+   *
+   * The data stay in place in the ring. The summaries of the cubes are recomputed and the next exportChanges() fails.
+   * The cells shifted out of the key space are cleared.
+   */
+  void translate(const int32_t (&shift)[3]);
+
+  bool contains(const octomap::OcTreeKey& key) const;
+
+  /**
+   * @brief the box of keys the window would cover once moved to the key by moveTo(), clipped to the key space
+   */
+  void getWindow(const octomap::OcTreeKey& center, octomap::OcTreeKey& min_key, octomap::OcTreeKey& max_key) const;
+
+  /**
+   * @brief intersects the box with the window
+   *
+   * @return false if the intersection is empty
+   */
+  bool intersectWindow(octomap::OcTreeKey& min_key, octomap::OcTreeKey& max_key) const;
+
+  bool isOccupied(const octomap::OcTreeKey& key) const;
+
+  /**
+   * @brief checks the aligned cube of 2^level cells starting at the key, true if any of them is occupied
+   */
+  bool isOccupied(const octomap::OcTreeKey& key, const unsigned int level) const;
+
+  /**
+   * @brief adds the log-odds update to the cell, an unknown cell starts at 0, the result is clamped
+   */
+  void update(const octomap::OcTreeKey& key, const float delta);
+
+  /**
+   * @brief adds the log-odds update to each cell of the aligned cube of 2^level cells starting at the key
+   */
+  void update(const octomap::OcTreeKey& key, const float delta, const unsigned int level);
+
+  /**
+   * @brief sets the value of the cell, the value is clamped
+   */
+  void setValue(const octomap::OcTreeKey& key, const float value);
+
+  /**
+   * @brief collects the known cells inside of the bounding box
+   *
+   * @param min_key the lower corner of the bounding box
+   * @param max_key the upper corner of the bounding box (inclusive)
+   * @param cells the output, sorted by the Morton code, the values are stored as the deltas
+   */
+  void exportCells(const octomap::OcTreeKey& min_key, const octomap::OcTreeKey& max_key, std::vector<KeyUpdate_t>& cells) const;
+
+  /**
+   * @brief collects the cells which make a tree exported before equal to the export of the box now
+   *
+   * These are the cells of the box changed since the previous export, the ones that became unknown have the value NaN,
+   * and the known cells which are in the box, but were not in the box of the previous export. The tree has to be cropped
+   * to the box (intersected with the window) before the cells are written into it (setLeavesBatch()).
+   *
+   * @param version the version of the grid at the previous export, it is set to the current version
+   * @param prev_min_key the lower corner of the box of the previous export
+   * @param prev_max_key the upper corner of the box of the previous export (inclusive)
+   * @param cells the output, sorted by the Morton code
+   *
+   * @return false if the changes since the version are not known (the grid was cleared or the window jumped in between),
+   * the whole box has to be exported by exportCells() then
+   */
+  bool exportChanges(uint64_t& version, const octomap::OcTreeKey& min_key, const octomap::OcTreeKey& max_key, const octomap::OcTreeKey& prev_min_key,
+                     const octomap::OcTreeKey& prev_max_key, std::vector<KeyUpdate_t>& cells);
+
+  /**
+   * @brief the version is increased by every change of the grid
+   */
+  uint64_t getVersion() const {
+    return version_;
+  }
+
+private:
+  int32_t size_[3];
+  int32_t origin_[3];  // the key of the lower corner of the window
+  int32_t offset_[3];  // the position of the lower corner of the window in the ring
+
+  float clamping_min_;
+  float clamping_max_;
+  float occupancy_threshold_;
+
+  std::vector<float> cells_;
+
+  uint64_t version_;
+
+  bool initialized_;
+
+  typedef struct
+  {
+    uint16_t n_occupied;
+    uint16_t n_saturated;
+  } Summary_t;
+
+  // the summaries of the cubes of a level, in a ring of the cubes overlapping the window
+  typedef struct
+  {
+    int32_t                size[3];
+    std::vector<Summary_t> cubes;
+  } Level_t;
+
+  // the levels 1 to levels_.size()
+  std::vector<Level_t> levels_;
+
+  // the cells changed since the last export, as the indices of the ring, each of them is listed once
+  std::vector<uint64_t> changed_flags_;
+  std::vector<uint32_t> changed_cells_;
+  uint64_t              changes_since_;
+  bool                  changes_tracked_;
+
+  /**
+   * @brief the position of the key in the ring along the axis, the key has to be inside of the window
+   */
+  int32_t ring(const int32_t coord, const int axis) const {
+    const int32_t pos = offset_[axis] + (coord - origin_[axis]);
+    return pos >= size_[axis] ? pos - size_[axis] : pos;
+  }
+
+  size_t index(const int32_t x, const int32_t y, const int32_t z) const {
+    return (size_t(ring(x, 0)) * size_[1] + size_t(ring(y, 1))) * size_[2] + size_t(ring(z, 2));
+  }
+
+  void markChanged(const size_t idx);
+
+  /**
+   * @brief the summary of the cube, nullptr if the level is not summarized or the cube is outside of the window
+   */
+  const Summary_t* summary(const octomap::OcTreeKey& key, const unsigned int level) const;
+
+  /**
+   * @brief moves the cell from the summaries of its old value to the summaries of the new one
+   */
+  void summarize(const int32_t x, const int32_t y, const int32_t z, const float old_value, const float new_value);
+
+  void clearSummaries();
+
+  void resetChanges(const bool tracked);
+
+  void clearSlab(const int axis, const int32_t coord);
+
+  void clearCell(const int32_t x, const int32_t y, const int32_t z);
+
+  void appendCells(const int32_t (&from)[3], const int32_t (&to)[3], std::vector<KeyUpdate_t>& cells) const;
+};
+
+//}
+
+}  // namespace mrs_octomap_server
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef MRS_OCTOMAP_SERVER_SATURATION_BITMAP_H
+#define MRS_OCTOMAP_SERVER_SATURATION_BITMAP_H
+
+#include <octomap/OcTreeKey.h>
+
+#include <vector>
+#include <cstdint>
+
+namespace mrs_octomap_server
+{
+
+/* class SaturationBitmap //{ */
+
+/**
+ * @brief One bit per voxel of a box of octree keys, marks the voxels whose log-odds are clamped at the minimum.
+ *
+ * The bits are addressed by the lower bits of the keys (as in RollingGrid), moving the box clears only the bits of
+ * the voxels that leave it. A cleared bit is always safe, it only means that the free updates of the voxel are applied
+ * to the map. The voxels outside of the box are never marked.
+ */
+class SaturationBitmap {
+
+public:
+  SaturationBitmap();
+
+  /**
+   * @brief allocates the bitmap, all the bits are cleared
+   *
+   * @param size_xy the maximum horizontal size of the box in voxels
+   * @param size_z the maximum vertical size of the box in voxels
+   */
+  void initialize(const int size_xy, const int size_z);
+
+  void clear();
+
+  /**
+   * @brief moves the box, the bits of the voxels that leave it are cleared
+   *
+   * @param min_key the lower corner of the box
+   * @param max_key the upper corner of the box (inclusive)
+   */
+  void moveTo(const octomap::OcTreeKey& min_key, const octomap::OcTreeKey& max_key);
+
+  bool test(const octomap::OcTreeKey& key) const;
+
+  void set(const octomap::OcTreeKey& key);
+
+  void reset(const octomap::OcTreeKey& key);
+
+private:
+  int32_t size_[3];
+  int32_t mask_[3];
+  int32_t min_[3];
+  int32_t max_[3];
+
+  // false if no box has been set or the box does not fit into the bitmap
+  bool valid_;
+
+  std::vector<uint64_t> words_;
+
+  bool inside(const octomap::OcTreeKey& key) const;
+
+  size_t index(const int32_t x, const int32_t y, const int32_t z) const {
+    return (size_t(x & mask_[0]) * size_[1] + size_t(y & mask_[1])) * size_[2] + size_t(z & mask_[2]);
+  }
+
+  void resetBit(const size_t idx) {
+    words_[idx >> 6] &= ~(uint64_t(1) << (idx & 63));
+  }
+
+  void clearSlab(const int axis, const int32_t coord);
+};
+
+//}
+
+}  // namespace mrs_octomap_server
+
+#endif
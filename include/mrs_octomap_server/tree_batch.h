@@ -0,0 +1,633 @@
+#ifndef MRS_OCTOMAP_SERVER_TREE_BATCH_H
+#define MRS_OCTOMAP_SERVER_TREE_BATCH_H
+
+#include <octomap/OcTreeKey.h>
+#include <octomap/octomap_types.h>
+
+#include <mrs_octomap_server/key_buffer.h>
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+namespace mrs_octomap_server
+{
+
+/* createRoot() //{ */
+
+/**
+ * @brief creates the root of an empty tree, without any leaf below it
+ *
+ * octomap creates the root only together with the path to a leaf, therefore, the leaf at the origin is set and deleted
+ * again, the deletion stops at the root. The root has no children then, the caller has to treat it as just created
+ * (it must not be expanded as a pruned node) and has to give it children.
+ */
+template <class TREE>
+void createRoot(TREE& octree) {
+
+  const octomap::OcTreeKey key = octree.coordToKey(0.0, 0.0, 0.0);
+
+  octree.setNodeValue(key, 0.0f);
+  octree.deleteNode(key);
+}
+
+//}
+
+/* updateNodesBatch() //{ */
+
+template <class TREE>
+void updateNodesBatchRecurs(TREE& octree, typename TREE::NodeType* node, const bool node_just_created, const unsigned int depth, const KeyUpdate_t* begin,
+                            const KeyUpdate_t* end, KeyBuffer* saturated_cells);
+
+/**
+ * @brief applies a batch of log-odds updates, equivalent to calling updateNode() for each of them in the given order
+ *
+ * The batch has to be sorted by the Morton code, the updates of the same voxel are applied in their order within
+ * the batch. The tree is descended only once for the whole batch and each touched inner node is pruned or has
+ * its occupancy refreshed only once, after all its children have been updated.
+ *
+ * The batch may also update inner nodes (mortonEncodeNode()), such an update applies to the whole volume of the node.
+ * Such a batch has to be sorted by keyUpdateLess().
+ *
+ * @param saturated_cells if given, the updated leaves which end clamped at the minimum are appended to it, in the order of the batch
+ */
+template <class TREE>
+void updateNodesBatch(TREE& octree, const std::vector<KeyUpdate_t>& batch, KeyBuffer* saturated_cells = nullptr) {
+
+  if (batch.empty()) {
+    return;
+  }
+
+  bool created_root = false;
+
+  if (!octree.getRoot()) {
+    createRoot(octree);
+    created_root = true;
+  }
+
+  updateNodesBatchRecurs(octree, octree.getRoot(), created_root, 0, batch.data(), batch.data() + batch.size(), saturated_cells);
+}
+
+/**
+ * @brief adds the log-odds update to the whole volume of the node, the unknown parts of it are created
+ */
+template <class TREE>
+void updateSubtreeLogOdds(TREE& octree, typename TREE::NodeType* node, const float delta) {
+
+  if (!octree.nodeHasChildren(node)) {
+    octree.updateNodeLogOdds(node, delta);
+    return;
+  }
+
+  for (unsigned int i = 0; i < 8; i++) {
+
+    if (!octree.nodeChildExists(node, i)) {
+      octree.createNodeChild(node, i);
+    }
+
+    updateSubtreeLogOdds(octree, octree.getNodeChild(node, i), delta);
+  }
+
+  // prune node if possible, otherwise set own probability
+  if (!octree.pruneNode(node)) {
+    node->updateOccupancyChildren();
+  }
+}
+
+template <class TREE>
+void updateNodesBatchRecurs(TREE& octree, typename TREE::NodeType* node, const bool node_just_created, const unsigned int depth, const KeyUpdate_t* begin,
+                            const KeyUpdate_t* end, KeyBuffer* saturated_cells) {
+
+  // at last level, update node, end of recursion
+  if (depth == octree.getTreeDepth()) {
+
+    for (const KeyUpdate_t* it = begin; it != end; it++) {
+      octree.updateNodeLogOdds(node, it->delta);
+    }
+
+    if (saturated_cells && node->getLogOdds() <= octree.getClampingThresMinLog()) {
+      saturated_cells->push_back(begin->code);
+    }
+
+    return;
+  }
+
+  // the updates of this node as a whole come first
+  const unsigned int level = octree.getTreeDepth() - depth;
+
+  bool just_created = node_just_created;
+
+  while (begin != end && mortonLevel(begin->code) == level) {
+
+    updateSubtreeLogOdds(octree, node, begin->delta);
+
+    // the whole node is known now, it is expanded as a pruned node
+    just_created = false;
+    begin++;
+  }
+
+  if (begin == end) {
+    return;
+  }
+
+  // a pruned node
+  if (!octree.nodeHasChildren(node) && !just_created) {
+
+    // updateNode() would skip all the updates if the node is already clamped in their direction
+    const float value   = node->getLogOdds();
+    bool        changes = false;
+
+    for (const KeyUpdate_t* it = begin; it != end; it++) {
+      if (!((it->delta >= 0 && value >= octree.getClampingThresMaxLog()) || (it->delta <= 0 && value <= octree.getClampingThresMinLog()))) {
+        changes = true;
+        break;
+      }
+    }
+
+    if (!changes) {
+
+      // the leaves of the pruned node share its value
+      if (saturated_cells && value <= octree.getClampingThresMinLog()) {
+        for (const KeyUpdate_t* it = begin; it != end; it++) {
+          if (mortonLevel(it->code) == 0) {
+            saturated_cells->push_back(it->code);
+          }
+        }
+      }
+
+      return;
+    }
+
+    octree.expandNode(node);
+  }
+
+  const int shift = 3 * int(octree.getTreeDepth() - depth - 1);
+
+  // the updates of each child form a contiguous range of the sorted batch
+  const KeyUpdate_t* child_begin = begin;
+
+  while (child_begin != end) {
+
+    const unsigned int pos = (child_begin->code >> shift) & 7;
+
+    const KeyUpdate_t* child_end = child_begin + 1;
+
+    while (child_end != end && ((child_end->code >> shift) & 7) == pos) {
+      child_end++;
+    }
+
+    bool created_node = false;
+
+    if (!octree.nodeChildExists(node, pos)) {
+      octree.createNodeChild(node, pos);
+      created_node = true;
+    }
+
+    updateNodesBatchRecurs(octree, octree.getNodeChild(node, pos), created_node, depth + 1, child_begin, child_end, saturated_cells);
+
+    child_begin = child_end;
+  }
+
+  // prune node if possible, otherwise set own probability
+  if (!octree.pruneNode(node)) {
+    node->updateOccupancyChildren();
+  }
+}
+
+//}
+
+/* setNodesBatch() //{ */
+
+template <class TREE>
+void setNodesBatchRecurs(TREE& octree, typename TREE::NodeType* node, const bool node_just_created, const unsigned int depth, const KeyUpdate_t* begin,
+                         const KeyUpdate_t* end);
+
+/**
+ * @brief sets the log-odds of the nodes, the values are stored in the deltas of the batch
+ *
+ * A node code (mortonEncodeNode()) replaces the whole subtree of the node by a single node of the value. The batch
+ * has to be sorted by keyUpdateLess() and the nodes must not overlap, as produced by collectNodes(). The occupancy of
+ * the inner nodes on the way is refreshed, the tree is not pruned.
+ */
+template <class TREE>
+void setNodesBatch(TREE& octree, const std::vector<KeyUpdate_t>& batch) {
+
+  if (batch.empty()) {
+    return;
+  }
+
+  bool created_root = false;
+
+  if (!octree.getRoot()) {
+    createRoot(octree);
+    created_root = true;
+  }
+
+  setNodesBatchRecurs(octree, octree.getRoot(), created_root, 0, batch.data(), batch.data() + batch.size());
+}
+
+template <class TREE>
+void setNodesBatchRecurs(TREE& octree, typename TREE::NodeType* node, const bool node_just_created, const unsigned int depth, const KeyUpdate_t* begin,
+                         const KeyUpdate_t* end) {
+
+  // the node itself is set, its subtree is replaced
+  if (mortonLevel(begin->code) == octree.getTreeDepth() - depth) {
+
+    for (unsigned int i = 0; i < 8; i++) {
+      if (octree.nodeChildExists(node, i)) {
+        octree.deleteNodeChild(node, i);
+      }
+    }
+
+    node->setLogOdds((end - 1)->delta);
+
+    return;
+  }
+
+  // a pruned node holds the values of all its children
+  if (!octree.nodeHasChildren(node) && !node_just_created) {
+    octree.expandNode(node);
+  }
+
+  const int shift = 3 * int(octree.getTreeDepth() - depth - 1);
+
+  // the nodes of each child form a contiguous range of the sorted batch
+  const KeyUpdate_t* child_begin = begin;
+
+  while (child_begin != end) {
+
+    const unsigned int pos = (child_begin->code >> shift) & 7;
+
+    const KeyUpdate_t* child_end = child_begin + 1;
+
+    while (child_end != end && ((child_end->code >> shift) & 7) == pos) {
+      child_end++;
+    }
+
+    bool created_node = false;
+
+    if (!octree.nodeChildExists(node, pos)) {
+      octree.createNodeChild(node, pos);
+      created_node = true;
+    }
+
+    setNodesBatchRecurs(octree, octree.getNodeChild(node, pos), created_node, depth + 1, child_begin, child_end);
+
+    child_begin = child_end;
+  }
+
+  node->updateOccupancyChildren();
+}
+
+//}
+
+/* setLeavesBatch() //{ */
+
+template <class TREE>
+bool setLeavesBatchRecurs(TREE& octree, typename TREE::NodeType* node, const bool node_just_created, const unsigned int depth, const KeyUpdate_t* begin,
+                          const KeyUpdate_t* end);
+
+/**
+ * @brief sets the log-odds of the leaves, the values are stored in the deltas of the batch, a NaN value deletes the leaf
+ *
+ * The batch has to be sorted by the Morton code, each leaf may be listed once. The touched nodes are pruned, the tree
+ * stays as pruned as if it had been built by updateNodesBatch() from its leaves.
+ */
+template <class TREE>
+void setLeavesBatch(TREE& octree, const std::vector<KeyUpdate_t>& batch) {
+
+  if (batch.empty()) {
+    return;
+  }
+
+  bool created_root = false;
+
+  if (!octree.getRoot()) {
+    createRoot(octree);
+    created_root = true;
+  }
+
+  if (!setLeavesBatchRecurs(octree, octree.getRoot(), created_root, 0, batch.data(), batch.data() + batch.size())) {
+    octree.clear();
+  }
+}
+
+/**
+ * @return false if no leaf is left below the node, the node has to be deleted by its parent
+ */
+template <class TREE>
+bool setLeavesBatchRecurs(TREE& octree, typename TREE::NodeType* node, const bool node_just_created, const unsigned int depth, const KeyUpdate_t* begin,
+                          const KeyUpdate_t* end) {
+
+  // at last level, set the node, end of recursion
+  if (depth == octree.getTreeDepth()) {
+
+    if (std::isnan(begin->delta)) {
+      return false;
+    }
+
+    node->setLogOdds(begin->delta);
+
+    return true;
+  }
+
+  // a pruned node
+  if (!octree.nodeHasChildren(node) && !node_just_created) {
+
+    const float value   = node->getLogOdds();
+    bool        changes = false;
+
+    for (const KeyUpdate_t* it = begin; it != end; it++) {
+      if (!(it->delta == value)) {
+        changes = true;
+        break;
+      }
+    }
+
+    if (!changes) {
+      return true;
+    }
+
+    octree.expandNode(node);
+  }
+
+  const int shift = 3 * int(octree.getTreeDepth() - depth - 1);
+
+  // the leaves of each child form a contiguous range of the sorted batch
+  const KeyUpdate_t* child_begin = begin;
+
+  while (child_begin != end) {
+
+    const unsigned int pos = (child_begin->code >> shift) & 7;
+
+    const KeyUpdate_t* child_end = child_begin + 1;
+
+    bool only_deletions = std::isnan(child_begin->delta);
+
+    while (child_end != end && ((child_end->code >> shift) & 7) == pos) {
+      only_deletions = only_deletions && std::isnan(child_end->delta);
+      child_end++;
+    }
+
+    bool created_node = false;
+
+    if (!octree.nodeChildExists(node, pos)) {
+
+      // the leaves are not in the tree already
+      if (only_deletions) {
+        child_begin = child_end;
+        continue;
+      }
+
+      octree.createNodeChild(node, pos);
+      created_node = true;
+    }
+
+    if (!setLeavesBatchRecurs(octree, octree.getNodeChild(node, pos), created_node, depth + 1, child_begin, child_end)) {
+      octree.deleteNodeChild(node, pos);
+    }
+
+    child_begin = child_end;
+  }
+
+  if (!octree.nodeHasChildren(node)) {
+    return false;
+  }
+
+  // prune node if possible, otherwise set own probability
+  if (!octree.pruneNode(node)) {
+    node->updateOccupancyChildren();
+  }
+
+  return true;
+}
+
+//}
+
+/* cropTree() //{ */
+
+template <class TREE>
+bool cropTreeRecurs(TREE& octree, typename TREE::NodeType* node, const unsigned int depth, const octomap::OcTreeKey& node_min_key,
+                    const octomap::OcTreeKey& min_key, const octomap::OcTreeKey& max_key);
+
+/**
+ * @brief removes the leaves outside of the box, the pruned nodes crossing the boundary are expanded
+ *
+ * The result is the same as building the tree from its leaves inside of the box.
+ *
+ * @param max_key the upper corner of the box (inclusive)
+ */
+template <class TREE>
+void cropTree(TREE& octree, const octomap::OcTreeKey& min_key, const octomap::OcTreeKey& max_key) {
+
+  if (!octree.getRoot()) {
+    return;
+  }
+
+  if (!cropTreeRecurs(octree, octree.getRoot(), 0, octomap::OcTreeKey(0, 0, 0), min_key, max_key)) {
+    octree.clear();
+  }
+}
+
+/**
+ * @return false if nothing of the node remains and the node has to be deleted by its parent
+ */
+template <class TREE>
+bool cropTreeRecurs(TREE& octree, typename TREE::NodeType* node, const unsigned int depth, const octomap::OcTreeKey& node_min_key,
+                    const octomap::OcTreeKey& min_key, const octomap::OcTreeKey& max_key) {
+
+  // the node spans this many keys along each axis
+  const unsigned int size = 1 << (octree.getTreeDepth() - depth);
+
+  bool inside = true;
+
+  for (int j = 0; j < 3; j++) {
+
+    const unsigned int node_max_key = node_min_key[j] + size - 1;
+
+    if (node_max_key < min_key[j] || node_min_key[j] > max_key[j]) {
+      return false;
+    }
+
+    if (node_min_key[j] < min_key[j] || node_max_key > max_key[j]) {
+      inside = false;
+    }
+  }
+
+  if (inside) {
+    return true;
+  }
+
+  // a pruned node crossing the boundary, only a part of its leaves stays
+  if (!octree.nodeHasChildren(node)) {
+    octree.expandNode(node);
+  }
+
+  const unsigned int half = size / 2;
+
+  bool has_children = false;
+
+  for (unsigned int i = 0; i < 8; i++) {
+
+    if (!octree.nodeChildExists(node, i)) {
+      continue;
+    }
+
+    // the child index has the x offset in the lowest bit, as in octomap::computeChildIdx()
+    octomap::OcTreeKey child_min_key = node_min_key;
+
+    child_min_key[0] += (i & 1) ? half : 0;
+    child_min_key[1] += (i & 2) ? half : 0;
+    child_min_key[2] += (i & 4) ? half : 0;
+
+    if (cropTreeRecurs(octree, octree.getNodeChild(node, i), depth + 1, child_min_key, min_key, max_key)) {
+      has_children = true;
+    } else {
+      octree.deleteNodeChild(node, i);
+    }
+  }
+
+  if (has_children) {
+    node->updateOccupancyChildren();
+  }
+
+  return has_children;
+}
+
+//}
+
+/* mergeTree() //{ */
+
+template <class TREE>
+void mergeTreeRecurs(const TREE& from, TREE& to, const typename TREE::NodeType* from_node, typename TREE::NodeType* to_node, const bool to_just_created);
+
+/**
+ * @brief merges the whole tree into another one, the known nodes of the source overwrite the destination
+ *
+ * Both trees are walked in lockstep, the subtrees missing in the destination are cloned in one step and only the
+ * nodes present in both trees are descended. The occupancy of the inner nodes of the destination is refreshed once
+ * on the way back. The result is the same as setting every leaf of the source in the destination.
+ */
+template <class TREE>
+void mergeTree(const TREE& from, TREE& to) {
+
+  if (!from.getRoot()) {
+    return;
+  }
+
+  bool created_root = false;
+
+  if (!to.getRoot()) {
+    createRoot(to);
+    created_root = true;
+  }
+
+  mergeTreeRecurs(from, to, from.getRoot(), to.getRoot(), created_root);
+}
+
+template <class TREE>
+void cloneSubtreeRecurs(const TREE& from, TREE& to, const typename TREE::NodeType* from_node, typename TREE::NodeType* to_node) {
+
+  to_node->copyData(*from_node);
+
+  for (unsigned int i = 0; i < 8; i++) {
+    if (from.nodeChildExists(from_node, i)) {
+      cloneSubtreeRecurs(from, to, from.getNodeChild(from_node, i), to.createNodeChild(to_node, i));
+    }
+  }
+}
+
+template <class TREE>
+void mergeTreeRecurs(const TREE& from, TREE& to, const typename TREE::NodeType* from_node, typename TREE::NodeType* to_node, const bool to_just_created) {
+
+  // a leaf or a pruned node of the source replaces the whole subtree
+  if (!from.nodeHasChildren(from_node)) {
+
+    for (unsigned int i = 0; i < 8; i++) {
+      if (to.nodeChildExists(to_node, i)) {
+        to.deleteNodeChild(to_node, i);
+      }
+    }
+
+    to_node->copyData(*from_node);
+
+    return;
+  }
+
+  // a pruned node holds the values of all its children
+  if (!to.nodeHasChildren(to_node) && !to_just_created) {
+    to.expandNode(to_node);
+  }
+
+  for (unsigned int i = 0; i < 8; i++) {
+
+    if (!from.nodeChildExists(from_node, i)) {
+      continue;
+    }
+
+    if (to.nodeChildExists(to_node, i)) {
+      mergeTreeRecurs(from, to, from.getNodeChild(from_node, i), to.getNodeChild(to_node, i), false);
+    } else {
+      cloneSubtreeRecurs(from, to, from.getNodeChild(from_node, i), to.createNodeChild(to_node, i));
+    }
+  }
+
+  to_node->updateOccupancyChildren();
+}
+
+//}
+
+/* copyBox() //{ */
+
+/**
+ * @brief copies the leaves of the tree inside of the box into another tree, the parts of the box outside of the map are cut off
+ *
+ * The leaves are visited by the leaf_bbx_iterator, a pruned node is copied as a whole, even if it reaches outside of the
+ * box. Nothing is copied if the box does not reach into the map.
+ */
+template <class TREE>
+void copyBox(const TREE& from, const octomap::point3d& box_min, const octomap::point3d& box_max, TREE& to) {
+
+  // the keys of the corners as in coordToKey(), clamped to the keys of the map
+  const double tree_max_val = double(1u << (from.getTreeDepth() - 1));
+  const double key_max      = 2.0 * tree_max_val - 1.0;
+  const double factor       = 1.0 / from.getResolution();
+
+  octomap::OcTreeKey min_key, max_key;
+
+  for (int j = 0; j < 3; j++) {
+
+    const double lo = std::floor(factor * box_min(j)) + tree_max_val;
+    const double hi = std::floor(factor * box_max(j)) + tree_max_val;
+
+    if (lo > hi || hi < 0.0 || lo > key_max) {
+      return;
+    }
+
+    min_key[j] = octomap::key_type(std::max(lo, 0.0));
+    max_key[j] = octomap::key_type(std::min(hi, key_max));
+  }
+
+  std::vector<KeyUpdate_t> nodes;
+
+  const unsigned int tree_depth = from.getTreeDepth();
+
+  for (auto it = from.begin_leafs_bbx(min_key, max_key), end = from.end_leafs_bbx(); it != end; ++it) {
+
+    const unsigned int level = tree_depth - it.getDepth();
+    const morton_t     code  = mortonEncode(it.getIndexKey());
+
+    nodes.push_back({level == 0 ? code : mortonEncodeNode(code, level), it->getLogOdds()});
+  }
+
+  // the nodes are set at their levels, in the depth-first order
+  std::sort(nodes.begin(), nodes.end(), keyUpdateLess);
+
+  setNodesBatch(to, nodes);
+}
+
+//}
+
+}  // namespace mrs_octomap_server
+
+#endif
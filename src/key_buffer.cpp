@@ -0,0 +1,91 @@
+#include <mrs_octomap_server/key_buffer.h>
+
+namespace mrs_octomap_server
+{
+
+/* sortUnique() //{ */
+
+void KeyBuffer::sortUnique() {
+
+  const size_t n = codes_.size();
+
+  // the radix sort does not pay off for small buffers
+  if (n < 256) {
+
+    std::sort(codes_.begin(), codes_.end());
+
+  } else {
+
+    const int n_passes = 7;  // 48-bit codes and the level of the node, 8 bits per pass
+
+    // histograms of all the passes are collected in a single sweep
+    size_t histograms[n_passes][256] = {};
+
+    for (size_t i = 0; i < n; i++) {
+      const morton_t code = codes_[i];
+      for (int pass = 0; pass < n_passes; pass++) {
+        histograms[pass][(code >> (8 * pass)) & 0xff]++;
+      }
+    }
+
+    scratch_.resize(n);
+
+    morton_t* src = codes_.data();
+    morton_t* dst = scratch_.data();
+
+    for (int pass = 0; pass < n_passes; pass++) {
+
+      const int shift = 8 * pass;
+
+      size_t* histogram = histograms[pass];
+
+      // all the codes share this byte, the pass would not change the order
+      if (histogram[(src[0] >> shift) & 0xff] == n) {
+        continue;
+      }
+
+      size_t offset = 0;
+      for (int b = 0; b < 256; b++) {
+        const size_t count = histogram[b];
+        histogram[b]       = offset;
+        offset += count;
+      }
+
+      for (size_t i = 0; i < n; i++) {
+        dst[histogram[(src[i] >> shift) & 0xff]++] = src[i];
+      }
+
+      std::swap(src, dst);
+    }
+
+    // the sorted data ended up in the scratch buffer
+    if (src != codes_.data()) {
+      codes_.swap(scratch_);
+    }
+  }
+
+  codes_.erase(std::unique(codes_.begin(), codes_.end()), codes_.end());
+}
+
+//}
+
+/* mergeUnique() //{ */
+
+void KeyBuffer::mergeUnique(const KeyBuffer& other) {
+
+  if (other.empty()) {
+    return;
+  }
+
+  scratch_.resize(codes_.size() + other.codes_.size());
+
+  auto end = std::set_union(codes_.begin(), codes_.end(), other.codes_.begin(), other.codes_.end(), scratch_.begin());
+
+  scratch_.erase(end, scratch_.end());
+
+  codes_.swap(scratch_);
+}
+
+//}
+
+}  // namespace mrs_octomap_server
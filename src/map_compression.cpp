@@ -0,0 +1,125 @@
+#include <mrs_octomap_server/map_compression.h>
+
+#include <lz4.h>
+#include <lz4hc.h>
+#include <zstd.h>
+
+#include <limits>
+#include <algorithm>
+
+namespace mrs_octomap_server
+{
+
+/* isCodecSupported() //{ */
+
+bool isCodecSupported(const std::string& codec) {
+
+  return codec == "lz4" || codec == "zstd";
+}
+
+//}
+
+/* compressMap() //{ */
+
+bool compressMap(const octomap_msgs::Octomap& map, const std::string& codec, const int level, CompressedOctomap& compressed) {
+
+  compressed.header            = map.header;
+  compressed.binary            = map.binary;
+  compressed.id                = map.id;
+  compressed.resolution        = map.resolution;
+  compressed.codec             = codec;
+  compressed.uncompressed_size = map.data.size();
+
+  const char*  src      = reinterpret_cast<const char*>(map.data.data());
+  const size_t src_size = map.data.size();
+
+  if (codec == "lz4") {
+
+    if (src_size > size_t(LZ4_MAX_INPUT_SIZE)) {
+      return false;
+    }
+
+    compressed.data.resize(LZ4_compressBound(int(src_size)));
+
+    char* dst = reinterpret_cast<char*>(compressed.data.data());
+
+    int size;
+
+    if (level > 1) {
+      size = LZ4_compress_HC(src, dst, int(src_size), int(compressed.data.size()), level);
+    } else {
+      size = LZ4_compress_default(src, dst, int(src_size), int(compressed.data.size()));
+    }
+
+    // a non-empty input never compresses to nothing
+    if (size <= 0 && src_size > 0) {
+      return false;
+    }
+
+    compressed.data.resize(std::max(size, 0));
+
+    return true;
+  }
+
+  if (codec == "zstd") {
+
+    compressed.data.resize(ZSTD_compressBound(src_size));
+
+    const size_t size = ZSTD_compress(compressed.data.data(), compressed.data.size(), src, src_size, level);
+
+    if (ZSTD_isError(size)) {
+      return false;
+    }
+
+    compressed.data.resize(size);
+
+    return true;
+  }
+
+  return false;
+}
+
+//}
+
+/* decompressMap() //{ */
+
+bool decompressMap(const CompressedOctomap& compressed, octomap_msgs::Octomap& map) {
+
+  map.header     = compressed.header;
+  map.binary     = compressed.binary;
+  map.id         = compressed.id;
+  map.resolution = compressed.resolution;
+
+  map.data.resize(compressed.uncompressed_size);
+
+  if (compressed.uncompressed_size == 0) {
+    return true;
+  }
+
+  const char* src = reinterpret_cast<const char*>(compressed.data.data());
+  char*       dst = reinterpret_cast<char*>(map.data.data());
+
+  if (compressed.codec == "lz4") {
+
+    if (compressed.uncompressed_size > uint64_t(LZ4_MAX_INPUT_SIZE) || compressed.data.size() > size_t(std::numeric_limits<int>::max())) {
+      return false;
+    }
+
+    const int size = LZ4_decompress_safe(src, dst, int(compressed.data.size()), int(map.data.size()));
+
+    return size >= 0 && uint64_t(size) == compressed.uncompressed_size;
+  }
+
+  if (compressed.codec == "zstd") {
+
+    const size_t size = ZSTD_decompress(dst, map.data.size(), src, compressed.data.size());
+
+    return !ZSTD_isError(size) && size == compressed.uncompressed_size;
+  }
+
+  return false;
+}
+
+//}
+
+}  // namespace mrs_octomap_server
@@ -0,0 +1,112 @@
+/* includes //{ */
+
+#include <ros/ros.h>
+#include <nodelet/nodelet.h>
+
+#include <octomap_msgs/Octomap.h>
+
+#include <mrs_lib/subscribe_handler.h>
+
+#include <boost/make_shared.hpp>
+
+#include <mrs_octomap_server/CompressedOctomap.h>
+#include <mrs_octomap_server/map_compression.h>
+
+//}
+
+namespace mrs_octomap_server
+{
+
+/* class MapDecompressor //{ */
+
+/**
+ * @brief Republishes a map compressed by the OctomapServer as the standard octomap_msgs/Octomap, on the side of the consumer.
+ */
+class MapDecompressor : public nodelet::Nodelet {
+
+public:
+  virtual void onInit();
+
+private:
+  ros::NodeHandle   nh_;
+  std::atomic<bool> is_initialized_ = false;
+
+  // | -------------------- topic subscribers ------------------- |
+
+  mrs_lib::SubscribeHandler<mrs_octomap_server::CompressedOctomap> sh_compressed_map_;
+
+  void callbackCompressedMap(const mrs_octomap_server::CompressedOctomap::ConstPtr msg);
+
+  // | ----------------------- publishers ----------------------- |
+
+  ros::Publisher pub_map_;
+};
+
+//}
+
+/* onInit() //{ */
+
+void MapDecompressor::onInit() {
+
+  nh_ = nodelet::Nodelet::getMTPrivateNodeHandle();
+
+  ros::Time::waitForValid();
+
+  /* subscribers //{ */
+
+  mrs_lib::SubscribeHandlerOptions shopts;
+  shopts.nh                 = nh_;
+  shopts.node_name          = "MapDecompressor";
+  shopts.no_message_timeout = mrs_lib::no_timeout;
+  shopts.threadsafe         = true;
+  shopts.autostart          = true;
+  shopts.queue_size         = 1;
+  shopts.transport_hints    = ros::TransportHints().tcpNoDelay();
+
+  sh_compressed_map_ = mrs_lib::SubscribeHandler<mrs_octomap_server::CompressedOctomap>(
+      shopts, "compressed_map_in", mrs_lib::no_timeout, std::bind(&MapDecompressor::callbackCompressedMap, this, std::placeholders::_1));
+
+  //}
+
+  /* publishers //{ */
+
+  // latched as the topics of the server
+  pub_map_ = nh_.advertise<octomap_msgs::Octomap>("map_out", 1, true);
+
+  //}
+
+  is_initialized_ = true;
+
+  ROS_INFO("[%s]: Initialized", ros::this_node::getName().c_str());
+}
+
+//}
+
+// | ------------------------ callbacks ----------------------- |
+
+/* callbackCompressedMap() //{ */
+
+void MapDecompressor::callbackCompressedMap(const mrs_octomap_server::CompressedOctomap::ConstPtr msg) {
+
+  if (!is_initialized_) {
+    return;
+  }
+
+  ROS_INFO_ONCE("[MapDecompressor]: getting compressed maps");
+
+  boost::shared_ptr<octomap_msgs::Octomap> map = boost::make_shared<octomap_msgs::Octomap>();
+
+  if (!decompressMap(*msg, *map)) {
+    ROS_ERROR_THROTTLE(1.0, "[MapDecompressor]: could not decompress the map (codec '%s')", msg->codec.c_str());
+    return;
+  }
+
+  pub_map_.publish(map);
+}
+
+//}
+
+}  // namespace mrs_octomap_server
+
+#include <pluginlib/class_list_macros.h>
+PLUGINLIB_EXPORT_CLASS(mrs_octomap_server::MapDecompressor, nodelet::Nodelet)
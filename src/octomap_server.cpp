@@ -15,6 +15,8 @@
 #include <sensor_msgs/PointCloud2.h>
 #include <sensor_msgs/LaserScan.h>
 #include <sensor_msgs/CameraInfo.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/image_encodings.h>
 #include <std_srvs/Empty.h>
 
 #include <eigen3/Eigen/Eigen>
@@ -53,13 +55,32 @@
 
 #include <filesystem>
 
-#include <mrs_octomap_server/conversions.h>
+#include <boost/make_shared.hpp>
 
-#include <laser_geometry/laser_geometry.h>
+#include <mrs_octomap_server/conversions.h>
+#include <mrs_octomap_server/key_buffer.h>
+#include <mrs_octomap_server/tree_batch.h>
+#include <mrs_octomap_server/ray_tracer.h>
+#include <mrs_octomap_server/bounded_queue.h>
+#include <mrs_octomap_server/rolling_grid.h>
+#include <mrs_octomap_server/saturation_bitmap.h>
+#include <mrs_octomap_server/quantized_octree.h>
+#include <mrs_octomap_server/map_serializer.h>
+#include <mrs_octomap_server/map_query.h>
+#include <mrs_octomap_server/map_compression.h>
 
 #include <cmath>
+#include <cstring>
+#include <thread>
+#include <condition_variable>
+
+#include <omp.h>
 
 #include <mrs_octomap_server/PoseWithSize.h>
+#include <mrs_octomap_server/OctomapDelta.h>
+#include <mrs_octomap_server/MapRoi.h>
+#include <mrs_octomap_server/GetMapRoi.h>
+#include <mrs_octomap_server/BatchQuery.h>
 
 //}
 
@@ -81,6 +102,8 @@ typedef struct
 {
   double max_range;
   int    horizontal_rays;
+  double angle_min;
+  double angle_increment;
 } SensorParams2DLidar_t;
 
 typedef struct
@@ -93,6 +116,8 @@ typedef struct
   bool   update_free_space;
   bool   clear_occupied;
   double free_ray_distance_unknown;
+  double downsampling_leaf_size;
+  std::vector<double> coarse_ray_distances;
 } SensorParams3DLidar_t;
 
 typedef struct
@@ -106,18 +131,50 @@ typedef struct
   bool   update_free_space;
   bool   clear_occupied;
   double free_ray_distance_unknown;
+  double downsampling_leaf_size;
+  std::vector<double> coarse_ray_distances;
+  int    image_stride;
+  int    image_width;  // 0 until the camera info arrives
+  int    image_height;
+  double fx, fy, cx, cy;
 } SensorParamsDepthCam_t;
 
+// immutable snapshots of the sensor models, a change of the params is published as a new snapshot
+typedef struct
+{
+  SensorParams2DLidar_t params;
+  xyz_lut_t             lut;
+} Sensor2DLidar_t;
+
+typedef struct
+{
+  SensorParams3DLidar_t params;
+  xyz_lut_t             lut;
+} Sensor3DLidar_t;
+
+typedef struct
+{
+  SensorParamsDepthCam_t params;
+  xyz_lut_t              lut;
+  vec3s_t                image_rays;  // pinhole rays of the strided depth image pixels, scaled to z = 1
+} SensorDepthCam_t;
+
 #ifdef COLOR_OCTOMAP_SERVER
 using PCLPoint      = pcl::PointXYZRGB;
 using PCLPointCloud = pcl::PointCloud<PCLPoint>;
 using OcTree_t      = octomap::ColorOcTree;
+#elif defined(QUANTIZED_OCTOMAP_SERVER)
+using PCLPoint      = pcl::PointXYZ;
+using PCLPointCloud = pcl::PointCloud<PCLPoint>;
+using OcTree_t      = QuantizedOcTree;
 #else
 using PCLPoint      = pcl::PointXYZ;
 using PCLPointCloud = pcl::PointCloud<PCLPoint>;
 using OcTree_t      = octomap::OcTree;
 #endif
 
+using OcTreeNode_t = OcTree_t::NodeType;
+
 typedef enum
 {
 
@@ -131,6 +188,49 @@ typedef enum
 
 const std::string _sensor_names_[] = {"LIDAR_3D", "LIDAR_2D", "LIDAR_1D", "DEPTH_CAMERA", "ULTRASOUND"};
 
+// a scan prepared for the integration into the local map, filled by the sensor callbacks without locking the map
+typedef struct
+{
+  octomap::point3d sensor_origin;
+
+  KeyBuffer occupied_cells;  // sorted
+  KeyBuffer free_cells;      // sorted, the rays towards the hits, already truncated by the hits
+
+  // the rays of the free vectors, truncated by the occupied cells of the map during the integration
+  KeyBuffer             free_rays;
+  std::vector<uint32_t> free_ray_lengths;
+
+  // scratch buffers of the raycasting, kept with the batch to avoid reallocation
+  KeyBuffer                                  free_ends;
+  std::vector<KeyBuffer>                     free_cells_workers;
+  std::vector<KeyBuffer>                     free_rays_workers;
+  std::vector<std::vector<uint32_t>>         free_ray_lengths_workers;
+  std::vector<RayBatch>                      ray_batches_workers;
+  std::vector<std::vector<octomap::point3d>> ray_ends_workers;
+
+  // scratch buffers of the rays traced in the distance bands, [worker][band]
+  std::vector<std::vector<RayBatch>>                      band_ray_batches_workers;
+  std::vector<std::vector<std::vector<octomap::point3d>>> band_ray_origins_workers;
+  std::vector<std::vector<std::vector<octomap::point3d>>> band_ray_ends_workers;
+} ScanBatch_t;
+
+// the serializations of a map, each one is cached for the version of the map it was taken from
+typedef struct
+{
+  std::mutex                    mutex;
+  uint64_t                      full_version   = 0;
+  uint64_t                      binary_version = 0;
+  octomap_msgs::OctomapConstPtr full;
+  octomap_msgs::OctomapConstPtr binary;
+} MapMsgCache_t;
+
+// a serialized map waiting for the compressor thread
+typedef struct
+{
+  ros::Publisher*               publisher;
+  octomap_msgs::OctomapConstPtr map;
+} CompressionJob_t;
+
 //}
 
 /* class OctomapServer //{ */
@@ -140,16 +240,22 @@ class OctomapServer : public nodelet::Nodelet {
 public:
   virtual void onInit();
 
+  ~OctomapServer();
+
   bool callbackLoadMap(mrs_msgs::String::Request& req, [[maybe_unused]] mrs_msgs::String::Response& resp);
   bool callbackSaveMap(mrs_msgs::String::Request& req, [[maybe_unused]] mrs_msgs::String::Response& resp);
 
   bool callbackResetMap(std_srvs::Empty::Request& req, std_srvs::Empty::Response& resp);
+  bool callbackRequestKeyframe(std_srvs::Empty::Request& req, std_srvs::Empty::Response& resp);
+  bool callbackGetMapRoi(mrs_octomap_server::GetMapRoi::Request& req, mrs_octomap_server::GetMapRoi::Response& resp);
+  bool callbackBatchQuery(mrs_octomap_server::BatchQuery::Request& req, mrs_octomap_server::BatchQuery::Response& resp);
 
   void callback3dLidarCloud2(const sensor_msgs::PointCloud2::ConstPtr msg, const SensorType_t sensor_type, const int sensor_id, const std::string topic,
                              const bool pcl_over_max_range = false);
 
-  void callbackLaserScan(const sensor_msgs::LaserScan::ConstPtr msg);
+  void callbackLaserScan(const sensor_msgs::LaserScan::ConstPtr msg, const int sensor_id);
   void callbackCameraInfo(const sensor_msgs::CameraInfo::ConstPtr msg, const int sensor_id);
+  void callbackDepthImage(const sensor_msgs::Image::ConstPtr msg, const int sensor_id);
   bool loadFromFile(const std::string& filename);
   bool saveToFile(const std::string& filename);
 
@@ -162,10 +268,12 @@ private:
   mrs_lib::SubscribeHandler<mrs_msgs::ControlManagerDiagnostics> sh_control_manager_diag_;
   mrs_lib::SubscribeHandler<mrs_msgs::Float64Stamped>            sh_height_;
   mrs_lib::SubscribeHandler<mrs_octomap_server::PoseWithSize>    sh_clear_box_;
+  mrs_lib::SubscribeHandler<mrs_octomap_server::MapRoi>          sh_map_roi_;
 
   std::vector<mrs_lib::SubscribeHandler<sensor_msgs::PointCloud2>> sh_3dlaser_pc2_;
   std::vector<mrs_lib::SubscribeHandler<sensor_msgs::PointCloud2>> sh_depth_cam_pc2_;
   std::vector<mrs_lib::SubscribeHandler<sensor_msgs::CameraInfo>>  sh_depth_cam_info_;
+  std::vector<mrs_lib::SubscribeHandler<sensor_msgs::Image>>       sh_depth_cam_image_;
   std::vector<mrs_lib::SubscribeHandler<sensor_msgs::LaserScan>>   sh_laser_scan_;
 
   // | ----------------------- publishers ----------------------- |
@@ -176,11 +284,24 @@ private:
   ros::Publisher pub_map_local_full_;
   ros::Publisher pub_map_local_binary_;
 
+  ros::Publisher pub_map_global_delta_;
+  ros::Publisher pub_map_local_delta_;
+
+  ros::Publisher pub_map_global_full_compressed_;
+  ros::Publisher pub_map_global_binary_compressed_;
+  ros::Publisher pub_map_local_full_compressed_;
+  ros::Publisher pub_map_local_binary_compressed_;
+
+  ros::Publisher pub_map_roi_;
+
   // | -------------------- service serviers -------------------- |
 
   ros::ServiceServer ss_reset_map_;
   ros::ServiceServer ss_save_map_;
   ros::ServiceServer ss_load_map_;
+  ros::ServiceServer ss_request_keyframe_;
+  ros::ServiceServer ss_get_map_roi_;
+  ros::ServiceServer ss_batch_query_;
 
   // | ------------------------- timers ------------------------- |
 
@@ -198,6 +319,14 @@ private:
   ros::Timer timer_local_map_resizer_;
   void       timerLocalMapResizer([[maybe_unused]] const ros::TimerEvent& event);
 
+  ros::Timer timer_map_roi_publisher_;
+  double     _map_roi_publisher_rate_;
+  void       timerMapRoiPublisher([[maybe_unused]] const ros::TimerEvent& event);
+
+  // the request and the version of the map last streamed, the roi publisher timer only
+  mrs_octomap_server::MapRoi::ConstPtr map_roi_published_request_;
+  uint64_t                             map_roi_published_version_ = 0;
+
   ros::Timer timer_persistency_;
   void       timerPersistency([[maybe_unused]] const ros::TimerEvent& event);
 
@@ -229,21 +358,79 @@ private:
   bool _local_map_publish_full_;
   bool _local_map_publish_binary_;
 
+  bool   _global_map_delta_enabled_;
+  double _global_map_delta_keyframe_period_;
+  bool   _local_map_delta_enabled_;
+  double _local_map_delta_keyframe_period_;
+
   std::unique_ptr<mrs_lib::Transformer> transformer_;
 
   std::shared_ptr<OcTree_t> octree_global_;
   std::mutex                mutex_octree_global_;
 
   std::shared_ptr<OcTree_t> octree_local_;
-  std::shared_ptr<OcTree_t> octree_local_0_;
-  std::shared_ptr<OcTree_t> octree_local_1_;
-  int                       octree_local_idx_ = 0;
   std::mutex                mutex_octree_local_;
 
+  // immutable copies of the maps for the readers (publishers, saving), taken once per version of the map,
+  // the versions are increased by every change of the maps under their mutexes
+  std::shared_ptr<const OcTree_t> octree_global_snapshot_;
+  uint64_t                        octree_global_version_          = 0;
+  uint64_t                        octree_global_snapshot_version_ = 0;
+
+  std::shared_ptr<const OcTree_t> octree_local_snapshot_;
+  uint64_t                        octree_local_version_          = 0;
+  uint64_t                        octree_local_snapshot_version_ = 0;
+
+  // a reader has fetched the snapshot, the writer refreshes it after its next write while it holds the lock anyway
+  std::atomic<bool> octree_global_snapshot_wanted_{false};
+  std::atomic<bool> octree_local_snapshot_wanted_{false};
+
+  std::mutex mutex_map_file_;
+
+  // the serialized snapshots, shared by the publishers of a map
+  MapMsgCache_t global_map_msgs_;
+  MapMsgCache_t local_map_msgs_;
+
+  int                     _serialization_n_threads_;
+  MapSerializer<OcTree_t> map_serializer_;
+
+  int                _batch_query_n_threads_;
+  MapQuery<OcTree_t> map_query_;
+
+  // the versions last sent on the latched topics, the publisher timers only
+  std::optional<uint64_t> global_map_full_published_version_;
+  std::optional<uint64_t> global_map_binary_published_version_;
+  std::optional<uint64_t> local_map_full_published_version_;
+  std::optional<uint64_t> local_map_binary_published_version_;
+  std::optional<uint64_t> global_map_full_compressed_published_version_;
+  std::optional<uint64_t> global_map_binary_compressed_published_version_;
+  std::optional<uint64_t> local_map_full_compressed_published_version_;
+  std::optional<uint64_t> local_map_binary_compressed_published_version_;
+
+  bool        _compression_global_map_enabled_;
+  bool        _compression_local_map_enabled_;
+  std::string _compression_codec_;
+  int         _compression_level_;
+
+  // the maps are compressed and published by the compressor thread, a newer map of a topic replaces the waiting one
+  std::vector<CompressionJob_t> compression_jobs_;
+  std::thread                   compressor_thread_;
+  std::atomic<bool>             compressor_running_{false};
+  std::mutex                    mutex_compressor_;
+  std::condition_variable       cv_compressor_;
+
+  void queueCompression(ros::Publisher& publisher, const octomap_msgs::OctomapConstPtr& map);
+
+  void threadCompressor();
+
   std::atomic<bool> octrees_initialized_ = false;
 
-  double     avg_time_cloud_insertion_ = 0;
-  std::mutex mutex_avg_time_cloud_insertion_;
+  // the time spent in the cloud callback, the integration is included only when it runs in the callback
+  double     avg_time_cloud_callback_ = 0;
+  std::mutex mutex_avg_time_cloud_callback_;
+
+  double     avg_time_cloud_integration_ = 0;
+  std::mutex mutex_avg_time_cloud_integration_;
 
   std::string _world_frame_;
   std::string _robot_frame_;
@@ -260,6 +447,22 @@ private:
   std::mutex mutex_local_map_dimensions_;
   double     _local_map_publisher_rate_;
 
+  bool _local_map_rolling_grid_enabled_;
+
+  // the local map as a dense window around the sensor, octree_local_ is updated from it when it is needed
+  RollingGrid              rolling_grid_;
+  uint64_t                 rolling_grid_exported_version_ = 0;
+  octomap::OcTreeKey       rolling_grid_exported_min_key_;
+  octomap::OcTreeKey       rolling_grid_exported_max_key_;
+  octomap::point3d         rolling_grid_center_;
+  std::vector<KeyUpdate_t> rolling_grid_cells_;
+
+  bool _local_map_saturation_tracking_enabled_;
+
+  // the leaves of the local map clamped at the minimum, their free updates are skipped
+  SaturationBitmap saturation_bitmap_;
+  KeyBuffer        saturated_cells_;
+
   double     local_map_duty_                 = 0;
   double     _local_map_duty_high_threshold_ = 0;
   double     _local_map_duty_low_threshold_  = 0;
@@ -269,18 +472,107 @@ private:
   bool   _unknown_rays_clear_occupied_;
   double _unknown_rays_distance_;
 
-  laser_geometry::LaserProjection projector_;
+  int  _insertion_n_threads_;
+  bool _insertion_integrator_enabled_;
+  int  _insertion_integrator_queue_size_;
+
+  // the scans of several sensors are prepared and integrated concurrently, their workers share insertion/n_threads threads
+  std::atomic<int> insertion_threads_available_;
+
+  int  reserveInsertionThreads();
+  void releaseInsertionThreads(const int n_threads);
+
+  RayTracer ray_tracer_;
+
+  // the tracers of the far distance bands, [i] traces through the nodes i + 1 levels above the leaves
+  std::vector<RayTracer> coarse_ray_tracers_;
+
+  // the scans prepared by the sensor callbacks wait in the queue for the integrator thread,
+  // the integrated batches are returned to the pool to be reused
+  std::unique_ptr<BoundedQueue<std::unique_ptr<ScanBatch_t>>> scan_queue_;
+  std::unique_ptr<BoundedQueue<std::unique_ptr<ScanBatch_t>>> scan_batch_pool_;
+
+  std::thread             integrator_thread_;
+  std::atomic<bool>       integrator_running_{false};
+  std::mutex              mutex_integrator_;
+  std::condition_variable cv_integrator_;
+
+  // buffers used by integrateScan(), kept between the scans to avoid reallocation
+  KeyBuffer                free_cells_;
+  std::vector<KeyBuffer>   free_cells_workers_;
+  std::vector<size_t>      free_ray_offsets_;
+  std::vector<KeyUpdate_t> update_batch_;
+  KeyBuffer                changed_cells_;
+
+  // the cells of the local map changed since the last merge into the global map, guarded by mutex_octree_local_
+  KeyBuffer                dirty_cells_;
+  std::vector<morton_t>    merge_codes_;
+  std::vector<KeyUpdate_t> merge_cells_;
+  std::vector<KeyUpdate_t> merge_grid_cells_;
+
+  // the values of the dirty cells which left the local map before they were merged, the batches of collectDirtyCells()
+  // end at the offsets, guarded by mutex_octree_local_
+  std::vector<KeyUpdate_t> flushed_cells_;
+  std::vector<size_t>      flushed_ends_;
+  KeyBuffer                flush_codes_;
+  KeyBuffer                kept_cells_;
+  std::vector<KeyUpdate_t> flush_batch_;
+
+  // the flushed batches taken over by the global map creator
+  std::vector<KeyUpdate_t> merge_flushed_cells_;
+  std::vector<size_t>      merge_flushed_ends_;
+  std::vector<KeyUpdate_t> merge_batch_;
+
+  // the whole local map has to be merged, e.g., after the global map has been replaced
+  std::atomic<bool> global_map_full_merge_{false};
+
+  // the deltas of the global map waiting for the publisher timer, guarded by mutex_octree_global_
+  std::vector<mrs_octomap_server::OctomapDelta> global_map_deltas_;
+  std::atomic<bool>                             global_map_keyframe_needed_{true};
+  ros::Time                                     global_map_keyframe_time_;
+
+  // the cells of the local map changed since the last delta, guarded by mutex_octree_local_
+  KeyBuffer                local_map_delta_cells_;
+  uint64_t                 local_map_delta_version_ = 0;
+  std::vector<KeyUpdate_t> local_map_delta_nodes_;
+  octomap::point3d         local_map_roi_min_;
+  octomap::point3d         local_map_roi_max_;
+  std::atomic<bool>        local_map_keyframe_needed_{true};
+  ros::Time                local_map_keyframe_time_;
+
+  void collectNodes(std::shared_ptr<OcTree_t>& octree, const KeyBuffer& codes, std::vector<KeyUpdate_t>& nodes);
+
+  void collectNodesRecurs(std::shared_ptr<OcTree_t>& octree, OcTreeNode_t* node, const morton_t first_leaf, const unsigned int level,
+                          std::vector<KeyUpdate_t>& nodes);
+
+  void collectDirtyCells(const KeyBuffer& codes, std::vector<KeyUpdate_t>& cells);
+
+  void flushDirtyCells(const octomap::OcTreeKey& min_key, const octomap::OcTreeKey& max_key);
+
+  void setFlushedCells(const std::vector<KeyUpdate_t>& cells, const std::vector<size_t>& ends, const bool deltas);
 
-  bool copyInsideBBX2(std::shared_ptr<OcTree_t>& from, std::shared_ptr<OcTree_t>& to, const octomap::point3d& p_min, const octomap::point3d& p_max);
+  void queueGlobalMapDelta(const std::vector<KeyUpdate_t>& nodes);
 
-  bool copyLocalMap(std::shared_ptr<OcTree_t>& from, std::shared_ptr<OcTree_t>& to);
+  std::shared_ptr<const OcTree_t> getGlobalMapSnapshot(uint64_t* version = nullptr, const bool latest = true);
+  std::shared_ptr<const OcTree_t> getLocalMapSnapshot(uint64_t* version = nullptr, const bool latest = true);
 
-  octomap::OcTreeNode* touchNodeRecurs(std::shared_ptr<OcTree_t>& octree, octomap::OcTreeNode* node, const octomap::OcTreeKey& key, unsigned int depth,
-                                       unsigned int max_depth);
+  std::shared_ptr<const OcTree_t> updateGlobalMapSnapshot(uint64_t* version = nullptr);
+  std::shared_ptr<const OcTree_t> updateLocalMapSnapshot(uint64_t* version = nullptr);
 
-  octomap::OcTreeNode* touchNode(std::shared_ptr<OcTree_t>& octree, const octomap::OcTreeKey& key, unsigned int target_depth);
+  octomap_msgs::OctomapConstPtr getMapMsg(MapMsgCache_t& cache, const std::shared_ptr<const OcTree_t>& octree, const uint64_t version, const bool binary);
 
-  void expandNodeRecursive(std::shared_ptr<OcTree_t>& octree, octomap::OcTreeNode* node, const unsigned int node_depth);
+  bool serializeMap(const OcTree_t& octree, const bool binary, octomap_msgs::Octomap& map);
+
+  std::shared_ptr<OcTree_t> extractRoi(const std::shared_ptr<const OcTree_t>& octree, const octomap::point3d& roi_min, const octomap::point3d& roi_max);
+
+  bool getMapRoi(const mrs_octomap_server::MapRoi& roi, octomap_msgs::Octomap& map, std::string& message, uint64_t* version = nullptr);
+
+  void fillDeltaNodes(const std::vector<KeyUpdate_t>& nodes, mrs_octomap_server::OctomapDelta& delta);
+
+  void publishKeyframe(ros::Publisher& publisher, MapMsgCache_t& cache, const std::shared_ptr<const OcTree_t>& octree,
+                       mrs_octomap_server::OctomapDelta& delta);
+
+  void expandNodeRecursive(std::shared_ptr<OcTree_t>& octree, OcTreeNode_t* node, const unsigned int node_depth);
 
   std::optional<double> getGroundZ(std::shared_ptr<OcTree_t>& octree, const double& x, const double& y);
 
@@ -288,11 +580,33 @@ private:
 
   bool createLocalMap(const std::string frame_id, const double horizontal_distance, const double vertical_distance, std::shared_ptr<OcTree_t>& octree);
 
-  virtual void insertPointCloud(const geometry_msgs::Vector3& sensorOrigin, const PCLPointCloud::ConstPtr& cloud, const PCLPointCloud::ConstPtr& free_cloud,
-                                double free_ray_distance, bool unknown_clear_occupied = false);
+  virtual void insertPointCloud(const octomap::point3d& sensor_origin, const Eigen::Ref<const vec3s_t>& hits, const Eigen::Ref<const vec3s_t>& free_vectors,
+                                double free_ray_distance, bool unknown_clear_occupied = false,
+                                const std::vector<double>& coarse_ray_distances = std::vector<double>());
+
+  void prepareScan(const octomap::point3d& sensor_origin, const Eigen::Ref<const vec3s_t>& hits, const Eigen::Ref<const vec3s_t>& free_vectors,
+                   double free_ray_distance, bool unknown_clear_occupied, const std::vector<double>& coarse_ray_distances, ScanBatch_t& batch);
+
+  void traceRaysInBands(const octomap::point3d& origin, const std::vector<octomap::point3d>& ends, const std::vector<double>& distances,
+                        std::vector<RayBatch>& band_batches, std::vector<std::vector<octomap::point3d>>& band_origins,
+                        std::vector<std::vector<octomap::point3d>>& band_ends, RayBatch& batch);
+
+  void integrateScan(const ScanBatch_t& batch);
 
-  void initialize3DLidarLUT(xyz_lut_t& lut, const SensorParams3DLidar_t sensor_params);
-  void initializeDepthCamLUT(xyz_lut_t& lut, const SensorParamsDepthCam_t sensor_params);
+  void exportRollingGrid();
+
+  void threadIntegrator();
+
+  bool getCloudXyzOffsets(const sensor_msgs::PointCloud2& cloud, uint32_t (&offsets)[3]);
+
+  size_t downsamplePoints(vec3s_t& points, const size_t n_points, const float leaf_size);
+
+  bool clipRayToBox(const octomap::point3d& origin, const octomap::point3d& end, const octomap::point3d& box_min, const octomap::point3d& box_max,
+                    float& t_min, float& t_max);
+
+  std::shared_ptr<const Sensor2DLidar_t>  initialize2DLidarLUT(const SensorParams2DLidar_t& sensor_params);
+  std::shared_ptr<const Sensor3DLidar_t>  initialize3DLidarLUT(const SensorParams3DLidar_t& sensor_params);
+  std::shared_ptr<const SensorDepthCam_t> initializeDepthCamLUT(const SensorParamsDepthCam_t& sensor_params);
 
   void timeoutGeneric(const std::string& topic, const ros::Time& last_msg, [[maybe_unused]] const int n_pubs);
 
@@ -303,17 +617,12 @@ private:
   int n_sensors_3d_lidar_;
   int n_sensors_depth_cam_;
 
-  std::vector<xyz_lut_t> sensor_2d_lidar_xyz_lut_;
-
-  std::vector<xyz_lut_t> sensor_3d_lidar_xyz_lut_;
-
-  std::vector<xyz_lut_t> sensor_depth_camera_xyz_lut_;
-
-  std::vector<SensorParams2DLidar_t> sensor_params_2d_lidar_;
+  // the snapshots are read by std::atomic_load() without locking, the writers are serialized by mutex_lut_
+  std::vector<std::shared_ptr<const Sensor2DLidar_t>> sensor_2d_lidar_;
 
-  std::vector<SensorParams3DLidar_t> sensor_params_3d_lidar_;
+  std::vector<std::shared_ptr<const Sensor3DLidar_t>> sensor_3d_lidar_;
 
-  std::vector<SensorParamsDepthCam_t> sensor_params_depth_cam_;
+  std::vector<std::shared_ptr<const SensorDepthCam_t>> sensor_depth_cam_;
 
   std::mutex mutex_lut_;
 
@@ -360,6 +669,8 @@ void OctomapServer::onInit() {
   param_loader.loadParam("global_map/compress", _global_map_compress_);
   param_loader.loadParam("global_map/publish_full", _global_map_publish_full_);
   param_loader.loadParam("global_map/publish_binary", _global_map_publish_binary_);
+  param_loader.loadParam("global_map/delta/enabled", _global_map_delta_enabled_);
+  param_loader.loadParam("global_map/delta/keyframe_period", _global_map_delta_keyframe_period_);
 
   param_loader.loadParam("local_map/size/max_width", _local_map_width_max_);
   param_loader.loadParam("local_map/size/max_height", _local_map_height_max_);
@@ -370,6 +681,15 @@ void OctomapServer::onInit() {
   param_loader.loadParam("local_map/publisher_rate", _local_map_publisher_rate_);
   param_loader.loadParam("local_map/publish_full", _local_map_publish_full_);
   param_loader.loadParam("local_map/publish_binary", _local_map_publish_binary_);
+  param_loader.loadParam("local_map/rolling_grid/enabled", _local_map_rolling_grid_enabled_);
+  param_loader.loadParam("local_map/saturation_tracking/enabled", _local_map_saturation_tracking_enabled_);
+  param_loader.loadParam("local_map/delta/enabled", _local_map_delta_enabled_);
+  param_loader.loadParam("local_map/delta/keyframe_period", _local_map_delta_keyframe_period_);
+
+  if (_local_map_rolling_grid_enabled_ && _local_map_saturation_tracking_enabled_) {
+    ROS_WARN("[OctomapServer]: the saturation tracking is not used with the rolling grid");
+    _local_map_saturation_tracking_enabled_ = false;
+  }
 
   local_map_width_  = _local_map_width_max_;
   local_map_height_ = _local_map_height_max_;
@@ -384,10 +704,36 @@ void OctomapServer::onInit() {
   param_loader.loadParam("unknown_rays/clear_occupied", _unknown_rays_clear_occupied_);
   param_loader.loadParam("unknown_rays/ray_distance", _unknown_rays_distance_);
 
+  param_loader.loadParam("insertion/n_threads", _insertion_n_threads_);
+  param_loader.loadParam("insertion/integrator_thread/enabled", _insertion_integrator_enabled_);
+  param_loader.loadParam("insertion/integrator_thread/queue_size", _insertion_integrator_queue_size_);
+
+  param_loader.loadParam("serialization/n_threads", _serialization_n_threads_);
+
+  param_loader.loadParam("map_roi/publisher_rate", _map_roi_publisher_rate_);
+
+  param_loader.loadParam("batch_query/n_threads", _batch_query_n_threads_);
+
+  param_loader.loadParam("compression/global_map", _compression_global_map_enabled_);
+  param_loader.loadParam("compression/local_map", _compression_local_map_enabled_);
+  param_loader.loadParam("compression/codec", _compression_codec_);
+  param_loader.loadParam("compression/level", _compression_level_);
+
+  if ((_compression_global_map_enabled_ || _compression_local_map_enabled_) && !isCodecSupported(_compression_codec_)) {
+    ROS_ERROR("[OctomapServer]: the compression codec '%s' is not supported, use 'lz4' or 'zstd', the compressed maps are disabled",
+              _compression_codec_.c_str());
+    _compression_global_map_enabled_ = false;
+    _compression_local_map_enabled_  = false;
+  }
+
   param_loader.loadParam("sensor_params/2d_lidar/n_sensors", n_sensors_2d_lidar_);
   param_loader.loadParam("sensor_params/3d_lidar/n_sensors", n_sensors_3d_lidar_);
   param_loader.loadParam("sensor_params/depth_camera/n_sensors", n_sensors_depth_cam_);
 
+  std::vector<SensorParams2DLidar_t>  sensor_params_2d_lidar;
+  std::vector<SensorParamsDepthCam_t> sensor_params_depth_cam;
+  std::vector<SensorParams3DLidar_t>  sensor_params_3d_lidar;
+
   for (int i = 0; i < n_sensors_2d_lidar_; i++) {
 
     std::stringstream max_range_param_name;
@@ -401,7 +747,11 @@ void OctomapServer::onInit() {
     param_loader.loadParam(max_range_param_name.str(), params.max_range);
     param_loader.loadParam(horizontal_rays_param_name.str(), params.horizontal_rays);
 
-    sensor_params_2d_lidar_.push_back(params);
+    // a full circle until the first scan arrives
+    params.angle_min       = -M_PI;
+    params.angle_increment = 2.0 * M_PI / std::max(1, params.horizontal_rays);
+
+    sensor_params_2d_lidar.push_back(params);
   }
 
   for (int i = 0; i < n_sensors_depth_cam_; i++) {
@@ -433,6 +783,15 @@ void OctomapServer::onInit() {
     std::stringstream free_ray_distance_unknown_param_name;
     free_ray_distance_unknown_param_name << "sensor_params/depth_camera/sensor_" << i << "/unknown_rays/free_ray_distance_unknown";
 
+    std::stringstream image_stride_param_name;
+    image_stride_param_name << "sensor_params/depth_camera/sensor_" << i << "/image/stride";
+
+    std::stringstream downsampling_leaf_size_param_name;
+    downsampling_leaf_size_param_name << "sensor_params/depth_camera/sensor_" << i << "/downsampling/leaf_size";
+
+    std::stringstream coarse_ray_distances_param_name;
+    coarse_ray_distances_param_name << "sensor_params/depth_camera/sensor_" << i << "/coarse_rays/distances";
+
     SensorParamsDepthCam_t params;
 
     param_loader.loadParam(max_range_param_name.str(), params.max_range);
@@ -444,8 +803,21 @@ void OctomapServer::onInit() {
     param_loader.loadParam(update_free_space_param_name.str(), params.update_free_space);
     param_loader.loadParam(clear_occupied_param_name.str(), params.clear_occupied);
     param_loader.loadParam(free_ray_distance_unknown_param_name.str(), params.free_ray_distance_unknown);
+    param_loader.loadParam(downsampling_leaf_size_param_name.str(), params.downsampling_leaf_size);
+    param_loader.loadParam(coarse_ray_distances_param_name.str(), params.coarse_ray_distances);
+    param_loader.loadParam(image_stride_param_name.str(), params.image_stride);
+
+    params.image_stride = std::max(1, params.image_stride);
 
-    sensor_params_depth_cam_.push_back(params);
+    // the intrinsics come with the camera info
+    params.image_width  = 0;
+    params.image_height = 0;
+    params.fx           = 0;
+    params.fy           = 0;
+    params.cx           = 0;
+    params.cy           = 0;
+
+    sensor_params_depth_cam.push_back(params);
   }
 
   for (int i = 0; i < n_sensors_3d_lidar_; i++) {
@@ -474,6 +846,12 @@ void OctomapServer::onInit() {
     std::stringstream free_ray_distance_unknown_param_name;
     free_ray_distance_unknown_param_name << "sensor_params/3d_lidar/sensor_" << i << "/unknown_rays/free_ray_distance_unknown";
 
+    std::stringstream downsampling_leaf_size_param_name;
+    downsampling_leaf_size_param_name << "sensor_params/3d_lidar/sensor_" << i << "/downsampling/leaf_size";
+
+    std::stringstream coarse_ray_distances_param_name;
+    coarse_ray_distances_param_name << "sensor_params/3d_lidar/sensor_" << i << "/coarse_rays/distances";
+
     SensorParams3DLidar_t params;
 
     param_loader.loadParam(max_range_param_name.str(), params.max_range);
@@ -484,8 +862,10 @@ void OctomapServer::onInit() {
     param_loader.loadParam(update_free_space_param_name.str(), params.update_free_space);
     param_loader.loadParam(clear_occupied_param_name.str(), params.clear_occupied);
     param_loader.loadParam(free_ray_distance_unknown_param_name.str(), params.free_ray_distance_unknown);
+    param_loader.loadParam(downsampling_leaf_size_param_name.str(), params.downsampling_leaf_size);
+    param_loader.loadParam(coarse_ray_distances_param_name.str(), params.coarse_ray_distances);
 
-    sensor_params_3d_lidar_.push_back(params);
+    sensor_params_3d_lidar.push_back(params);
   }
 
   param_loader.loadParam("sensor_model/hit", _probHit_);
@@ -493,6 +873,28 @@ void OctomapServer::onInit() {
   param_loader.loadParam("sensor_model/min", _thresMin_);
   param_loader.loadParam("sensor_model/max", _thresMax_);
 
+  // the distance bands of the coarse rays have to be increasing
+  {
+    auto check_bands = [](std::vector<double>& distances, const std::string& sensor_name, const int sensor_id) {
+      for (size_t j = 0; j < distances.size(); j++) {
+        if (distances[j] <= 0 || (j > 0 && distances[j] <= distances[j - 1])) {
+          ROS_ERROR("[OctomapServer]: the coarse ray distances of %s #%d have to be positive and increasing, tracing the rays at the full resolution",
+                    sensor_name.c_str(), sensor_id);
+          distances.clear();
+          return;
+        }
+      }
+    };
+
+    for (int i = 0; i < n_sensors_3d_lidar_; i++) {
+      check_bands(sensor_params_3d_lidar[i].coarse_ray_distances, _sensor_names_[LIDAR_3D], i);
+    }
+
+    for (int i = 0; i < n_sensors_depth_cam_; i++) {
+      check_bands(sensor_params_depth_cam[i].coarse_ray_distances, _sensor_names_[DEPTH_CAMERA], i);
+    }
+  }
+
   if (!param_loader.loadedSuccessfully()) {
     ROS_ERROR("[%s]: Could not load all non-optional parameters. Shutting down.", ros::this_node::getName().c_str());
     ros::requestShutdown();
@@ -502,22 +904,17 @@ void OctomapServer::onInit() {
 
   /* initialize sensor LUT model //{ */
 
-  for (int i = 0; i < n_sensors_3d_lidar_; i++) {
-
-    xyz_lut_t lut_table;
-
-    sensor_3d_lidar_xyz_lut_.push_back(lut_table);
+  for (int i = 0; i < n_sensors_2d_lidar_; i++) {
+    sensor_2d_lidar_.push_back(initialize2DLidarLUT(sensor_params_2d_lidar[i]));
+  }
 
-    initialize3DLidarLUT(sensor_3d_lidar_xyz_lut_[i], sensor_params_3d_lidar_[i]);
+  for (int i = 0; i < n_sensors_3d_lidar_; i++) {
+    sensor_3d_lidar_.push_back(initialize3DLidarLUT(sensor_params_3d_lidar[i]));
   }
 
   for (int i = 0; i < n_sensors_depth_cam_; i++) {
 
-    xyz_lut_t lut_table;
-
-    sensor_depth_camera_xyz_lut_.push_back(lut_table);
-
-    initializeDepthCamLUT(sensor_depth_camera_xyz_lut_[i], sensor_params_depth_cam_[i]);
+    sensor_depth_cam_.push_back(initializeDepthCamLUT(sensor_params_depth_cam[i]));
 
     vec_camera_info_processed_.push_back(false);
   }
@@ -532,19 +929,11 @@ void OctomapServer::onInit() {
   octree_global_->setClampingThresMin(_thresMin_);
   octree_global_->setClampingThresMax(_thresMax_);
 
-  octree_local_0_ = std::make_shared<OcTree_t>(octree_resolution_);
-  octree_local_0_->setProbHit(_probHit_);
-  octree_local_0_->setProbMiss(_probMiss_);
-  octree_local_0_->setClampingThresMin(_thresMin_);
-  octree_local_0_->setClampingThresMax(_thresMax_);
-
-  octree_local_1_ = std::make_shared<OcTree_t>(octree_resolution_);
-  octree_local_1_->setProbHit(_probHit_);
-  octree_local_1_->setProbMiss(_probMiss_);
-  octree_local_1_->setClampingThresMin(_thresMin_);
-  octree_local_1_->setClampingThresMax(_thresMax_);
-
-  octree_local_ = octree_local_0_;
+  octree_local_ = std::make_shared<OcTree_t>(octree_resolution_);
+  octree_local_->setProbHit(_probHit_);
+  octree_local_->setProbMiss(_probMiss_);
+  octree_local_->setClampingThresMin(_thresMin_);
+  octree_local_->setClampingThresMax(_thresMax_);
 
   if (_persistency_enabled_) {
     bool success = loadFromFile(_persistency_map_name_);
@@ -567,6 +956,73 @@ void OctomapServer::onInit() {
 
   //}
 
+  /* insertion buffers //{ */
+
+  free_cells_workers_.resize(std::max(1, _insertion_n_threads_));
+
+  insertion_threads_available_ = std::max(1, _insertion_n_threads_);
+
+  // the workers must not spawn their own teams (e.g., inside the tree or the PCL), that would multiply the thread count
+  omp_set_max_active_levels(1);
+
+  // the keys are emitted for the local map
+  ray_tracer_.setResolution(octree_local_->getResolution());
+
+  ROS_INFO("[OctomapServer]: raycasting using %s instructions", RayTracer::simdLevelName(ray_tracer_.getSimdLevel()));
+
+  {
+    size_t n_bands = 0;
+
+    for (auto& sensor : sensor_3d_lidar_) {
+      n_bands = std::max(n_bands, sensor->params.coarse_ray_distances.size());
+    }
+
+    for (auto& sensor : sensor_depth_cam_) {
+      n_bands = std::max(n_bands, sensor->params.coarse_ray_distances.size());
+    }
+
+    for (size_t i = 0; i < n_bands; i++) {
+      coarse_ray_tracers_.push_back(RayTracer(octree_local_->getResolution()));
+      coarse_ray_tracers_.back().setLevel(unsigned(i + 1));
+    }
+  }
+
+  if (_local_map_rolling_grid_enabled_) {
+
+    // the window covers the largest local map
+    const int size_xy = int(std::ceil(_local_map_width_max_ / octree_resolution_)) + 1;
+    const int size_z  = int(std::ceil(_local_map_height_max_ / octree_resolution_)) + 1;
+
+    // the cubes of the coarse ray tracers are summarized
+    rolling_grid_.initialize(size_xy, size_z, octree_local_->getClampingThresMinLog(), octree_local_->getClampingThresMaxLog(),
+                             octree_local_->getOccupancyThresLog(), unsigned(coarse_ray_tracers_.size()));
+
+    // the first export builds the whole tree
+    rolling_grid_exported_version_ = 0;
+    rolling_grid_exported_min_key_ = octomap::OcTreeKey(0, 0, 0);
+    rolling_grid_exported_max_key_ = octomap::OcTreeKey(0, 0, 0);
+
+    ROS_INFO("[OctomapServer]: the local map is kept in a rolling grid of %d x %d x %d cells", size_xy, size_xy, size_z);
+  }
+
+  if (_local_map_saturation_tracking_enabled_) {
+
+    // the box covers the largest local map
+    const int size_xy = int(std::ceil(_local_map_width_max_ / octree_resolution_)) + 1;
+    const int size_z  = int(std::ceil(_local_map_height_max_ / octree_resolution_)) + 1;
+
+    saturation_bitmap_.initialize(size_xy, size_z);
+  }
+
+  map_serializer_ = MapSerializer<OcTree_t>(_serialization_n_threads_);
+
+  map_query_ = MapQuery<OcTree_t>(_batch_query_n_threads_);
+
+  scan_queue_      = std::make_unique<BoundedQueue<std::unique_ptr<ScanBatch_t>>>(std::max(1, _insertion_integrator_queue_size_));
+  scan_batch_pool_ = std::make_unique<BoundedQueue<std::unique_ptr<ScanBatch_t>>>(2 * std::max(1, _insertion_integrator_queue_size_));
+
+  //}
+
   /* transformer //{ */
 
   transformer_ = std::make_unique<mrs_lib::Transformer>("OctomapServer");
@@ -578,11 +1034,28 @@ void OctomapServer::onInit() {
 
   /* publishers //{ */
 
-  pub_map_global_full_   = nh_.advertise<octomap_msgs::Octomap>("octomap_global_full_out", 1);
-  pub_map_global_binary_ = nh_.advertise<octomap_msgs::Octomap>("octomap_global_binary_out", 1);
+  // latched, the maps are published only when they change
+  pub_map_global_full_   = nh_.advertise<octomap_msgs::Octomap>("octomap_global_full_out", 1, true);
+  pub_map_global_binary_ = nh_.advertise<octomap_msgs::Octomap>("octomap_global_binary_out", 1, true);
+
+  pub_map_local_full_   = nh_.advertise<octomap_msgs::Octomap>("octomap_local_full_out", 1, true);
+  pub_map_local_binary_ = nh_.advertise<octomap_msgs::Octomap>("octomap_local_binary_out", 1, true);
+
+  if (_compression_global_map_enabled_) {
+    pub_map_global_full_compressed_   = nh_.advertise<mrs_octomap_server::CompressedOctomap>("octomap_global_full_compressed_out", 1, true);
+    pub_map_global_binary_compressed_ = nh_.advertise<mrs_octomap_server::CompressedOctomap>("octomap_global_binary_compressed_out", 1, true);
+  }
+
+  pub_map_roi_ = nh_.advertise<octomap_msgs::Octomap>("octomap_roi_out", 1);
+
+  if (_compression_local_map_enabled_) {
+    pub_map_local_full_compressed_   = nh_.advertise<mrs_octomap_server::CompressedOctomap>("octomap_local_full_compressed_out", 1, true);
+    pub_map_local_binary_compressed_ = nh_.advertise<mrs_octomap_server::CompressedOctomap>("octomap_local_binary_compressed_out", 1, true);
+  }
 
-  pub_map_local_full_   = nh_.advertise<octomap_msgs::Octomap>("octomap_local_full_out", 1);
-  pub_map_local_binary_ = nh_.advertise<octomap_msgs::Octomap>("octomap_local_binary_out", 1);
+  // the deltas have to be received in order, a dropped one is only recovered by the next keyframe
+  pub_map_global_delta_ = nh_.advertise<mrs_octomap_server::OctomapDelta>("octomap_global_delta_out", 10);
+  pub_map_local_delta_  = nh_.advertise<mrs_octomap_server::OctomapDelta>("octomap_local_delta_out", 10);
 
   //}
 
@@ -600,6 +1073,16 @@ void OctomapServer::onInit() {
   sh_control_manager_diag_ = mrs_lib::SubscribeHandler<mrs_msgs::ControlManagerDiagnostics>(shopts, "control_manager_diagnostics_in");
   sh_height_               = mrs_lib::SubscribeHandler<mrs_msgs::Float64Stamped>(shopts, "height_in");
   sh_clear_box_            = mrs_lib::SubscribeHandler<mrs_octomap_server::PoseWithSize>(shopts, "clear_box_in");
+  sh_map_roi_              = mrs_lib::SubscribeHandler<mrs_octomap_server::MapRoi>(shopts, "map_roi_in");
+
+  for (int i = 0; i < n_sensors_2d_lidar_; i++) {
+
+    std::stringstream ss;
+    ss << "lidar_2d_" << i << "_in";
+
+    sh_laser_scan_.push_back(mrs_lib::SubscribeHandler<sensor_msgs::LaserScan>(
+        shopts, ss.str(), ros::Duration(2.0), std::bind(&OctomapServer::callbackLaserScan, this, std::placeholders::_1, i)));
+  }
 
   for (int i = 0; i < n_sensors_3d_lidar_; i++) {
 
@@ -640,6 +1123,15 @@ void OctomapServer::onInit() {
         shopts, ss.str(), ros::Duration(2.0), std::bind(&OctomapServer::callbackCameraInfo, this, std::placeholders::_1, i)));
   }
 
+  for (int i = 0; i < n_sensors_depth_cam_; i++) {
+
+    std::stringstream ss;
+    ss << "depth_camera_" << i << "_image_in";
+
+    sh_depth_cam_image_.push_back(mrs_lib::SubscribeHandler<sensor_msgs::Image>(
+        shopts, ss.str(), ros::Duration(2.0), std::bind(&OctomapServer::callbackDepthImage, this, std::placeholders::_1, i)));
+  }
+
   //}
 
   /* service servers //{ */
@@ -648,6 +1140,10 @@ void OctomapServer::onInit() {
   ss_save_map_  = nh_.advertiseService("save_map_in", &OctomapServer::callbackSaveMap, this);
   ss_load_map_  = nh_.advertiseService("load_map_in", &OctomapServer::callbackLoadMap, this);
 
+  ss_request_keyframe_ = nh_.advertiseService("request_keyframe_in", &OctomapServer::callbackRequestKeyframe, this);
+  ss_get_map_roi_      = nh_.advertiseService("get_map_roi_in", &OctomapServer::callbackGetMapRoi, this);
+  ss_batch_query_      = nh_.advertiseService("batch_query_in", &OctomapServer::callbackBatchQuery, this);
+
   //}
 
   /* timers //{ */
@@ -661,6 +1157,8 @@ void OctomapServer::onInit() {
 
   timer_local_map_resizer_ = nh_.createTimer(ros::Rate(1.0), &OctomapServer::timerLocalMapResizer, this);
 
+  timer_map_roi_publisher_ = nh_.createTimer(ros::Rate(_map_roi_publisher_rate_), &OctomapServer::timerMapRoiPublisher, this);
+
   if (_persistency_enabled_) {
     timer_persistency_ = nh_.createTimer(ros::Rate(1.0 / _persistency_save_time_), &OctomapServer::timerPersistency, this);
   }
@@ -678,6 +1176,26 @@ void OctomapServer::onInit() {
 
   //}
 
+  /* integrator thread //{ */
+
+  if (_insertion_integrator_enabled_) {
+
+    integrator_running_ = true;
+    integrator_thread_  = std::thread(&OctomapServer::threadIntegrator, this);
+  }
+
+  //}
+
+  /* compressor thread //{ */
+
+  if (_compression_global_map_enabled_ || _compression_local_map_enabled_) {
+
+    compressor_running_ = true;
+    compressor_thread_  = std::thread(&OctomapServer::threadCompressor, this);
+  }
+
+  //}
+
   is_initialized_ = true;
 
   ROS_INFO("[%s]: Initialized", ros::this_node::getName().c_str());
@@ -685,6 +1203,39 @@ void OctomapServer::onInit() {
 
 //}
 
+/* ~OctomapServer() //{ */
+
+OctomapServer::~OctomapServer() {
+
+  if (integrator_thread_.joinable()) {
+
+    {
+      std::scoped_lock lock(mutex_integrator_);
+
+      integrator_running_ = false;
+    }
+
+    cv_integrator_.notify_one();
+
+    integrator_thread_.join();
+  }
+
+  if (compressor_thread_.joinable()) {
+
+    {
+      std::scoped_lock lock(mutex_compressor_);
+
+      compressor_running_ = false;
+    }
+
+    cv_compressor_.notify_one();
+
+    compressor_thread_.join();
+  }
+}
+
+//}
+
 // | --------------------- topic callbacks -------------------- |
 
 /* callbackCameraInfo() //{ */
@@ -701,25 +1252,34 @@ void OctomapServer::callbackCameraInfo(const sensor_msgs::CameraInfo::ConstPtr m
 
   std::scoped_lock lock(mutex_lut_);
 
-  sensor_params_depth_cam_[sensor_id].horizontal_fov = 2 * atan(msg->width / (2 * msg->K[0]));
-  sensor_params_depth_cam_[sensor_id].vertical_fov   = 2 * atan(msg->height / (2 * msg->K[4]));
+  SensorParamsDepthCam_t params = std::atomic_load(&sensor_depth_cam_[sensor_id])->params;
+
+  params.horizontal_fov = 2 * atan(msg->width / (2 * msg->K[0]));
+  params.vertical_fov   = 2 * atan(msg->height / (2 * msg->K[4]));
+
+  // the pinhole model for the depth images
+  params.image_width  = msg->width;
+  params.image_height = msg->height;
+  params.fx           = msg->K[0];
+  params.fy           = msg->K[4];
+  params.cx           = msg->K[2];
+  params.cy           = msg->K[5];
 
   ROS_INFO(
       "[OctomapServer]: Changing sensor params based on camera_info for depth camera %d to %d horizontal rays, %d vertical rays, %.3f horizontal FOV, %.3f "
       "vertical FOV.",
-      (int)sensor_id, sensor_params_depth_cam_[sensor_id].horizontal_rays, sensor_params_depth_cam_[sensor_id].vertical_rays,
-      sensor_params_depth_cam_[sensor_id].horizontal_fov * (180 / M_PI), sensor_params_depth_cam_[sensor_id].vertical_fov * (180 / M_PI));
+      (int)sensor_id, params.horizontal_rays, params.vertical_rays, params.horizontal_fov * (180 / M_PI), params.vertical_fov * (180 / M_PI));
 
-  initializeDepthCamLUT(sensor_depth_camera_xyz_lut_[sensor_id], sensor_params_depth_cam_[sensor_id]);
+  std::atomic_store(&sensor_depth_cam_[sensor_id], initializeDepthCamLUT(params));
 
   vec_camera_info_processed_.at(sensor_id) = true;
 }
 
 //}
 
-/* callbackLaserScan() //{ */
+/* callbackDepthImage() //{ */
 
-void OctomapServer::callbackLaserScan(const sensor_msgs::LaserScan::ConstPtr msg) {
+void OctomapServer::callbackDepthImage(const sensor_msgs::Image::ConstPtr msg, const int sensor_id) {
 
   if (!is_initialized_) {
     return;
@@ -729,6 +1289,11 @@ void OctomapServer::callbackLaserScan(const sensor_msgs::LaserScan::ConstPtr msg
     return;
   }
 
+  if (!vec_camera_info_processed_.at(sensor_id)) {
+    ROS_WARN_THROTTLE(1.0, "[OctomapServer]: Received depth image for depth camera %d but no camera info received yet.", sensor_id);
+    return;
+  }
+
   if (!_map_while_grounded_) {
 
     if (!sh_control_manager_diag_.hasMsg()) {
@@ -753,70 +1318,128 @@ void OctomapServer::callbackLaserScan(const sensor_msgs::LaserScan::ConstPtr msg
     }
   }
 
-  sensor_msgs::LaserScanConstPtr scan = msg;
+  // 16-bit depth is in millimeters, float depth in meters
+  const bool is_16u = msg->encoding == sensor_msgs::image_encodings::TYPE_16UC1 || msg->encoding == sensor_msgs::image_encodings::MONO16;
+  const bool is_32f = msg->encoding == sensor_msgs::image_encodings::TYPE_32FC1;
+
+  if (!is_16u && !is_32f) {
+    ROS_WARN_THROTTLE(1.0, "[OctomapServer]: depth image from depth camera %d has unsupported encoding '%s', expected 16UC1 or 32FC1", sensor_id,
+                      msg->encoding.c_str());
+    return;
+  }
 
-  PCLPointCloud::Ptr pc              = boost::make_shared<PCLPointCloud>();
-  PCLPointCloud::Ptr free_vectors_pc = boost::make_shared<PCLPointCloud>();
+  const size_t pixel_size = is_16u ? sizeof(uint16_t) : sizeof(float);
 
-  Eigen::Matrix4f                 sensorToWorld;
-  geometry_msgs::TransformStamped sensorToWorldTf;
+  if (size_t(msg->height) * msg->step > msg->data.size() || size_t(msg->width) * pixel_size > msg->step) {
+    ROS_WARN_THROTTLE(1.0, "[OctomapServer]: depth image from depth camera %d has inconsistent dimensions, can not integrate data!", sensor_id);
+    return;
+  }
 
-  auto res = transformer_->getTransform(scan->header.frame_id, _world_frame_, scan->header.stamp);
+  // load the sensor model once for the whole image
+  std::shared_ptr<const SensorDepthCam_t> sensor = std::atomic_load(&sensor_depth_cam_[sensor_id]);
+
+  const SensorParamsDepthCam_t& params = sensor->params;
+
+  if (int(msg->width) != params.image_width || int(msg->height) != params.image_height) {
+    ROS_WARN_THROTTLE(1.0, "[OctomapServer]: depth image from depth camera %d is %dx%d, but the camera info is for %dx%d, can not integrate data!", sensor_id,
+                      msg->width, msg->height, params.image_width, params.image_height);
+    return;
+  }
+
+  auto res = transformer_->getTransform(msg->header.frame_id, _world_frame_, msg->header.stamp);
 
   if (!res) {
-    ROS_WARN_THROTTLE(1.0, "[OctomapServer]: insertLaserScanCallback(): could not find tf from %s to %s", scan->header.frame_id.c_str(), _world_frame_.c_str());
+    ROS_WARN_THROTTLE(1.0, "[OctomapServer]: callbackDepthImage(): could not find tf from %s to %s", msg->header.frame_id.c_str(), _world_frame_.c_str());
     return;
   }
 
-  pcl_ros::transformAsMatrix(res.value().transform, sensorToWorld);
+  Eigen::Matrix4f                 sensorToWorld;
+  geometry_msgs::TransformStamped sensorToWorldTf = res.value();
+  pcl_ros::transformAsMatrix(sensorToWorldTf.transform, sensorToWorld);
+
+  const Eigen::Matrix3f rotation    = sensorToWorld.topLeftCorner<3, 3>();
+  const vec3_t          translation = sensorToWorld.topRightCorner<3, 1>();
+
+  const uint32_t stride   = uint32_t(params.image_stride);
+  const size_t   n_pixels = size_t(sensor->image_rays.cols());
+  const size_t   n_cols   = (size_t(params.image_width) + stride - 1) / stride;
+
+  // the buffers only grow, they are not reallocated once they fit the largest image processed by this thread
+  thread_local vec3s_t hits;
+  thread_local vec3s_t free_vectors;
+
+  if (size_t(hits.cols()) < n_pixels) {
+    hits.resize(3, n_pixels);
+    free_vectors.resize(3, n_pixels);
+  }
+
+  size_t n_hits         = 0;
+  size_t n_free_vectors = 0;
+
+  const float max_range_sq     = float(params.max_range * params.max_range);
+  const float unknown_distance = float(params.free_ray_distance_unknown);
 
-  // laser scan to point cloud
-  sensor_msgs::PointCloud2 ros_cloud;
-  projector_.projectLaser(*scan, ros_cloud);
-  pcl::fromROSMsg(ros_cloud, *pc);
+  for (uint32_t row = 0; row < msg->height; row += stride) {
 
-  // compute free rays, if required
-  if (_unknown_rays_update_free_space_) {
+    const uint8_t* row_data = msg->data.data() + size_t(row) * msg->step;
+    const size_t   lut_row  = (row / stride) * n_cols;
 
-    sensor_msgs::LaserScan free_scan = *scan;
+    for (uint32_t col = 0; col < msg->width; col += stride) {
 
-    double free_scan_distance = (scan->range_max - 1.0) < _unknown_rays_distance_ ? (scan->range_max - 1.0) : _unknown_rays_distance_;
+      float depth;
 
-    for (int i = 0; i < scan->ranges.size(); i++) {
-      if (scan->ranges[i] > scan->range_max || scan->ranges[i] < scan->range_min) {
-        free_scan.ranges[i] = scan->range_max - 1.0;  // valid under max range
+      if (is_16u) {
+        uint16_t depth_mm;
+        memcpy(&depth_mm, row_data + col * pixel_size, sizeof(uint16_t));
+        depth = float(depth_mm) * 0.001f;
       } else {
-        free_scan.ranges[i] = scan->range_min - 1.0;  // definitely invalid
+        memcpy(&depth, row_data + col * pixel_size, sizeof(float));
       }
-    }
 
-    sensor_msgs::PointCloud2 free_cloud;
-    projector_.projectLaser(free_scan, free_cloud);
+      const vec3_t ray = sensor->image_rays.col(lut_row + col / stride);
 
-    pcl::fromROSMsg(free_cloud, *free_vectors_pc);
-  }
+      if (!std::isfinite(depth) || depth <= 0) {
+
+        // datapoint is missing, update only free space, if desired
+        if (params.update_free_space) {
+          free_vectors.col(n_free_vectors++) = rotation * (ray.normalized() * unknown_distance) + translation;
+        }
+
+        continue;
+      }
+
+      const vec3_t pt = ray * depth;
 
-  free_vectors_pc->header = pc->header;
+      if (pt.squaredNorm() > max_range_sq) {
 
-  // transform to the map frame
+        // point is over the max range, update only free space
+        free_vectors.col(n_free_vectors++) = rotation * pt + translation;
 
-  pcl::transformPointCloud(*pc, *pc, sensorToWorld);
-  pcl::transformPointCloud(*free_vectors_pc, *free_vectors_pc, sensorToWorld);
+      } else {
 
-  pc->header.frame_id              = _world_frame_;
-  free_vectors_pc->header.frame_id = _world_frame_;
+        // point is ok
+        hits.col(n_hits++) = rotation * pt + translation;
+      }
+    }
+  }
 
-  insertPointCloud(sensorToWorldTf.transform.translation, pc, free_vectors_pc, _unknown_rays_distance_, _unknown_rays_clear_occupied_);
+  // one endpoint per leaf, the rays are then cast only from the remaining ones
+  if (params.downsampling_leaf_size > 0) {
+    n_hits         = downsamplePoints(hits, n_hits, float(params.downsampling_leaf_size));
+    n_free_vectors = downsamplePoints(free_vectors, n_free_vectors, float(params.downsampling_leaf_size));
+  }
 
   const octomap::point3d sensor_origin = octomap::pointTfToOctomap(sensorToWorldTf.transform.translation);
+
+  insertPointCloud(sensor_origin, hits.leftCols(n_hits), free_vectors.leftCols(n_free_vectors), params.free_ray_distance, params.clear_occupied,
+                   params.coarse_ray_distances);
 }
 
 //}
 
-/* callback3dLidarCloud2() //{ */
+/* callbackLaserScan() //{ */
 
-void OctomapServer::callback3dLidarCloud2(const sensor_msgs::PointCloud2::ConstPtr msg, const SensorType_t sensor_type, const int sensor_id,
-                                          const std::string topic, const bool pcl_over_max_range) {
+void OctomapServer::callbackLaserScan(const sensor_msgs::LaserScan::ConstPtr msg, const int sensor_id) {
 
   if (!is_initialized_) {
     return;
@@ -826,11 +1449,6 @@ void OctomapServer::callback3dLidarCloud2(const sensor_msgs::PointCloud2::ConstP
     return;
   }
 
-  if (sensor_type == DEPTH_CAMERA && !vec_camera_info_processed_.at(sensor_id)) {
-    ROS_WARN_THROTTLE(1.0, "[OctomapServer]: Received data for depth camera %d but no camera info received yet.", sensor_id);
-    return;
-  }
-
   if (!_map_while_grounded_) {
 
     if (!sh_control_manager_diag_.hasMsg()) {
@@ -855,15 +1473,156 @@ void OctomapServer::callback3dLidarCloud2(const sensor_msgs::PointCloud2::ConstP
     }
   }
 
-  sensor_msgs::PointCloud2ConstPtr cloud = msg;
+  sensor_msgs::LaserScanConstPtr scan = msg;
 
-  ros::Time time_start = ros::Time::now();
+  auto res = transformer_->getTransform(scan->header.frame_id, _world_frame_, scan->header.stamp);
+
+  if (!res) {
+    ROS_WARN_THROTTLE(1.0, "[OctomapServer]: callbackLaserScan(): could not find tf from %s to %s", scan->header.frame_id.c_str(), _world_frame_.c_str());
+    return;
+  }
+
+  Eigen::Matrix4f                 sensorToWorld;
+  geometry_msgs::TransformStamped sensorToWorldTf = res.value();
+  pcl_ros::transformAsMatrix(sensorToWorldTf.transform, sensorToWorld);
+
+  const int n_rays = int(scan->ranges.size());
+
+  // rebuild the sensor model only when the geometry of the scan changes
+  {
+    std::shared_ptr<const Sensor2DLidar_t> sensor = std::atomic_load(&sensor_2d_lidar_[sensor_id]);
+
+    if (sensor->params.horizontal_rays != n_rays || sensor->params.angle_min != scan->angle_min ||
+        sensor->params.angle_increment != scan->angle_increment) {
+
+      std::scoped_lock lock(mutex_lut_);
+
+      SensorParams2DLidar_t params = std::atomic_load(&sensor_2d_lidar_[sensor_id])->params;
+
+      // another callback might have rebuilt it while this one was waiting for the lock
+      if (params.horizontal_rays != n_rays || params.angle_min != scan->angle_min || params.angle_increment != scan->angle_increment) {
+
+        params.horizontal_rays = n_rays;
+        params.angle_min       = scan->angle_min;
+        params.angle_increment = scan->angle_increment;
+
+        ROS_INFO("[OctomapServer]: Changing sensor params for 2D lidar %d to %d rays, %.3f min angle, %.3f angle increment.", sensor_id,
+                 params.horizontal_rays, params.angle_min, params.angle_increment);
+
+        std::atomic_store(&sensor_2d_lidar_[sensor_id], initialize2DLidarLUT(params));
+      }
+    }
+  }
+
+  std::shared_ptr<const Sensor2DLidar_t> sensor = std::atomic_load(&sensor_2d_lidar_[sensor_id]);
+
+  const Eigen::Matrix3f rotation    = sensorToWorld.topLeftCorner<3, 3>();
+  const vec3_t          translation = sensorToWorld.topRightCorner<3, 1>();
+
+  // the buffers only grow, they are not reallocated once they fit the largest scan processed by this thread
+  thread_local vec3s_t directions;
+  thread_local vec3s_t hits;
+  thread_local vec3s_t free_vectors;
+
+  if (hits.cols() < n_rays) {
+    hits.resize(3, n_rays);
+    free_vectors.resize(3, n_rays);
+  }
+
+  // the directions of the rays in the map frame
+  directions.noalias() = rotation * sensor->lut.directions;
+
+  const float range_min = scan->range_min;
+  const float range_max = scan->range_max;
+  const float max_range = float(sensor->params.max_range);
+
+  // the free space along the missing measurements is updated up to this distance, as if there was a valid measurement
+  const float unknown_distance = range_max - 1.0f;
+
+  size_t n_hits         = 0;
+  size_t n_free_vectors = 0;
+
+  for (int i = 0; i < n_rays; i++) {
+
+    const float range = scan->ranges[i];
+
+    if (range >= range_min && range <= range_max) {
+
+      if (range <= max_range) {
+        hits.col(n_hits++) = directions.col(i) * range + translation;
+      } else {
+        // over the max range of the sensor model, update only free space
+        free_vectors.col(n_free_vectors++) = directions.col(i) * range + translation;
+      }
+
+    } else if (_unknown_rays_update_free_space_ && !std::isnan(range)) {
+
+      // no return, e.g., the range is inf or 0
+      free_vectors.col(n_free_vectors++) = directions.col(i) * unknown_distance + translation;
+    }
+  }
+
+  const octomap::point3d sensor_origin = octomap::pointTfToOctomap(sensorToWorldTf.transform.translation);
+
+  insertPointCloud(sensor_origin, hits.leftCols(n_hits), free_vectors.leftCols(n_free_vectors), _unknown_rays_distance_, _unknown_rays_clear_occupied_);
+}
+
+//}
+
+/* callback3dLidarCloud2() //{ */
+
+void OctomapServer::callback3dLidarCloud2(const sensor_msgs::PointCloud2::ConstPtr msg, const SensorType_t sensor_type, const int sensor_id,
+                                          const std::string topic, const bool pcl_over_max_range) {
+
+  if (!is_initialized_) {
+    return;
+  }
+
+  if (!octrees_initialized_) {
+    return;
+  }
+
+  if (sensor_type == DEPTH_CAMERA && !vec_camera_info_processed_.at(sensor_id)) {
+    ROS_WARN_THROTTLE(1.0, "[OctomapServer]: Received data for depth camera %d but no camera info received yet.", sensor_id);
+    return;
+  }
+
+  if (!_map_while_grounded_) {
+
+    if (!sh_control_manager_diag_.hasMsg()) {
+
+      ROS_WARN_THROTTLE(1.0, "[OctomapServer]: missing control manager diagnostics, can not integrate data!");
+      return;
+
+    } else {
+
+      ros::Time last_time = sh_control_manager_diag_.lastMsgTime();
+
+      if ((ros::Time::now() - last_time).toSec() > 1.0) {
+        ROS_WARN_THROTTLE(1.0, "[OctomapServer]: control manager diagnostics too old, can not integrate data!");
+        return;
+      }
+
+      // TODO is this the best option?
+      if (!sh_control_manager_diag_.getMsg()->flying_normally) {
+        ROS_INFO_THROTTLE(1.0, "[OctomapServer]: not flying normally, therefore, not integrating data");
+        return;
+      }
+    }
+  }
+
+  sensor_msgs::PointCloud2ConstPtr cloud = msg;
 
-  PCLPointCloud::Ptr pc              = boost::make_shared<PCLPointCloud>();
-  PCLPointCloud::Ptr free_vectors_pc = boost::make_shared<PCLPointCloud>();
-  PCLPointCloud::Ptr hit_pc          = boost::make_shared<PCLPointCloud>();
+  ros::Time time_start = ros::Time::now();
+
+  // the points are read directly from the message data
+  uint32_t xyz_offsets[3];
 
-  pcl::fromROSMsg(*cloud, *pc);
+  if (!getCloudXyzOffsets(*cloud, xyz_offsets)) {
+    ROS_WARN_THROTTLE(1.0, "[OctomapServer]: point cloud from %s #%d on topic %s does not have valid float32 x, y, z fields, can not integrate data!",
+                      _sensor_names_[sensor_type].c_str(), sensor_id, topic.c_str());
+    return;
+  }
 
   auto res = transformer_->getTransform(cloud->header.frame_id, _world_frame_, cloud->header.stamp);
 
@@ -876,8 +1635,6 @@ void OctomapServer::callback3dLidarCloud2(const sensor_msgs::PointCloud2::ConstP
   geometry_msgs::TransformStamped sensorToWorldTf = res.value();
   pcl_ros::transformAsMatrix(sensorToWorldTf.transform, sensorToWorld);
 
-  double max_range;
-
   if (!pcl_over_max_range) {
 
     // generate sensor lookup table for free space raycasting based on pointcloud dimensions
@@ -886,42 +1643,57 @@ void OctomapServer::callback3dLidarCloud2(const sensor_msgs::PointCloud2::ConstP
                         _sensor_names_[sensor_type].c_str(), sensor_id, topic.c_str());
     }
 
+    // the rebuilt sensor model is published as a new snapshot, the writers are serialized by mutex_lut_
     switch (sensor_type) {
 
       case LIDAR_3D: {
 
-        std::scoped_lock lock(mutex_lut_);
-
         // change number of rays if it differs from the pointcloud dimensions
-        if (sensor_params_3d_lidar_[sensor_id].horizontal_rays != cloud->width || sensor_params_3d_lidar_[sensor_id].vertical_rays != cloud->height) {
-          sensor_params_3d_lidar_[sensor_id].horizontal_rays = cloud->width;
-          sensor_params_3d_lidar_[sensor_id].vertical_rays   = cloud->height;
-          ROS_INFO("[OctomapServer]: Changing sensor params for lidar %d to %d horizontal rays, %d vertical rays.", sensor_id,
-                   sensor_params_3d_lidar_[sensor_id].horizontal_rays, sensor_params_3d_lidar_[sensor_id].vertical_rays);
-          initialize3DLidarLUT(sensor_3d_lidar_xyz_lut_[sensor_id], sensor_params_3d_lidar_[sensor_id]);
-        }
+        if (std::atomic_load(&sensor_3d_lidar_[sensor_id])->params.horizontal_rays != cloud->width ||
+            std::atomic_load(&sensor_3d_lidar_[sensor_id])->params.vertical_rays != cloud->height) {
+
+          std::scoped_lock lock(mutex_lut_);
+
+          SensorParams3DLidar_t params = std::atomic_load(&sensor_3d_lidar_[sensor_id])->params;
+
+          // another callback might have rebuilt it while this one was waiting for the lock
+          if (params.horizontal_rays != cloud->width || params.vertical_rays != cloud->height) {
+
+            params.horizontal_rays = cloud->width;
+            params.vertical_rays   = cloud->height;
+            ROS_INFO("[OctomapServer]: Changing sensor params for lidar %d to %d horizontal rays, %d vertical rays.", sensor_id, params.horizontal_rays,
+                     params.vertical_rays);
 
-        max_range = sensor_params_3d_lidar_[sensor_id].max_range;
+            std::atomic_store(&sensor_3d_lidar_[sensor_id], initialize3DLidarLUT(params));
+          }
+        }
 
         break;
       }
 
       case DEPTH_CAMERA: {
 
-        std::scoped_lock lock(mutex_lut_);
-
         // change number of rays if it differs from the pointcloud dimensions
-        if (sensor_params_depth_cam_[sensor_id].horizontal_rays != cloud->width || sensor_params_depth_cam_[sensor_id].vertical_rays != cloud->height) {
-          sensor_params_depth_cam_[sensor_id].horizontal_rays = cloud->width;
-          sensor_params_depth_cam_[sensor_id].vertical_rays   = cloud->height;
-          ROS_INFO(
-              "[OctomapServer]: Changing sensor params for depth camera %d to %d horizontal rays, %d vertical rays, %.3f horizontal FOV, %.3f vertical FOV.",
-              sensor_id, sensor_params_depth_cam_[sensor_id].horizontal_rays, sensor_params_depth_cam_[sensor_id].vertical_rays,
-              sensor_params_depth_cam_[sensor_id].horizontal_fov * (180 / M_PI), sensor_params_depth_cam_[sensor_id].vertical_fov * (180 / M_PI));
-          initializeDepthCamLUT(sensor_depth_camera_xyz_lut_[sensor_id], sensor_params_depth_cam_[sensor_id]);
-        }
+        if (std::atomic_load(&sensor_depth_cam_[sensor_id])->params.horizontal_rays != cloud->width ||
+            std::atomic_load(&sensor_depth_cam_[sensor_id])->params.vertical_rays != cloud->height) {
+
+          std::scoped_lock lock(mutex_lut_);
+
+          SensorParamsDepthCam_t params = std::atomic_load(&sensor_depth_cam_[sensor_id])->params;
+
+          // another callback might have rebuilt it while this one was waiting for the lock
+          if (params.horizontal_rays != cloud->width || params.vertical_rays != cloud->height) {
+
+            params.horizontal_rays = cloud->width;
+            params.vertical_rays   = cloud->height;
+            ROS_INFO(
+                "[OctomapServer]: Changing sensor params for depth camera %d to %d horizontal rays, %d vertical rays, %.3f horizontal FOV, %.3f vertical "
+                "FOV.",
+                sensor_id, params.horizontal_rays, params.vertical_rays, params.horizontal_fov * (180 / M_PI), params.vertical_fov * (180 / M_PI));
 
-        max_range = sensor_params_depth_cam_[sensor_id].max_range;
+            std::atomic_store(&sensor_depth_cam_[sensor_id], initializeDepthCamLUT(params));
+          }
+        }
 
         break;
       }
@@ -933,21 +1705,46 @@ void OctomapServer::callback3dLidarCloud2(const sensor_msgs::PointCloud2::ConstP
     }
   }
 
-  // get raycasting parameters
+  // load the sensor model once for the whole scan, the snapshot stays valid even if it gets replaced in the meantime
+  std::shared_ptr<const Sensor3DLidar_t>  sensor_3d_lidar;
+  std::shared_ptr<const SensorDepthCam_t> sensor_depth_cam;
+
+  double max_range              = 0;
   double free_ray_distance      = 0;
   bool   unknown_clear_occupied = false;
+  double leaf_size              = 0;
+
+  std::vector<double> coarse_ray_distances;
+
+  // directions of the missing points, used for free space raycasting of the unknown rays
+  const vec3s_t* unknown_directions = nullptr;
+  float          unknown_distance   = 0;
+
   switch (sensor_type) {
     case LIDAR_3D: {
-      std::scoped_lock lock(mutex_lut_);
-      free_ray_distance      = sensor_params_3d_lidar_[sensor_id].free_ray_distance;
-      unknown_clear_occupied = sensor_params_3d_lidar_[sensor_id].clear_occupied;
+      sensor_3d_lidar        = std::atomic_load(&sensor_3d_lidar_[sensor_id]);
+      max_range              = sensor_3d_lidar->params.max_range;
+      free_ray_distance      = sensor_3d_lidar->params.free_ray_distance;
+      unknown_clear_occupied = sensor_3d_lidar->params.clear_occupied;
+      leaf_size              = sensor_3d_lidar->params.downsampling_leaf_size;
+      coarse_ray_distances   = sensor_3d_lidar->params.coarse_ray_distances;
+      if (sensor_3d_lidar->params.update_free_space) {
+        unknown_directions = &sensor_3d_lidar->lut.directions;
+        unknown_distance   = float(sensor_3d_lidar->params.free_ray_distance_unknown);
+      }
       break;
     }
-
     case DEPTH_CAMERA: {
-      std::scoped_lock lock(mutex_lut_);
-      free_ray_distance      = sensor_params_depth_cam_[sensor_id].free_ray_distance;
-      unknown_clear_occupied = sensor_params_depth_cam_[sensor_id].clear_occupied;
+      sensor_depth_cam       = std::atomic_load(&sensor_depth_cam_[sensor_id]);
+      max_range              = sensor_depth_cam->params.max_range;
+      free_ray_distance      = sensor_depth_cam->params.free_ray_distance;
+      unknown_clear_occupied = sensor_depth_cam->params.clear_occupied;
+      leaf_size              = sensor_depth_cam->params.downsampling_leaf_size;
+      coarse_ray_distances   = sensor_depth_cam->params.coarse_ray_distances;
+      if (sensor_depth_cam->params.update_free_space) {
+        unknown_directions = &sensor_depth_cam->lut.directions;
+        unknown_distance   = float(sensor_depth_cam->params.free_ray_distance_unknown);
+      }
       break;
     }
     default: {
@@ -955,128 +1752,88 @@ void OctomapServer::callback3dLidarCloud2(const sensor_msgs::PointCloud2::ConstP
     }
   }
 
-  // points that are over the max range from previous pcl filtering, update only free space
+  // points that are over the max range from previous pcl filtering update only free space, the missing ones are skipped
   if (pcl_over_max_range) {
+    unknown_directions = nullptr;
+  }
 
-    free_vectors_pc->swap(*pc);
-
-  } else {
-
-    // go through the pointcloud
-    for (int i = 0; i < pc->size(); i++) {
+  const Eigen::Matrix3f rotation    = sensorToWorld.topLeftCorner<3, 3>();
+  const vec3_t          translation = sensorToWorld.topRightCorner<3, 1>();
 
-      pcl::PointXYZ pt = pc->at(i);
+  const size_t n_points = size_t(cloud->width) * cloud->height;
 
-      if ((!std::isfinite(pt.x) || !std::isfinite(pt.y) || !std::isfinite(pt.z))) {
-        // datapoint is missing, update only free space, if desired
-        vec3_t ray_vec;
-        double raycasting_distance       = 0;
-        bool   unknown_update_free_space = false;
-        switch (sensor_type) {
-          case LIDAR_3D: {
-            std::scoped_lock lock(mutex_lut_);
-            ray_vec                   = sensor_3d_lidar_xyz_lut_[sensor_id].directions.col(i);
-            raycasting_distance       = sensor_params_3d_lidar_[sensor_id].free_ray_distance_unknown;
-            unknown_update_free_space = sensor_params_3d_lidar_[sensor_id].update_free_space;
-            break;
-          }
-          case DEPTH_CAMERA: {
-            std::scoped_lock lock(mutex_lut_);
-            ray_vec                   = sensor_depth_camera_xyz_lut_[sensor_id].directions.col(i);
-            raycasting_distance       = sensor_params_depth_cam_[sensor_id].free_ray_distance_unknown;
-            unknown_update_free_space = sensor_params_depth_cam_[sensor_id].update_free_space;
-            break;
-          }
-          default: {
-            break;
-          }
-        }
+  // the buffers only grow, they are not reallocated once they fit the largest scan processed by this thread
+  thread_local vec3s_t hits;
+  thread_local vec3s_t free_vectors;
 
-        if (unknown_update_free_space) {
-          pcl::PointXYZ temp_pt;
+  if (size_t(hits.cols()) < n_points) {
+    hits.resize(3, n_points);
+    free_vectors.resize(3, n_points);
+  }
 
-          temp_pt.x = ray_vec(0) * float(raycasting_distance);
-          temp_pt.y = ray_vec(1) * float(raycasting_distance);
-          temp_pt.z = ray_vec(2) * float(raycasting_distance);
+  size_t n_hits         = 0;
+  size_t n_free_vectors = 0;
 
-          free_vectors_pc->push_back(temp_pt);
-        }
-      } else if ((pow(pt.x, 2) + pow(pt.y, 2) + pow(pt.z, 2)) > pow(max_range, 2)) {
-        // point is over the max range, update only free space
-        free_vectors_pc->push_back(pt);
-      } else {
-        // point is ok
-        hit_pc->push_back(pt);
-      }
+  const float max_range_sq = float(max_range * max_range);
 
-      /* // add hit points to the pointcloud of occupied points */
-      /* if ((std::isfinite(pt.x) && std::isfinite(pt.y) && std::isfinite(pt.z)) && ((pow(pt.x, 2) + pow(pt.y, 2) + pow(pt.z, 2)) < pow(max_range, 2))) { */
+  // a single pass through the message data: classify the points and transform them to the map frame
+  for (uint32_t row = 0; row < cloud->height; row++) {
 
-      /*   hit_pc->push_back(pt); */
+    const uint8_t* row_data = cloud->data.data() + size_t(row) * cloud->row_step;
 
-      /* } else { */
+    for (uint32_t col = 0; col < cloud->width; col++) {
 
-      /*   // calculate vectors for free space raycasting of unknown rays (where data are missing, either due to filtering, being over the max_range, or not
-       * being */
-      /*   // seen by the sensor) */
-      /*   if (_unknown_rays_update_free_space_) { */
-      /*     vec3_t ray_vec; */
-      /*     switch (sensor_type) { */
-      /*       case LIDAR_3D: { */
-      /*         std::scoped_lock lock(mutex_lut_); */
-      /*         ray_vec = sensor_3d_lidar_xyz_lut_[sensor_id].directions.col(i); */
-      /*         break; */
-      /*       } */
-      /*       case DEPTH_CAMERA: { */
-      /*         std::scoped_lock lock(mutex_lut_); */
-      /*         ray_vec = sensor_depth_camera_xyz_lut_[sensor_id].directions.col(i); */
-      /*         break; */
-      /*       } */
-      /*       default: { */
-      /*         break; */
-      /*       } */
-      /*     } */
+      const uint8_t* point_data = row_data + size_t(col) * cloud->point_step;
 
-      /*     /1* if (ray_vec(2) > 0.0) { *1/ */
+      vec3_t pt;
+      memcpy(&pt(0), point_data + xyz_offsets[0], sizeof(float));
+      memcpy(&pt(1), point_data + xyz_offsets[1], sizeof(float));
+      memcpy(&pt(2), point_data + xyz_offsets[2], sizeof(float));
 
-      /*     pcl::PointXYZ temp_pt; */
+      if (!pt.allFinite()) {
 
-      /*     temp_pt.x = ray_vec(0) * float(max_range); */
-      /*     temp_pt.y = ray_vec(1) * float(max_range); */
-      /*     temp_pt.z = ray_vec(2) * float(max_range); */
+        // datapoint is missing, update only free space, if desired
+        const size_t i = size_t(row) * cloud->width + col;
 
-      /*     free_vectors_pc->push_back(temp_pt); */
-      /*     /1* } *1/ */
-      /*   } */
-      /* } */
-    }
-  }
+        if (unknown_directions && i < size_t(unknown_directions->cols())) {
+          free_vectors.col(n_free_vectors++) = rotation * (unknown_directions->col(i) * unknown_distance) + translation;
+        }
 
-  free_vectors_pc->header = pc->header;
+      } else if (pcl_over_max_range || pt.squaredNorm() > max_range_sq) {
 
-  // transform to the map frame
+        // point is over the max range, update only free space
+        free_vectors.col(n_free_vectors++) = rotation * pt + translation;
 
-  pcl::transformPointCloud(*hit_pc, *hit_pc, sensorToWorld);
-  pcl::transformPointCloud(*free_vectors_pc, *free_vectors_pc, sensorToWorld);
+      } else {
 
-  hit_pc->header.frame_id          = _world_frame_;
-  free_vectors_pc->header.frame_id = _world_frame_;
+        // point is ok
+        hits.col(n_hits++) = rotation * pt + translation;
+      }
+    }
+  }
 
-  insertPointCloud(sensorToWorldTf.transform.translation, hit_pc, free_vectors_pc, free_ray_distance, unknown_clear_occupied);
+  // one endpoint per leaf, the rays are then cast only from the remaining ones
+  if (leaf_size > 0) {
+    n_hits         = downsamplePoints(hits, n_hits, float(leaf_size));
+    n_free_vectors = downsamplePoints(free_vectors, n_free_vectors, float(leaf_size));
+  }
 
   const octomap::point3d sensor_origin = octomap::pointTfToOctomap(sensorToWorldTf.transform.translation);
 
+  insertPointCloud(sensor_origin, hits.leftCols(n_hits), free_vectors.leftCols(n_free_vectors), free_ray_distance, unknown_clear_occupied,
+                   coarse_ray_distances);
+
   {
-    std::scoped_lock lock(mutex_avg_time_cloud_insertion_);
+    std::scoped_lock lock(mutex_avg_time_cloud_callback_);
 
     ros::Time time_end = ros::Time::now();
 
     double exec_duration = (time_end - time_start).toSec();
 
-    double coef               = 0.5;
-    avg_time_cloud_insertion_ = coef * avg_time_cloud_insertion_ + (1.0 - coef) * exec_duration;
+    double coef              = 0.5;
+    avg_time_cloud_callback_ = coef * avg_time_cloud_callback_ + (1.0 - coef) * exec_duration;
 
-    ROS_INFO_THROTTLE(1.0, "[OctomapServer]: avg cloud insertion time = %.3f sec", avg_time_cloud_insertion_);
+    ROS_INFO_THROTTLE(1.0, "[OctomapServer]: avg cloud callback time = %.3f sec", avg_time_cloud_callback_);
   }
 }  // namespace mrs_octomap_server
 
@@ -1152,7 +1909,16 @@ bool OctomapServer::callbackResetMap([[maybe_unused]] std_srvs::Empty::Request&
     std::scoped_lock lock(mutex_octree_global_, mutex_octree_local_);
 
     octree_global_->clear();
+    octree_global_version_++;
+    global_map_keyframe_needed_ = true;
+    dirty_cells_.clear();
+    flushed_cells_.clear();
+    flushed_ends_.clear();
     octree_local_->clear();
+    rolling_grid_.clear();
+    octree_local_version_++;
+    local_map_keyframe_needed_ = true;
+    saturation_bitmap_.clear();
   }
 
   octrees_initialized_ = true;
@@ -1164,127 +1930,119 @@ bool OctomapServer::callbackResetMap([[maybe_unused]] std_srvs::Empty::Request&
 
 //}
 
-// | ------------------------- timers ------------------------- |
-
-/* timerGlobalMapPublisher() //{ */
+/* callbackRequestKeyframe() //{ */
 
-void OctomapServer::timerGlobalMapPublisher([[maybe_unused]] const ros::TimerEvent& evt) {
+bool OctomapServer::callbackRequestKeyframe([[maybe_unused]] std_srvs::Empty::Request& req, [[maybe_unused]] std_srvs::Empty::Response& resp) {
 
-  if (!is_initialized_) {
-    return;
-  }
+  global_map_keyframe_needed_ = true;
+  local_map_keyframe_needed_  = true;
 
-  if (!octrees_initialized_) {
-    return;
-  }
+  ROS_INFO("[OctomapServer]: keyframes requested");
 
-  ROS_INFO_ONCE("[OctomapServer]: full map publisher timer spinning");
+  return true;
+}
 
-  size_t octomap_size;
+//}
 
-  {
-    std::scoped_lock lock(mutex_octree_global_);
+/* callbackGetMapRoi() //{ */
 
-    octomap_size = octree_global_->size();
-  }
+bool OctomapServer::callbackGetMapRoi(mrs_octomap_server::GetMapRoi::Request& req, mrs_octomap_server::GetMapRoi::Response& resp) {
 
-  if (octomap_size <= 1) {
-    ROS_WARN("[%s]: Nothing to publish, octree is empty", ros::this_node::getName().c_str());
-    return;
+  if (!is_initialized_) {
+    resp.success = false;
+    resp.message = "not initialized";
+    return true;
   }
 
-  /* if (_global_map_compress_) { */
-  /*   octree_global_->prune(); */
-  /* } */
-
-  if (pub_map_global_full_) {
+  resp.success = getMapRoi(req.roi, resp.map, resp.message);
 
-    octomap_msgs::Octomap map;
-    map.header.frame_id = _world_frame_;
-    map.header.stamp    = ros::Time::now();  // TODO
+  return true;
+}
 
-    bool success = false;
+//}
 
-    {
-      std::scoped_lock lock(mutex_octree_global_);
+/* callbackBatchQuery() //{ */
 
-      mrs_lib::ScopeTimer timer = mrs_lib::ScopeTimer("OctomapServer::globalMapFullPublish", scope_timer_logger_, _scope_timer_enabled_);
+/**
+ * @brief answers the occupancy queries against the snapshot of the map, the queries are evaluated in parallel
+ */
+bool OctomapServer::callbackBatchQuery(mrs_octomap_server::BatchQuery::Request& req, mrs_octomap_server::BatchQuery::Response& resp) {
 
-      success = octomap_msgs::fullMapToMsg(*octree_global_, map);
-    }
+  if (!is_initialized_) {
+    resp.success = false;
+    resp.message = "not initialized";
+    return true;
+  }
 
-    if (success) {
-      pub_map_global_full_.publish(map);
-    } else {
-      ROS_ERROR("[OctomapServer]: error serializing global octomap to full representation");
-    }
+  if (!req.header.frame_id.empty() && req.header.frame_id != _world_frame_) {
+    resp.success = false;
+    resp.message = "the queries have to be given in the frame of the map, " + _world_frame_;
+    return true;
   }
 
-  if (_global_map_publish_binary_) {
+  if (req.map != mrs_octomap_server::BatchQuery::Request::GLOBAL_MAP && req.map != mrs_octomap_server::BatchQuery::Request::LOCAL_MAP) {
+    resp.success = false;
+    resp.message = "unknown map";
+    return true;
+  }
 
-    octomap_msgs::Octomap map;
-    map.header.frame_id = _world_frame_;
-    map.header.stamp    = ros::Time::now();  // TODO
+  if (req.map == mrs_octomap_server::BatchQuery::Request::GLOBAL_MAP && !_global_map_enabled_) {
+    resp.success = false;
+    resp.message = "the global map is disabled";
+    return true;
+  }
 
-    bool success = false;
+  if (req.boxes_min.size() != req.boxes_max.size() || req.segments_start.size() != req.segments_end.size()) {
+    resp.success = false;
+    resp.message = "the boxes or the segments are not complete";
+    return true;
+  }
 
-    {
-      std::scoped_lock lock(mutex_octree_global_);
+  mrs_lib::ScopeTimer timer = mrs_lib::ScopeTimer("OctomapServer::callbackBatchQuery", scope_timer_logger_, _scope_timer_enabled_);
 
-      mrs_lib::ScopeTimer timer = mrs_lib::ScopeTimer("OctomapServer::globalMapBinaryPublish", scope_timer_logger_, _scope_timer_enabled_);
+  std::shared_ptr<const OcTree_t> octree =
+      req.map == mrs_octomap_server::BatchQuery::Request::LOCAL_MAP ? getLocalMapSnapshot() : getGlobalMapSnapshot();
 
-      success = octomap_msgs::binaryMapToMsg(*octree_global_, map);
-    }
+  auto toPoints = [](const std::vector<geometry_msgs::Point>& in) {
+    std::vector<octomap::point3d> out;
+    out.reserve(in.size());
 
-    if (success) {
-      pub_map_global_binary_.publish(map);
-    } else {
-      ROS_ERROR("[OctomapServer]: error serializing global octomap to binary representation");
+    for (const geometry_msgs::Point& point : in) {
+      out.push_back(octomap::pointMsgToOctomap(point));
     }
-  }
-}
-
-//}
-
-/* timerGlobalMapCreator() //{ */
-
-void OctomapServer::timerGlobalMapCreator([[maybe_unused]] const ros::TimerEvent& evt) {
 
-  if (!is_initialized_) {
-    return;
-  }
+    return out;
+  };
 
-  if (!octrees_initialized_) {
-    return;
-  }
+  map_query_.queryPoints(*octree, toPoints(req.points), resp.points_occupancy);
 
-  mrs_lib::ScopeTimer timer = mrs_lib::ScopeTimer("OctomapServer::timerGlobalMapCreator", scope_timer_logger_, _scope_timer_enabled_);
+  map_query_.queryBoxes(*octree, toPoints(req.boxes_min), toPoints(req.boxes_max), req.report_unknown, resp.boxes_occupancy);
 
-  ROS_INFO_ONCE("[OctomapServer]: global map creator timer spinning");
+  std::vector<MapQuery<OcTree_t>::SegmentResult_t> segments;
 
-  // copy the local map into a buffer
+  map_query_.querySegments(*octree, toPoints(req.segments_start), toPoints(req.segments_end), req.report_unknown, segments);
 
-  std::shared_ptr<OcTree_t> local_map_tmp_;
-  {
-    std::scoped_lock lock(mutex_octree_local_);
+  resp.segments_occupancy.resize(segments.size());
+  resp.segments_hit.resize(segments.size());
 
-    local_map_tmp_ = std::make_shared<OcTree_t>(*octree_local_);
+  for (size_t i = 0; i < segments.size(); i++) {
+    resp.segments_occupancy[i] = segments[i].occupancy;
+    resp.segments_hit[i]       = octomap::pointOctomapToMsg(segments[i].hit);
   }
 
-  local_map_tmp_->expand();
-
-  {
-    std::scoped_lock lock(mutex_octree_global_);
+  resp.success = true;
+  resp.message = "answered " + std::to_string(req.points.size() + req.boxes_min.size() + req.segments_start.size()) + " queries";
 
-    copyLocalMap(local_map_tmp_, octree_global_);
-  }
+  return true;
 }
 
 //}
 
-/* timerLocalMapPublisher() //{ */
+// | ------------------------- timers ------------------------- |
 
-void OctomapServer::timerLocalMapPublisher([[maybe_unused]] const ros::TimerEvent& evt) {
+/* timerGlobalMapPublisher() //{ */
+
+void OctomapServer::timerGlobalMapPublisher([[maybe_unused]] const ros::TimerEvent& evt) {
 
   if (!is_initialized_) {
     return;
@@ -1294,63 +2052,457 @@ void OctomapServer::timerLocalMapPublisher([[maybe_unused]] const ros::TimerEven
     return;
   }
 
-  ROS_INFO_ONCE("[OctomapServer]: local map publisher timer spinning");
-
-  size_t octomap_size = octree_local_->size();
+  ROS_INFO_ONCE("[OctomapServer]: full map publisher timer spinning");
 
-  if (octomap_size <= 1) {
-    ROS_WARN("[%s]: Nothing to publish, octree_local_, octree is empty", ros::this_node::getName().c_str());
-    return;
-  }
+  /* deltas //{ */
 
-  if (_local_map_publish_full_) {
+  if (_global_map_delta_enabled_) {
 
-    octomap_msgs::Octomap map;
-    map.header.frame_id = _world_frame_;
-    map.header.stamp    = ros::Time::now();  // TODO
+    std::vector<mrs_octomap_server::OctomapDelta> deltas;
+    std::shared_ptr<const OcTree_t>               keyframe;
+    mrs_octomap_server::OctomapDelta              keyframe_msg;
 
-    bool success = false;
+    const bool subscribed = pub_map_global_delta_.getNumSubscribers() > 0;
 
     {
-      std::scoped_lock lock(mutex_octree_local_);
+      std::scoped_lock lock(mutex_octree_global_);
 
-      mrs_lib::ScopeTimer timer = mrs_lib::ScopeTimer("OctomapServer::localMapFullPublish", scope_timer_logger_, _scope_timer_enabled_);
+      if (!subscribed) {
 
-      success = octomap_msgs::fullMapToMsg(*octree_local_, map);
-    }
+        // nobody is listening, the next subscriber starts from a keyframe
+        global_map_deltas_.clear();
+        global_map_keyframe_needed_ = true;
 
-    if (success) {
-      pub_map_local_full_.publish(map);
-    } else {
-      ROS_ERROR("[OctomapServer]: error serializing local octomap to full representation");
-    }
-  }
+      } else if (global_map_keyframe_needed_ || (ros::Time::now() - global_map_keyframe_time_).toSec() >= _global_map_delta_keyframe_period_) {
 
-  if (_local_map_publish_binary_) {
+        // the keyframe covers all the deltas waiting so far
+        keyframe = updateGlobalMapSnapshot(&keyframe_msg.version);
 
-    octomap_msgs::Octomap map;
-    map.header.frame_id = _world_frame_;
-    map.header.stamp    = ros::Time::now();  // TODO
+        global_map_deltas_.clear();
+        global_map_keyframe_needed_ = false;
 
-    bool success = false;
+      } else {
 
-    {
-      std::scoped_lock lock(mutex_octree_local_);
+        deltas.swap(global_map_deltas_);
+      }
+    }
+
+    if (keyframe) {
 
-      mrs_lib::ScopeTimer timer = mrs_lib::ScopeTimer("OctomapServer::localMapBinaryPublish", scope_timer_logger_, _scope_timer_enabled_);
+      global_map_keyframe_time_ = ros::Time::now();
 
-      success = octomap_msgs::binaryMapToMsg(*octree_local_, map);
+      publishKeyframe(pub_map_global_delta_, global_map_msgs_, keyframe, keyframe_msg);
     }
 
-    if (success) {
-      pub_map_local_binary_.publish(map);
-    } else {
-      ROS_ERROR("[OctomapServer]: error serializing local octomap to binary representation");
+    for (const mrs_octomap_server::OctomapDelta& delta : deltas) {
+      pub_map_global_delta_.publish(delta);
     }
   }
-}
 
-//}
+  //}
+
+  const bool publish_full   = _global_map_publish_full_ && pub_map_global_full_.getNumSubscribers() > 0;
+  const bool publish_binary = _global_map_publish_binary_ && pub_map_global_binary_.getNumSubscribers() > 0;
+
+  const bool publish_full_compressed =
+      _global_map_publish_full_ && _compression_global_map_enabled_ && pub_map_global_full_compressed_.getNumSubscribers() > 0;
+  const bool publish_binary_compressed =
+      _global_map_publish_binary_ && _compression_global_map_enabled_ && pub_map_global_binary_compressed_.getNumSubscribers() > 0;
+
+  if (!publish_full && !publish_binary && !publish_full_compressed && !publish_binary_compressed) {
+    return;
+  }
+
+  // serialized without blocking the map
+  uint64_t                        version;
+  std::shared_ptr<const OcTree_t> octree = getGlobalMapSnapshot(&version, false);
+
+  if (octree->size() <= 1) {
+    ROS_WARN("[%s]: Nothing to publish, octree is empty", ros::this_node::getName().c_str());
+    return;
+  }
+
+  /* if (_global_map_compress_) { */
+  /*   octree_global_->prune(); */
+  /* } */
+
+  // the topics are latched, the subscribers already have the map of the published version
+  if (publish_full && global_map_full_published_version_ != version) {
+
+    octomap_msgs::OctomapConstPtr map = getMapMsg(global_map_msgs_, octree, version, false);
+
+    if (map) {
+      pub_map_global_full_.publish(map);
+      global_map_full_published_version_ = version;
+    } else {
+      ROS_ERROR("[OctomapServer]: error serializing global octomap to full representation");
+    }
+  }
+
+  if (publish_binary && global_map_binary_published_version_ != version) {
+
+    octomap_msgs::OctomapConstPtr map = getMapMsg(global_map_msgs_, octree, version, true);
+
+    if (map) {
+      pub_map_global_binary_.publish(map);
+      global_map_binary_published_version_ = version;
+    } else {
+      ROS_ERROR("[OctomapServer]: error serializing global octomap to binary representation");
+    }
+  }
+
+  // compressed and published by the compressor thread, the serialization is shared with the plain topics
+  if (publish_full_compressed && global_map_full_compressed_published_version_ != version) {
+
+    octomap_msgs::OctomapConstPtr map = getMapMsg(global_map_msgs_, octree, version, false);
+
+    if (map) {
+      queueCompression(pub_map_global_full_compressed_, map);
+      global_map_full_compressed_published_version_ = version;
+    } else {
+      ROS_ERROR("[OctomapServer]: error serializing global octomap to full representation");
+    }
+  }
+
+  if (publish_binary_compressed && global_map_binary_compressed_published_version_ != version) {
+
+    octomap_msgs::OctomapConstPtr map = getMapMsg(global_map_msgs_, octree, version, true);
+
+    if (map) {
+      queueCompression(pub_map_global_binary_compressed_, map);
+      global_map_binary_compressed_published_version_ = version;
+    } else {
+      ROS_ERROR("[OctomapServer]: error serializing global octomap to binary representation");
+    }
+  }
+}
+
+//}
+
+/* timerGlobalMapCreator() //{ */
+
+void OctomapServer::timerGlobalMapCreator([[maybe_unused]] const ros::TimerEvent& evt) {
+
+  if (!is_initialized_) {
+    return;
+  }
+
+  if (!octrees_initialized_) {
+    return;
+  }
+
+  mrs_lib::ScopeTimer timer = mrs_lib::ScopeTimer("OctomapServer::timerGlobalMapCreator", scope_timer_logger_, _scope_timer_enabled_);
+
+  ROS_INFO_ONCE("[OctomapServer]: global map creator timer spinning");
+
+  // collect the current values of the cells changed since the last merge
+
+  bool full_merge;
+
+  {
+    std::scoped_lock lock(mutex_octree_local_);
+
+    if (dirty_cells_.empty() && flushed_ends_.empty() && !global_map_full_merge_) {
+      return;
+    }
+
+    // the cells which left the local map since the last merge
+    std::swap(merge_flushed_cells_, flushed_cells_);
+    std::swap(merge_flushed_ends_, flushed_ends_);
+    flushed_cells_.clear();
+    flushed_ends_.clear();
+
+    // looking up the cells one by one would cost more than walking the whole local map, the rolling grid is read by the
+    // cells anyway
+    full_merge = global_map_full_merge_ || (!_local_map_rolling_grid_enabled_ && dirty_cells_.size() > octree_local_->size());
+
+    if (!full_merge) {
+
+      collectDirtyCells(dirty_cells_, merge_cells_);
+
+      dirty_cells_.clear();
+    }
+  }
+
+  if (full_merge) {
+
+    std::scoped_lock lock(mutex_octree_global_, mutex_octree_local_);
+
+    // the older values first, the local map overwrites them
+    setFlushedCells(merge_flushed_cells_, merge_flushed_ends_, false);
+
+    exportRollingGrid();
+
+    mergeTree(*octree_local_, *octree_global_);
+
+    // the rolling grid holds also the cells outside of the exported box
+    if (_local_map_rolling_grid_enabled_) {
+
+      collectDirtyCells(dirty_cells_, merge_cells_);
+
+      setNodesBatch(*octree_global_, merge_cells_);
+    }
+
+    octree_global_version_++;
+
+    dirty_cells_.clear();
+    global_map_full_merge_ = false;
+
+    // the merge is not described by a delta
+    global_map_keyframe_needed_ = true;
+
+    // the copy for the readers is taken here, the merged global map is in the cache and the lock is held already
+    if (octree_global_snapshot_wanted_.exchange(false)) {
+      updateGlobalMapSnapshot();
+    }
+
+    return;
+  }
+
+  {
+    std::scoped_lock lock(mutex_octree_global_);
+
+    setFlushedCells(merge_flushed_cells_, merge_flushed_ends_, _global_map_delta_enabled_);
+
+    if (!merge_cells_.empty()) {
+
+      setNodesBatch(*octree_global_, merge_cells_);
+
+      // the merged nodes are the delta, they are set by the receiver the same way
+      if (_global_map_delta_enabled_) {
+        queueGlobalMapDelta(merge_cells_);
+      }
+
+      octree_global_version_++;
+    }
+
+    // the copy for the readers is taken here, the merged global map is in the cache and the lock is held already
+    if (octree_global_snapshot_wanted_.exchange(false)) {
+      updateGlobalMapSnapshot();
+    }
+  }
+}
+
+//}
+
+/* timerLocalMapPublisher() //{ */
+
+void OctomapServer::timerLocalMapPublisher([[maybe_unused]] const ros::TimerEvent& evt) {
+
+  if (!is_initialized_) {
+    return;
+  }
+
+  if (!octrees_initialized_) {
+    return;
+  }
+
+  ROS_INFO_ONCE("[OctomapServer]: local map publisher timer spinning");
+
+  /* deltas //{ */
+
+  if (_local_map_delta_enabled_) {
+
+    mrs_octomap_server::OctomapDelta delta;
+    std::shared_ptr<const OcTree_t>  keyframe;
+    bool                             publish_delta = false;
+
+    const bool subscribed = pub_map_local_delta_.getNumSubscribers() > 0;
+
+    {
+      std::scoped_lock lock(mutex_octree_local_);
+
+      // brings the local map up to date, an export which had to rebuild the tree asks for a keyframe
+      if (subscribed) {
+        exportRollingGrid();
+      }
+
+      if (!subscribed) {
+
+        // nobody is listening, the next subscriber starts from a keyframe
+        local_map_keyframe_needed_ = true;
+
+      } else if (local_map_keyframe_needed_ || (ros::Time::now() - local_map_keyframe_time_).toSec() >= _local_map_delta_keyframe_period_) {
+
+        keyframe = updateLocalMapSnapshot(&delta.version);
+
+        local_map_keyframe_needed_ = false;
+
+      } else if (octree_local_version_ != local_map_delta_version_) {
+
+        // the cells removed by the cropping are not collected, the receiver crops its map by the same box
+        collectNodes(octree_local_, local_map_delta_cells_, local_map_delta_nodes_);
+
+        delta.header.frame_id = _world_frame_;
+        delta.header.stamp    = ros::Time::now();
+        delta.base_version    = local_map_delta_version_;
+        delta.version         = octree_local_version_;
+
+        fillDeltaNodes(local_map_delta_nodes_, delta);
+
+        // the box of keys the local map is cropped to, sent as the centers of its corner cells (see OctomapDelta.msg)
+        octomap::OcTreeKey crop_min_key = rolling_grid_exported_min_key_;
+        octomap::OcTreeKey crop_max_key = rolling_grid_exported_max_key_;
+
+        delta.crop = _local_map_rolling_grid_enabled_ || (octree_local_->coordToKeyChecked(local_map_roi_min_, crop_min_key) &&
+                                                          octree_local_->coordToKeyChecked(local_map_roi_max_, crop_max_key));
+
+        if (delta.crop) {
+
+          const octomap::point3d crop_min = octree_local_->keyToCoord(crop_min_key);
+          const octomap::point3d crop_max = octree_local_->keyToCoord(crop_max_key);
+
+          delta.crop_min.x = crop_min.x();
+          delta.crop_min.y = crop_min.y();
+          delta.crop_min.z = crop_min.z();
+          delta.crop_max.x = crop_max.x();
+          delta.crop_max.y = crop_max.y();
+          delta.crop_max.z = crop_max.z();
+        }
+
+        publish_delta = true;
+      }
+
+      local_map_delta_cells_.clear();
+      local_map_delta_version_ = octree_local_version_;
+    }
+
+    if (keyframe) {
+
+      local_map_keyframe_time_ = ros::Time::now();
+
+      publishKeyframe(pub_map_local_delta_, local_map_msgs_, keyframe, delta);
+
+    } else if (publish_delta) {
+
+      pub_map_local_delta_.publish(delta);
+    }
+  }
+
+  //}
+
+  const bool publish_full   = _local_map_publish_full_ && pub_map_local_full_.getNumSubscribers() > 0;
+  const bool publish_binary = _local_map_publish_binary_ && pub_map_local_binary_.getNumSubscribers() > 0;
+
+  const bool publish_full_compressed =
+      _local_map_publish_full_ && _compression_local_map_enabled_ && pub_map_local_full_compressed_.getNumSubscribers() > 0;
+  const bool publish_binary_compressed =
+      _local_map_publish_binary_ && _compression_local_map_enabled_ && pub_map_local_binary_compressed_.getNumSubscribers() > 0;
+
+  if (!publish_full && !publish_binary && !publish_full_compressed && !publish_binary_compressed) {
+    return;
+  }
+
+  // serialized without blocking the map
+  uint64_t                        version;
+  std::shared_ptr<const OcTree_t> octree = getLocalMapSnapshot(&version, false);
+
+  if (octree->size() <= 1) {
+    ROS_WARN("[%s]: Nothing to publish, octree_local_, octree is empty", ros::this_node::getName().c_str());
+    return;
+  }
+
+  // the topics are latched, the subscribers already have the map of the published version
+  if (publish_full && local_map_full_published_version_ != version) {
+
+    octomap_msgs::OctomapConstPtr map = getMapMsg(local_map_msgs_, octree, version, false);
+
+    if (map) {
+      pub_map_local_full_.publish(map);
+      local_map_full_published_version_ = version;
+    } else {
+      ROS_ERROR("[OctomapServer]: error serializing local octomap to full representation");
+    }
+  }
+
+  if (publish_binary && local_map_binary_published_version_ != version) {
+
+    octomap_msgs::OctomapConstPtr map = getMapMsg(local_map_msgs_, octree, version, true);
+
+    if (map) {
+      pub_map_local_binary_.publish(map);
+      local_map_binary_published_version_ = version;
+    } else {
+      ROS_ERROR("[OctomapServer]: error serializing local octomap to binary representation");
+    }
+  }
+
+  // compressed and published by the compressor thread, the serialization is shared with the plain topics
+  if (publish_full_compressed && local_map_full_compressed_published_version_ != version) {
+
+    octomap_msgs::OctomapConstPtr map = getMapMsg(local_map_msgs_, octree, version, false);
+
+    if (map) {
+      queueCompression(pub_map_local_full_compressed_, map);
+      local_map_full_compressed_published_version_ = version;
+    } else {
+      ROS_ERROR("[OctomapServer]: error serializing local octomap to full representation");
+    }
+  }
+
+  if (publish_binary_compressed && local_map_binary_compressed_published_version_ != version) {
+
+    octomap_msgs::OctomapConstPtr map = getMapMsg(local_map_msgs_, octree, version, true);
+
+    if (map) {
+      queueCompression(pub_map_local_binary_compressed_, map);
+      local_map_binary_compressed_published_version_ = version;
+    } else {
+      ROS_ERROR("[OctomapServer]: error serializing local octomap to binary representation");
+    }
+  }
+}
+
+//}
+
+/* timerMapRoiPublisher() //{ */
+
+/**
+ * @brief streams the region of the map last requested on the map_roi_in topic, again whenever the map changes
+ */
+void OctomapServer::timerMapRoiPublisher([[maybe_unused]] const ros::TimerEvent& evt) {
+
+  if (!is_initialized_) {
+    return;
+  }
+
+  if (!octrees_initialized_) {
+    return;
+  }
+
+  if (!sh_map_roi_.hasMsg() || pub_map_roi_.getNumSubscribers() == 0) {
+    return;
+  }
+
+  mrs_octomap_server::MapRoi::ConstPtr request = sh_map_roi_.getMsg();
+
+  uint64_t version;
+
+  {
+    std::scoped_lock lock(request->map == mrs_octomap_server::MapRoi::LOCAL_MAP ? mutex_octree_local_ : mutex_octree_global_);
+
+    version = request->map == mrs_octomap_server::MapRoi::LOCAL_MAP ? octree_local_version_ : octree_global_version_;
+  }
+
+  if (request == map_roi_published_request_ && version == map_roi_published_version_) {
+    return;
+  }
+
+  octomap_msgs::Octomap map;
+  std::string           message;
+
+  if (!getMapRoi(*request, map, message, &version)) {
+    ROS_WARN_THROTTLE(1.0, "[OctomapServer]: could not stream the map roi: %s", message.c_str());
+    return;
+  }
+
+  pub_map_roi_.publish(map);
+
+  map_roi_published_request_ = request;
+  map_roi_published_version_ = version;
+}
+
+//}
 
 /* timerLocalMapResizer() //{ */
 
@@ -1504,7 +2656,16 @@ void OctomapServer::timerAltitudeAlignment([[maybe_unused]] const ros::TimerEven
         std::scoped_lock lock(mutex_octree_global_, mutex_octree_local_);
 
         octree_global_->clear();
+        octree_global_version_++;
+        global_map_keyframe_needed_ = true;
+        dirty_cells_.clear();
+        flushed_cells_.clear();
+        flushed_ends_.clear();
         octree_local_->clear();
+        rolling_grid_.clear();
+        octree_local_version_++;
+        local_map_keyframe_needed_ = true;
+        saturation_bitmap_.clear();
 
         octrees_initialized_ = true;
       }
@@ -1517,309 +2678,1471 @@ void OctomapServer::timerAltitudeAlignment([[maybe_unused]] const ros::TimerEven
       align_using_height = true;
     }
 
-  } else {
+  } else {
+
+    align_using_height = false;
+  }
+
+  // | ------ get the current UAV position in the map frame ----- |
+
+  auto res = transformer_->getTransform(_robot_frame_, _world_frame_);
+
+  double robot_x, robot_y, robot_z;
+
+  if (res) {
+
+    geometry_msgs::TransformStamped world_to_robot = res.value();
+
+    robot_x = world_to_robot.transform.translation.x;
+    robot_y = world_to_robot.transform.translation.y;
+    robot_z = world_to_robot.transform.translation.z;
+
+    ROS_INFO("[OctomapServer]: robot coordinates %.2f, %.2f, %.2f", robot_x, robot_y, robot_z);
+
+  } else {
+
+    ROS_INFO_THROTTLE(1.0, "[OctomapServer]: waiting for the tf from %s to %s", _world_frame_.c_str(), _robot_frame_.c_str());
+    return;
+  }
+
+  std::optional<double> ground_z;
+
+  {
+    // the search expands the nodes of the global map
+    std::scoped_lock lock(mutex_octree_global_);
+
+    ground_z = getGroundZ(octree_global_, robot_x, robot_y);
+  }
+
+  if (!ground_z) {
+
+    ROS_WARN_THROTTLE(1.0, "[OctomapServer]: could not calculate the Z of the ground below");
+
+    {
+      std::scoped_lock lock(mutex_octree_global_, mutex_octree_local_);
+
+      octree_global_->clear();
+      octree_global_version_++;
+      global_map_keyframe_needed_ = true;
+      dirty_cells_.clear();
+      flushed_cells_.clear();
+      flushed_ends_.clear();
+      octree_local_->clear();
+      rolling_grid_.clear();
+      octree_local_version_++;
+      local_map_keyframe_needed_ = true;
+      saturation_bitmap_.clear();
+
+      octrees_initialized_ = true;
+    }
+
+    timer_altitude_alignment_.stop();
+
+    ROS_INFO("[OctomapServer]: stopping the altitude alignment timer");
+
+    return;
+  }
+
+  double ground_z_should_be = 0;
+
+  if (align_using_height) {
+    ground_z_should_be = robot_z - sh_height_.getMsg()->value;
+  } else {
+    ground_z_should_be = robot_z - _robot_height_ - 0.5 * octree_global_->getResolution();
+  }
+
+  double offset = ground_z_should_be - ground_z.value();
+
+  ROS_INFO("[OctomapServer]: ground is at height %.2f m", ground_z.value());
+  ROS_INFO("[OctomapServer]: ground should be at height %.2f m", ground_z_should_be);
+  ROS_INFO("[OctomapServer]: shifting ground by %.2f m", offset);
+
+  {
+    std::scoped_lock lock(mutex_octree_global_, mutex_octree_local_);
+
+    // the keys of the flushed cells are valid before the translation only
+    setFlushedCells(flushed_cells_, flushed_ends_, false);
+    flushed_cells_.clear();
+    flushed_ends_.clear();
+
+    translateMap(octree_global_, 0, 0, offset);
+    translateMap(octree_local_, 0, 0, offset);
+    saturation_bitmap_.clear();
+
+    // the rolling grid is shifted by the same number of cells as translateMap() shifts the leaves
+    const int32_t shift[3] = {0, 0, int32_t(std::floor(offset / octree_resolution_ + 0.5))};
+
+    rolling_grid_.translate(shift);
+    rolling_grid_center_.z() += float(offset);
+
+    // the local map no longer matches the rolling grid, it is built anew from it by the next export
+    rolling_grid_exported_version_ = 0;
+
+    // the keys of the changed cells are not valid in the translated maps, the whole local map is merged instead
+    dirty_cells_.clear();
+    global_map_full_merge_ = true;
+
+    octree_global_version_++;
+    octree_local_version_++;
+    global_map_keyframe_needed_ = true;
+    local_map_keyframe_needed_  = true;
+
+    octrees_initialized_ = true;
+  }
+
+  timer_altitude_alignment_.stop();
+}
+
+//}
+
+// | ------------------------- threads ------------------------ |
+
+/* threadIntegrator() //{ */
+
+void OctomapServer::threadIntegrator() {
+
+  ROS_INFO("[OctomapServer]: integrator thread started");
+
+  while (integrator_running_) {
+
+    std::unique_ptr<ScanBatch_t> batch;
+
+    if (!scan_queue_->pop(batch)) {
+
+      std::unique_lock lock(mutex_integrator_);
+
+      cv_integrator_.wait(lock, [this] { return !integrator_running_ || !scan_queue_->empty(); });
+
+      continue;
+    }
+
+    {
+      std::scoped_lock lock(mutex_octree_local_);
+
+      integrateScan(*batch);
+    }
+
+    scan_batch_pool_->push(std::move(batch));
+  }
+}
+
+//}
+
+// | ------------------------ routines ------------------------ |
+
+/* queueCompression() //{ */
+
+/**
+ * @brief hands the map over to the compressor thread, a map of the same topic still waiting there is replaced
+ */
+void OctomapServer::queueCompression(ros::Publisher& publisher, const octomap_msgs::OctomapConstPtr& map) {
+
+  {
+    std::scoped_lock lock(mutex_compressor_);
+
+    auto job = std::find_if(compression_jobs_.begin(), compression_jobs_.end(), [&](const CompressionJob_t& j) { return j.publisher == &publisher; });
+
+    if (job != compression_jobs_.end()) {
+      job->map = map;
+    } else {
+      compression_jobs_.push_back({&publisher, map});
+    }
+  }
+
+  cv_compressor_.notify_one();
+}
+
+//}
+
+/* threadCompressor() //{ */
+
+void OctomapServer::threadCompressor() {
+
+  ROS_INFO("[OctomapServer]: compressor thread started, codec '%s', level %d", _compression_codec_.c_str(), _compression_level_);
+
+  std::vector<CompressionJob_t> jobs;
+
+  while (compressor_running_) {
+
+    {
+      std::unique_lock lock(mutex_compressor_);
+
+      cv_compressor_.wait(lock, [this] { return !compressor_running_ || !compression_jobs_.empty(); });
+
+      jobs.swap(compression_jobs_);
+    }
+
+    for (const CompressionJob_t& job : jobs) {
+
+      mrs_octomap_server::CompressedOctomap compressed;
+
+      bool success = false;
+
+      {
+        mrs_lib::ScopeTimer timer = mrs_lib::ScopeTimer("OctomapServer::mapCompression", scope_timer_logger_, _scope_timer_enabled_);
+
+        success = compressMap(*job.map, _compression_codec_, _compression_level_, compressed);
+      }
+
+      if (success) {
+        job.publisher->publish(compressed);
+      } else {
+        ROS_ERROR("[OctomapServer]: error compressing the map using '%s'", _compression_codec_.c_str());
+      }
+    }
+
+    jobs.clear();
+  }
+}
+
+//}
+
+/* insertPointCloud() //{ */
+
+void OctomapServer::insertPointCloud(const octomap::point3d& sensor_origin, const Eigen::Ref<const vec3s_t>& hits, const Eigen::Ref<const vec3s_t>& free_vectors,
+                                     double free_ray_distance, bool unknown_clear_occupied, const std::vector<double>& coarse_ray_distances) {
+
+  mrs_lib::ScopeTimer timer = mrs_lib::ScopeTimer("OctomapServer::timerInsertPointCloud", scope_timer_logger_, _scope_timer_enabled_);
+
+  // reuse a batch of an already integrated scan, its buffers already have the working size
+  std::unique_ptr<ScanBatch_t> batch;
+
+  if (!scan_batch_pool_->pop(batch)) {
+    batch = std::make_unique<ScanBatch_t>();
+  }
+
+  prepareScan(sensor_origin, hits, free_vectors, free_ray_distance, unknown_clear_occupied, coarse_ray_distances, *batch);
+
+  if (_insertion_integrator_enabled_) {
+
+    if (!scan_queue_->push(std::move(batch))) {
+      ROS_WARN_THROTTLE(1.0, "[OctomapServer]: the integration queue is full, dropping the scan");
+      scan_batch_pool_->push(std::move(batch));
+      return;
+    }
+
+    // passing through the mutex makes sure that the integrator can not miss the notification
+    { std::scoped_lock lock(mutex_integrator_); }
+
+    cv_integrator_.notify_one();
+
+  } else {
+
+    {
+      std::scoped_lock lock(mutex_octree_local_);
+
+      integrateScan(*batch);
+    }
+
+    scan_batch_pool_->push(std::move(batch));
+  }
+}
+
+//}
+
+/* prepareScan() //{ */
+
+void OctomapServer::prepareScan(const octomap::point3d& sensor_origin, const Eigen::Ref<const vec3s_t>& hits, const Eigen::Ref<const vec3s_t>& free_vectors,
+                                double free_ray_distance, bool unknown_clear_occupied, const std::vector<double>& coarse_ray_distances,
+                                ScanBatch_t& batch) {
+
+  mrs_lib::ScopeTimer timer = mrs_lib::ScopeTimer("OctomapServer::prepareScan", scope_timer_logger_, _scope_timer_enabled_);
+
+  auto [local_map_width, local_map_height] = mrs_lib::get_mutexed(mutex_local_map_dimensions_, local_map_width_, local_map_height_);
+
+  const float free_space_ray_len = float(free_ray_distance);
+
+  // the local map box, the parts of the rays outside of it would be cropped away after the integration, so they are not traced at all
+  const float            width_2  = float(local_map_width / 2.0);
+  const float            height_2 = float(local_map_height / 2.0);
+  const octomap::point3d box_min  = sensor_origin - octomap::point3d(width_2, width_2, height_2);
+  const octomap::point3d box_max  = sensor_origin + octomap::point3d(width_2, width_2, height_2);
+
+  batch.sensor_origin = sensor_origin;
+
+  batch.occupied_cells.clear();
+  batch.free_cells.clear();
+  batch.free_rays.clear();
+  batch.free_ray_lengths.clear();
+  batch.free_ends.clear();
+
+  // all measured points: make it free on ray, occupied on endpoint:
+  for (Eigen::Index i = 0; i < hits.cols(); i++) {
+
+    octomap::point3d measured_point(hits(0, i), hits(1, i), hits(2, i));
+    const float      point_distance = float((measured_point - sensor_origin).norm());
+
+    float t_min, t_max;
+    if (!clipRayToBox(sensor_origin, measured_point, box_min, box_max, t_min, t_max)) {
+      continue;
+    }
+
+    octomap::OcTreeKey key;
+
+    // a hit outside of the box would be cropped away
+    if (t_max >= 1.0f && ray_tracer_.coordToKeyChecked(measured_point, key)) {
+      batch.occupied_cells.push_back(key);
+    }
+
+    // move end point to distance min(free space ray len, current distance, distance to the border of the box)
+    measured_point = sensor_origin + (measured_point - sensor_origin).normalize() * std::min(free_space_ray_len, point_distance * std::min(t_max, 1.0f));
+
+    if (ray_tracer_.coordToKeyChecked(measured_point, key)) {
+      batch.free_ends.push_back(key);
+    }
+  }
+
+  batch.occupied_cells.sortUnique();
+  batch.free_ends.sortUnique();
+
+  // the rays are split among the workers, each of them collects its own free cells,
+  // the buffers are concatenated afterwards in the order of the workers
+  const int n_workers = std::max(1, _insertion_n_threads_);
+  const int n_threads = reserveInsertionThreads();
+
+  batch.free_cells_workers.resize(n_workers);
+  batch.free_rays_workers.resize(n_workers);
+  batch.free_ray_lengths_workers.resize(n_workers);
+  batch.ray_batches_workers.resize(n_workers);
+  batch.ray_ends_workers.resize(n_workers);
+  batch.band_ray_batches_workers.resize(n_workers);
+  batch.band_ray_origins_workers.resize(n_workers);
+  batch.band_ray_ends_workers.resize(n_workers);
+
+  // the far parts of the rays are traced through the coarser nodes, at most one level per available tracer
+  const std::vector<double> distances(coarse_ray_distances.begin(),
+                                      coarse_ray_distances.begin() + std::min(coarse_ray_distances.size(), coarse_ray_tracers_.size()));
+
+  for (int i = 0; i < n_threads; i++) {
+    batch.free_cells_workers[i].clear();
+    batch.free_rays_workers[i].clear();
+    batch.free_ray_lengths_workers[i].clear();
+  }
+
+  // the rays are traced in chunks, each chunk is traced by the SIMD kernel at once
+  const size_t ray_chunk = 256;
+
+  // FREE VECTORS, their truncation by the occupied cells of the map is left to the integration
+  const size_t n_free_vectors = size_t(free_vectors.cols());
+
+#pragma omp parallel num_threads(n_threads)
+  {
+    KeyBuffer&                     free_cells_worker       = batch.free_cells_workers[omp_get_thread_num()];
+    KeyBuffer&                     free_rays_worker        = batch.free_rays_workers[omp_get_thread_num()];
+    std::vector<uint32_t>&         free_ray_lengths_worker = batch.free_ray_lengths_workers[omp_get_thread_num()];
+    RayBatch&                      ray_batch               = batch.ray_batches_workers[omp_get_thread_num()];
+    std::vector<octomap::point3d>& ray_ends                = batch.ray_ends_workers[omp_get_thread_num()];
+
+    std::vector<RayBatch>&                      band_batches = batch.band_ray_batches_workers[omp_get_thread_num()];
+    std::vector<std::vector<octomap::point3d>>& band_origins = batch.band_ray_origins_workers[omp_get_thread_num()];
+    std::vector<std::vector<octomap::point3d>>& band_ends    = batch.band_ray_ends_workers[omp_get_thread_num()];
+
+#pragma omp for schedule(dynamic, 1)
+    for (size_t first = 0; first < n_free_vectors; first += ray_chunk) {
+
+      ray_ends.clear();
+
+      for (size_t i = first; i < std::min(first + ray_chunk, n_free_vectors); i++) {
+
+        octomap::point3d measured_point(free_vectors(0, i), free_vectors(1, i), free_vectors(2, i));
+        const float      point_distance = float((measured_point - sensor_origin).norm());
+
+        float t_min, t_max;
+        if (!clipRayToBox(sensor_origin, measured_point, box_min, box_max, t_min, t_max)) {
+          continue;
+        }
+
+        // move end point to distance min(free space ray len, current distance, distance to the border of the box)
+        ray_ends.push_back(sensor_origin + (measured_point - sensor_origin).normalize() *
+                                               std::min(free_space_ray_len, point_distance * std::min(t_max, 1.0f)));
+      }
+
+      traceRaysInBands(sensor_origin, ray_ends, distances, band_batches, band_origins, band_ends, ray_batch);
+
+      for (size_t r = 0; r < ray_batch.size(); r++) {
+
+        if (ray_batch.rayLength(r) == 0) {
+          continue;
+        }
+
+        if (unknown_clear_occupied) {
+          free_cells_worker.append(ray_batch.rayBegin(r), ray_batch.rayEnd(r));
+        } else {
+          free_rays_worker.append(ray_batch.rayBegin(r), ray_batch.rayEnd(r));
+          free_ray_lengths_worker.push_back(ray_batch.rayLength(r));
+        }
+      }
+    }
+  }
+
+  // for FREE RAY ENDS
+  const size_t n_free_ends = batch.free_ends.size();
+
+#pragma omp parallel num_threads(n_threads)
+  {
+    KeyBuffer&                     free_cells_worker = batch.free_cells_workers[omp_get_thread_num()];
+    RayBatch&                      ray_batch         = batch.ray_batches_workers[omp_get_thread_num()];
+    std::vector<octomap::point3d>& ray_ends          = batch.ray_ends_workers[omp_get_thread_num()];
+
+    std::vector<RayBatch>&                      band_batches = batch.band_ray_batches_workers[omp_get_thread_num()];
+    std::vector<std::vector<octomap::point3d>>& band_origins = batch.band_ray_origins_workers[omp_get_thread_num()];
+    std::vector<std::vector<octomap::point3d>>& band_ends    = batch.band_ray_ends_workers[omp_get_thread_num()];
+
+#pragma omp for schedule(dynamic, 1)
+    for (size_t first = 0; first < n_free_ends; first += ray_chunk) {
+
+      ray_ends.clear();
+
+      for (size_t i = first; i < std::min(first + ray_chunk, n_free_ends); i++) {
+        ray_ends.push_back(ray_tracer_.keyToCoord(mortonDecode(batch.free_ends[i])));
+      }
+
+      traceRaysInBands(sensor_origin, ray_ends, distances, band_batches, band_origins, band_ends, ray_batch);
+
+      for (size_t r = 0; r < ray_batch.size(); r++) {
+
+        const morton_t* ray_begin = ray_batch.rayBegin(r);
+        const morton_t* ray_end   = ray_batch.rayEnd(r);
+
+        const morton_t* alterantive_ray_end = ray_end;
+
+        for (const morton_t* it2 = ray_begin; it2 != ray_end; it2++) {
+
+          // a coarse node is occupied if it contains any of the occupied cells
+          const unsigned int level    = mortonLevel(*it2);
+          const bool         occupied = level == 0 ? batch.occupied_cells.contains(*it2)
+                                                   : batch.occupied_cells.containsRange(mortonFirstLeaf(*it2), mortonFirstLeaf(*it2) + (morton_t(1) << (3 * level)));
+
+          if (occupied) {
+
+            if (it2 == ray_begin) {
+              alterantive_ray_end = ray_begin;  // special case
+            } else {
+              alterantive_ray_end = it2 - 1;
+            }
+
+            break;
+          }
+        }
+
+        free_cells_worker.append(ray_begin, alterantive_ray_end);
+      }
+    }
+  }
+
+  // merge the results of the workers
+  for (int i = 0; i < n_threads; i++) {
+    batch.free_cells.append(batch.free_cells_workers[i]);
+    batch.free_rays.append(batch.free_rays_workers[i]);
+    batch.free_ray_lengths.insert(batch.free_ray_lengths.end(), batch.free_ray_lengths_workers[i].begin(), batch.free_ray_lengths_workers[i].end());
+  }
+
+  releaseInsertionThreads(n_threads);
+
+  batch.free_cells.sortUnique();
+}
+
+//}
+
+/* reserveInsertionThreads() //{ */
+
+/**
+ * @brief takes the threads for one scan from the budget shared by the concurrent scans
+ *
+ * A scan takes all the threads that are left, but always at least one, so it is never blocked by the others. The budget
+ * is oversubscribed by at most one thread per concurrent scan then.
+ *
+ * @return the number of threads for the scan, at most insertion/n_threads, it has to be given back by releaseInsertionThreads()
+ */
+int OctomapServer::reserveInsertionThreads() {
+
+  int available = insertion_threads_available_.load();
+  int n_threads;
+
+  do {
+    n_threads = std::max(1, available);
+  } while (!insertion_threads_available_.compare_exchange_weak(available, available - n_threads));
+
+  return n_threads;
+}
+
+//}
+
+/* releaseInsertionThreads() //{ */
+
+void OctomapServer::releaseInsertionThreads(const int n_threads) {
+
+  insertion_threads_available_ += n_threads;
+}
+
+//}
+
+/* traceRaysInBands() //{ */
+
+/**
+ * @brief traces the rays from the origin to the ends, the parts of the rays beyond the distances are traced through coarser nodes
+ *
+ * The part of a ray beyond distances[i] (and up to distances[i + 1]) is traced by coarse_ray_tracers_[i], i.e., through
+ * the nodes i + 1 levels above the leaves. The parts are concatenated into a single ray of the output batch, in the
+ * order from the origin.
+ */
+void OctomapServer::traceRaysInBands(const octomap::point3d& origin, const std::vector<octomap::point3d>& ends, const std::vector<double>& distances,
+                                     std::vector<RayBatch>& band_batches, std::vector<std::vector<octomap::point3d>>& band_origins,
+                                     std::vector<std::vector<octomap::point3d>>& band_ends, RayBatch& batch) {
+
+  if (distances.empty()) {
+    ray_tracer_.traceRays(origin, ends.data(), ends.size(), batch);
+    return;
+  }
+
+  const size_t n_rays  = ends.size();
+  const size_t n_bands = distances.size() + 1;
+
+  band_batches.resize(n_bands);
+  band_origins.resize(n_bands);
+  band_ends.resize(n_bands);
+
+  for (size_t b = 0; b < n_bands; b++) {
+    band_origins[b].resize(n_rays);
+    band_ends[b].resize(n_rays);
+  }
+
+  // split the rays at the distances, a band that the ray does not reach gets an empty ray
+  for (size_t i = 0; i < n_rays; i++) {
+
+    octomap::point3d direction = ends[i] - origin;
+
+    const float length = float(direction.norm());
+
+    direction.normalize();
+
+    for (size_t b = 0; b < n_bands; b++) {
+
+      const float from = b == 0 ? 0.0f : std::min(length, float(distances[b - 1]));
+      const float to   = b == n_bands - 1 ? length : std::min(length, float(distances[b]));
+
+      band_origins[b][i] = origin + direction * from;
+      band_ends[b][i]    = origin + direction * to;
+    }
+  }
+
+  ray_tracer_.traceRays(origin, band_ends[0].data(), n_rays, band_batches[0]);
+
+  for (size_t b = 1; b < n_bands; b++) {
+    coarse_ray_tracers_[b - 1].traceRays(band_origins[b].data(), band_ends[b].data(), n_rays, band_batches[b]);
+  }
+
+  // concatenate the parts of each ray
+  batch.begins.resize(n_rays);
+  batch.counts.resize(n_rays);
+
+  uint32_t n_keys = 0;
+
+  for (size_t i = 0; i < n_rays; i++) {
+
+    batch.begins[i] = n_keys;
+    batch.counts[i] = 0;
+
+    for (size_t b = 0; b < n_bands; b++) {
+      batch.counts[i] += band_batches[b].rayLength(i);
+    }
+
+    n_keys += batch.counts[i];
+  }
+
+  batch.keys.resize(n_keys);
+
+  for (size_t i = 0; i < n_rays; i++) {
+
+    morton_t* keys = batch.keys.data() + batch.begins[i];
+
+    for (size_t b = 0; b < n_bands; b++) {
+      keys = std::copy(band_batches[b].rayBegin(i), band_batches[b].rayEnd(i), keys);
+    }
+  }
+}
+
+//}
+
+/* integrateScan() //{ */
+
+void OctomapServer::integrateScan(const ScanBatch_t& batch) {
+
+  mrs_lib::ScopeTimer timer = mrs_lib::ScopeTimer("OctomapServer::integrateScan", scope_timer_logger_, _scope_timer_enabled_);
+
+  ros::Time time_start = ros::Time::now();
+
+  const octomap::point3d& sensor_origin = batch.sensor_origin;
+
+  // the window follows the sensor, only the slabs which left it are cleared
+  if (_local_map_rolling_grid_enabled_) {
+
+    octomap::OcTreeKey sensor_key;
+
+    if (ray_tracer_.coordToKeyChecked(sensor_origin, sensor_key)) {
+
+      // the cells leaving the window are lost by the move
+      octomap::OcTreeKey window_min, window_max;
+      rolling_grid_.getWindow(sensor_key, window_min, window_max);
+      flushDirtyCells(window_min, window_max);
+
+      rolling_grid_.moveTo(sensor_key);
+      rolling_grid_center_ = sensor_origin;
+    }
+  }
+
+  // the free vectors end before the first cell which is occupied in the map, the map is only read here,
+  // so the rays can be checked in parallel
+  {
+    const size_t n_rays    = batch.free_ray_lengths.size();
+    const int    n_threads = reserveInsertionThreads();
+
+    free_ray_offsets_.resize(n_rays);
+
+    size_t offset = 0;
+    for (size_t r = 0; r < n_rays; r++) {
+      free_ray_offsets_[r] = offset;
+      offset += batch.free_ray_lengths[r];
+    }
+
+    for (int i = 0; i < n_threads; i++) {
+      free_cells_workers_[i].clear();
+    }
+
+#pragma omp parallel num_threads(n_threads)
+    {
+      KeyBuffer& free_cells_worker = free_cells_workers_[omp_get_thread_num()];
+
+#pragma omp for schedule(dynamic, 256)
+      for (size_t r = 0; r < n_rays; r++) {
+
+        const morton_t* ray_begin = batch.free_rays.data() + free_ray_offsets_[r];
+        const morton_t* ray_end   = ray_begin + batch.free_ray_lengths[r];
+
+        const morton_t* alterantive_ray_end = ray_end;
+
+        for (const morton_t* it2 = ray_begin; it2 != ray_end; it2++) {
+
+          // check if the cell is occupied in the map, a coarse node is occupied if any of its leaves is
+          const unsigned int       level = mortonLevel(*it2);
+          const octomap::OcTreeKey key   = mortonDecode(mortonFirstLeaf(*it2));
+
+          bool occupied;
+
+          if (_local_map_rolling_grid_enabled_) {
+            occupied = level == 0 ? rolling_grid_.isOccupied(key) : rolling_grid_.isOccupied(key, level);
+          } else {
+            auto node = octree_local_->search(key, octree_local_->getTreeDepth() - level);
+            occupied  = node && octree_local_->isNodeOccupied(node);
+          }
+
+          if (occupied) {
+
+            if (it2 == ray_begin) {
+              alterantive_ray_end = ray_begin;  // special case
+            } else {
+              alterantive_ray_end = it2 - 1;
+            }
+
+            break;
+          }
+        }
+
+        free_cells_worker.append(ray_begin, alterantive_ray_end);
+      }
+    }
+
+    free_cells_.clear();
+
+    for (int i = 0; i < n_threads; i++) {
+      free_cells_.append(free_cells_workers_[i]);
+    }
+
+    releaseInsertionThreads(n_threads);
+
+    free_cells_.sortUnique();
+    free_cells_.mergeUnique(batch.free_cells);
+  }
+
+  const KeyBuffer& occupied_cells = batch.occupied_cells;
+
+  // merge the FREE CELLS and the OCCUPIED CELLS into a single batch sorted by the Morton code,
+  // a cell present in both gets the miss applied before the hit
+  {
+    const float miss = octree_local_->getProbMissLog();
+    const float hit  = octree_local_->getProbHitLog();
+
+    update_batch_.clear();
+
+    KeyBuffer::const_iterator it_free = free_cells_.begin(), it_occupied = occupied_cells.begin();
+
+    while (it_free != free_cells_.end() || it_occupied != occupied_cells.end()) {
+
+      if (it_occupied == occupied_cells.end() || (it_free != free_cells_.end() && *it_free <= *it_occupied)) {
+
+        // a miss would not change a leaf clamped at the minimum
+        if (!(_local_map_saturation_tracking_enabled_ && mortonLevel(*it_free) == 0 && saturation_bitmap_.test(mortonDecode(*it_free)))) {
+          update_batch_.push_back({*it_free, miss});
+        }
+
+        it_free++;
+      } else {
+        update_batch_.push_back({*it_occupied, hit});
+        it_occupied++;
+      }
+    }
+
+    // the batch is still sorted by the Morton code here, the changed cells are noted for the global map and the deltas
+    if (_global_map_enabled_ || _local_map_delta_enabled_) {
+
+      changed_cells_.clear();
+
+      for (const KeyUpdate_t& update : update_batch_) {
+        if (changed_cells_.empty() || changed_cells_[changed_cells_.size() - 1] != update.code) {
+          changed_cells_.push_back(update.code);
+        }
+      }
+
+      if (_global_map_enabled_) {
+        dirty_cells_.mergeUnique(changed_cells_);
+      }
+
+      if (_local_map_delta_enabled_) {
+        local_map_delta_cells_.mergeUnique(changed_cells_);
+      }
+    }
+
+    // the coarse nodes sort after all the leaves, they are merged into their place in front of their leaves
+    auto first_node = std::find_if(update_batch_.begin(), update_batch_.end(), [](const KeyUpdate_t& u) { return mortonLevel(u.code) > 0; });
+
+    if (first_node != update_batch_.end()) {
+      std::sort(first_node, update_batch_.end(), keyUpdateLess);
+      std::inplace_merge(update_batch_.begin(), first_node, update_batch_.end(), keyUpdateLess);
+    }
+  }
+
+  if (_local_map_rolling_grid_enabled_) {
+
+    for (const KeyUpdate_t& update : update_batch_) {
+
+      const unsigned int level = mortonLevel(update.code);
+
+      if (level == 0) {
+        rolling_grid_.update(mortonDecode(update.code), update.delta);
+      } else {
+        rolling_grid_.update(mortonDecode(mortonFirstLeaf(update.code)), update.delta, level);
+      }
+    }
+
+  } else if (_local_map_saturation_tracking_enabled_) {
+
+    saturated_cells_.clear();
+
+    updateNodesBatch(*octree_local_, update_batch_, &saturated_cells_);
+
+    for (const morton_t code : occupied_cells) {
+      saturation_bitmap_.reset(mortonDecode(code));
+    }
+
+    for (const morton_t code : saturated_cells_) {
+      saturation_bitmap_.set(mortonDecode(code));
+    }
+
+  } else {
+
+    updateNodesBatch(*octree_local_, update_batch_);
+  }
+
+  /* octomap::OcTreeKey robot_key = octree_local_->coordToKey(robotOriginTf.x, robotOriginTf.y, robotOriginTf.z); */
+  /* octree_local_->updateNode(robot_key, false); */
+
+  // the box of the local map around the robot, also sent with the deltas of the local map
+  {
+    auto [local_map_width, local_map_height] = mrs_lib::get_mutexed(mutex_local_map_dimensions_, local_map_width_, local_map_height_);
+
+    float x        = sensor_origin.x();
+    float y        = sensor_origin.y();
+    float z        = sensor_origin.z();
+    float width_2  = local_map_width / float(2.0);
+    float height_2 = local_map_height / float(2.0);
+
+    local_map_roi_min_ = octomap::point3d(x - width_2, y - width_2, z - height_2);
+    local_map_roi_max_ = octomap::point3d(x + width_2, y + width_2, z + height_2);
+  }
+
+  // CROP THE MAP AROUND THE ROBOT, the rolling grid has been cropped by moving it
+  if (!_local_map_rolling_grid_enabled_) {
+
+    mrs_lib::ScopeTimer timer = mrs_lib::ScopeTimer("OctomapServer::localMapCopy", scope_timer_logger_, _scope_timer_enabled_);
+
+    const octomap::point3d& roi_min = local_map_roi_min_;
+    const octomap::point3d& roi_max = local_map_roi_max_;
+
+    octomap::OcTreeKey min_key, max_key;
+
+    if (octree_local_->coordToKeyChecked(roi_min, min_key) && octree_local_->coordToKeyChecked(roi_max, max_key)) {
+
+      flushDirtyCells(min_key, max_key);
+
+      // the same crop as the export of the rolling grid, the pruned nodes crossing the boundary are expanded
+      cropTree(*octree_local_, min_key, max_key);
+
+      // the saturated leaves have to stay in the map, the bits of the cropped ones are cleared
+      if (_local_map_saturation_tracking_enabled_) {
+        saturation_bitmap_.moveTo(min_key, max_key);
+      }
+
+    } else if (_local_map_saturation_tracking_enabled_) {
+      saturation_bitmap_.clear();
+    }
+  }
+
+  /* set free space in the bounding box specified by clear_box topic */ /*//{*/
+  {
+    // TODO mutex?
+    if (sh_clear_box_.hasMsg()) {
+      mrs_octomap_server::PoseWithSize pws = *sh_clear_box_.getMsg();
+      if ((ros::Time::now() - pws.header.stamp).toSec() < 1.0) {
+        // transform the pose to octomap frame
+        geometry_msgs::PoseStamped pose_stamped;
+        pose_stamped.header = pws.header;
+        pose_stamped.pose   = pws.pose;
+        auto res            = transformer_->transformSingle(pose_stamped, _world_frame_);
+        if (res) {
+          auto pose = res.value();
+          // calculate bounding box around the odometry
+          double resolution = octree_local_->getResolution();
+          double min_x      = pose.pose.position.x - pws.width / 2 - resolution;
+          double max_x      = pose.pose.position.x + pws.width / 2 + resolution;
+          double min_y      = pose.pose.position.y - pws.width / 2 - resolution;
+          double max_y      = pose.pose.position.y + pws.width / 2 + resolution;
+          double min_z      = pose.pose.position.z - pws.height / 2 - resolution;
+          double max_z      = pose.pose.position.z + pws.height / 2 + resolution;
+          double step       = resolution / 2;
+
+          // both of the backends set the cells free at the minimum, the value of a cell cleared by the misses
+          const float free_value = octree_local_->getClampingThresMinLog();
+
+          changed_cells_.clear();
+
+          // set the values in the octree
+          for (double x = min_x; x < max_x; x += step) {
+            for (double y = min_y; y < max_y; y += step) {
+              for (double z = min_z; z < max_z; z += step) {
+                if (_local_map_rolling_grid_enabled_) {
+
+                  octomap::OcTreeKey key;
+
+                  if (ray_tracer_.coordToKeyChecked(octomap::point3d(x, y, z), key)) {
+                    rolling_grid_.setValue(key, free_value);
+                  }
+
+                } else {
+                  octree_local_->setNodeValue(x, y, z, free_value);
+                }
+
+                saturation_bitmap_.reset(octree_local_->coordToKey(x, y, z));
+
+                changed_cells_.push_back(octree_local_->coordToKey(x, y, z));
+              }
+            }
+          }
+
+          changed_cells_.sortUnique();
+
+          if (_global_map_enabled_) {
+            dirty_cells_.mergeUnique(changed_cells_);
+          }
+
+          if (_local_map_delta_enabled_) {
+            local_map_delta_cells_.mergeUnique(changed_cells_);
+          }
+        } else {
+          ROS_WARN_THROTTLE(1.0, "[OctomapServer]: Unable to transform the pose to be cleared from frame %s to frame %s.", pws.header.frame_id.c_str(),
+                            _world_frame_.c_str());
+        }
+      } else {
+        ROS_WARN_THROTTLE(1.0, "[OctomapServer]: Latest pose from clear_box is too old - diff from now: %.3f", (ros::Time::now() - pws.header.stamp).toSec());
+      }
+    }
+  }
+  /*//}*/
+
+  octree_local_version_++;
+
+  // the copy for the readers is taken here, the local map is in the cache and the lock is held already
+  if (octree_local_snapshot_wanted_.exchange(false)) {
+    updateLocalMapSnapshot();
+  }
+
+  ros::Time time_end = ros::Time::now();
+
+  {
+    std::scoped_lock lock(mutex_local_map_duty_);
+
+    local_map_duty_ += (time_end - time_start).toSec();
+  }
+
+  {
+    std::scoped_lock lock(mutex_avg_time_cloud_integration_);
+
+    double exec_duration = (time_end - time_start).toSec();
+
+    double coef                 = 0.5;
+    avg_time_cloud_integration_ = coef * avg_time_cloud_integration_ + (1.0 - coef) * exec_duration;
+
+    ROS_INFO_THROTTLE(1.0, "[OctomapServer]: avg cloud integration time = %.3f sec", avg_time_cloud_integration_);
+  }
+}
+
+//}
+
+/* getGlobalMapSnapshot() //{ */
+
+/**
+ * @brief an immutable copy of the global map, the copy is taken only if the map has changed since the last one
+ *
+ * The snapshot can be read without any lock, it stays valid for as long as it is held. Once fetched, the snapshot is
+ * refreshed by the global map creator right after its next merge, so the periodic readers find it ready.
+ *
+ * @param version the version of the map the snapshot was taken from (optional output)
+ * @param latest if false, the snapshot refreshed by the creator since the previous fetch is returned even if the map
+ * has changed after it, the reader does not copy the map then
+ */
+std::shared_ptr<const OcTree_t> OctomapServer::getGlobalMapSnapshot(uint64_t* version, const bool latest) {
+
+  std::scoped_lock lock(mutex_octree_global_);
+
+  // cleared by the writer once it has refreshed the snapshot
+  const bool refreshed = !octree_global_snapshot_wanted_.exchange(true);
+
+  if (!latest && refreshed && octree_global_snapshot_) {
+
+    if (version) {
+      *version = octree_global_snapshot_version_;
+    }
+
+    return octree_global_snapshot_;
+  }
+
+  return updateGlobalMapSnapshot(version);
+}
+
+//}
+
+/* updateGlobalMapSnapshot() //{ */
+
+/**
+ * @brief getGlobalMapSnapshot() with mutex_octree_global_ already locked
+ */
+std::shared_ptr<const OcTree_t> OctomapServer::updateGlobalMapSnapshot(uint64_t* version) {
+
+  if (!octree_global_snapshot_ || octree_global_snapshot_version_ != octree_global_version_) {
+
+    mrs_lib::ScopeTimer timer = mrs_lib::ScopeTimer("OctomapServer::globalMapSnapshot", scope_timer_logger_, _scope_timer_enabled_);
+
+    octree_global_snapshot_         = std::make_shared<const OcTree_t>(*octree_global_);
+    octree_global_snapshot_version_ = octree_global_version_;
+  }
+
+  if (version) {
+    *version = octree_global_snapshot_version_;
+  }
+
+  return octree_global_snapshot_;
+}
+
+//}
+
+/* getLocalMapSnapshot() //{ */
+
+/**
+ * @brief an immutable copy of the local map, the copy is taken only if the map has changed since the last one
+ *
+ * Once fetched, the snapshot is refreshed by the integrator right after its next scan, see getGlobalMapSnapshot().
+ */
+std::shared_ptr<const OcTree_t> OctomapServer::getLocalMapSnapshot(uint64_t* version, const bool latest) {
+
+  std::scoped_lock lock(mutex_octree_local_);
+
+  const bool refreshed = !octree_local_snapshot_wanted_.exchange(true);
+
+  if (!latest && refreshed && octree_local_snapshot_) {
+
+    if (version) {
+      *version = octree_local_snapshot_version_;
+    }
+
+    return octree_local_snapshot_;
+  }
+
+  return updateLocalMapSnapshot(version);
+}
+
+//}
+
+/* updateLocalMapSnapshot() //{ */
+
+/**
+ * @brief getLocalMapSnapshot() with mutex_octree_local_ already locked
+ */
+std::shared_ptr<const OcTree_t> OctomapServer::updateLocalMapSnapshot(uint64_t* version) {
+
+  exportRollingGrid();
+
+  if (!octree_local_snapshot_ || octree_local_snapshot_version_ != octree_local_version_) {
+
+    mrs_lib::ScopeTimer timer = mrs_lib::ScopeTimer("OctomapServer::localMapSnapshot", scope_timer_logger_, _scope_timer_enabled_);
+
+    octree_local_snapshot_         = std::make_shared<const OcTree_t>(*octree_local_);
+    octree_local_snapshot_version_ = octree_local_version_;
+  }
+
+  if (version) {
+    *version = octree_local_snapshot_version_;
+  }
+
+  return octree_local_snapshot_;
+}
+
+//}
+
+/* getMapMsg() //{ */
+
+/**
+ * @brief the full or binary serialization of the snapshot, serialized only once per version of the map
+ *
+ * A consumer asking for the version being serialized waits for it instead of serializing it again.
+ *
+ * @return the message, nullptr if the serialization failed
+ */
+octomap_msgs::OctomapConstPtr OctomapServer::getMapMsg(MapMsgCache_t& cache, const std::shared_ptr<const OcTree_t>& octree, const uint64_t version,
+                                                       const bool binary) {
+
+  std::scoped_lock lock(cache.mutex);
+
+  octomap_msgs::OctomapConstPtr& cached         = binary ? cache.binary : cache.full;
+  uint64_t&                      cached_version = binary ? cache.binary_version : cache.full_version;
+
+  if (cached && cached_version == version) {
+    return cached;
+  }
+
+  boost::shared_ptr<octomap_msgs::Octomap> map = boost::make_shared<octomap_msgs::Octomap>();
+
+  if (!serializeMap(*octree, binary, *map)) {
+    return nullptr;
+  }
+
+  cached         = map;
+  cached_version = version;
+
+  return cached;
+}
+
+//}
+
+/* serializeMap() //{ */
+
+/**
+ * @brief the full or binary serialization of the map, by the parallel serializer if it has more than one thread
+ */
+bool OctomapServer::serializeMap(const OcTree_t& octree, const bool binary, octomap_msgs::Octomap& map) {
+
+  map.header.frame_id = _world_frame_;
+  map.header.stamp    = ros::Time::now();
+
+  if (binary) {
+
+    mrs_lib::ScopeTimer timer = mrs_lib::ScopeTimer("OctomapServer::mapBinarySerialization", scope_timer_logger_, _scope_timer_enabled_);
+
+    if (_serialization_n_threads_ > 1) {
+      return map_serializer_.binaryMapToMsg(octree, map);
+    } else {
+      return octomap_msgs::binaryMapToMsg(octree, map);
+    }
+
+  } else {
+
+    mrs_lib::ScopeTimer timer = mrs_lib::ScopeTimer("OctomapServer::mapFullSerialization", scope_timer_logger_, _scope_timer_enabled_);
+
+    if (_serialization_n_threads_ > 1) {
+      return map_serializer_.fullMapToMsg(octree, map);
+    } else {
+      return octomap_msgs::fullMapToMsg(octree, map);
+    }
+  }
+}
+
+//}
+
+/* getMapRoi() //{ */
+
+/**
+ * @brief extracts and serializes the region of the global or the local map, the map is read from its snapshot
+ *
+ * @param roi the request
+ * @param map the output
+ * @param message the reason of a failure
+ * @param version the version of the map the region was taken from (optional output)
+ */
+bool OctomapServer::getMapRoi(const mrs_octomap_server::MapRoi& roi, octomap_msgs::Octomap& map, std::string& message, uint64_t* version) {
+
+  if (!roi.header.frame_id.empty() && roi.header.frame_id != _world_frame_) {
+    message = "the box has to be given in the frame of the map, " + _world_frame_;
+    return false;
+  }
+
+  if (roi.map != mrs_octomap_server::MapRoi::GLOBAL_MAP && roi.map != mrs_octomap_server::MapRoi::LOCAL_MAP) {
+    message = "unknown map";
+    return false;
+  }
+
+  if (roi.map == mrs_octomap_server::MapRoi::GLOBAL_MAP && !_global_map_enabled_) {
+    message = "the global map is disabled";
+    return false;
+  }
+
+  if (roi.min.x > roi.max.x || roi.min.y > roi.max.y || roi.min.z > roi.max.z) {
+    message = "the box is empty";
+    return false;
+  }
+
+  std::shared_ptr<const OcTree_t> octree = roi.map == mrs_octomap_server::MapRoi::LOCAL_MAP ? getLocalMapSnapshot(version) : getGlobalMapSnapshot(version);
+
+  std::shared_ptr<OcTree_t> region = extractRoi(octree, octomap::point3d(roi.min.x, roi.min.y, roi.min.z), octomap::point3d(roi.max.x, roi.max.y, roi.max.z));
+
+  if (!serializeMap(*region, roi.binary, map)) {
+    message = "error serializing the map";
+    return false;
+  }
+
+  message = "the map of the region has " + std::to_string(region->size()) + " nodes";
+
+  return true;
+}
+
+//}
+
+/* extractRoi() //{ */
+
+/**
+ * @brief copies the leaves of the map inside of the box into a new tree, the parts of the box outside of the map are cut off
+ */
+std::shared_ptr<OcTree_t> OctomapServer::extractRoi(const std::shared_ptr<const OcTree_t>& octree, const octomap::point3d& roi_min,
+                                                    const octomap::point3d& roi_max) {
+
+  mrs_lib::ScopeTimer timer = mrs_lib::ScopeTimer("OctomapServer::extractRoi", scope_timer_logger_, _scope_timer_enabled_);
+
+  std::shared_ptr<OcTree_t> roi = std::make_shared<OcTree_t>(octree->getResolution());
+  roi->setProbHit(_probHit_);
+  roi->setProbMiss(_probMiss_);
+  roi->setClampingThresMin(_thresMin_);
+  roi->setClampingThresMax(_thresMax_);
+
+  copyBox(*octree, roi_min, roi_max, *roi);
+
+  return roi;
+}
+
+//}
 
-    align_using_height = false;
-  }
+/* fillDeltaNodes() //{ */
 
-  // | ------ get the current UAV position in the map frame ----- |
+/**
+ * @brief stores the nodes (as produced by collectNodes()) in the delta message
+ */
+void OctomapServer::fillDeltaNodes(const std::vector<KeyUpdate_t>& nodes, mrs_octomap_server::OctomapDelta& delta) {
 
-  auto res = transformer_->getTransform(_robot_frame_, _world_frame_);
+  delta.keyframe   = false;
+  delta.resolution = octree_resolution_;
 
-  double robot_x, robot_y, robot_z;
+  delta.codes.resize(nodes.size());
+  delta.log_odds.resize(nodes.size());
 
-  if (res) {
+  for (size_t i = 0; i < nodes.size(); i++) {
+    delta.codes[i]    = nodes[i].code;
+    delta.log_odds[i] = nodes[i].delta;
+  }
+}
 
-    geometry_msgs::TransformStamped world_to_robot = res.value();
+//}
 
-    robot_x = world_to_robot.transform.translation.x;
-    robot_y = world_to_robot.transform.translation.y;
-    robot_z = world_to_robot.transform.translation.z;
+/* publishKeyframe() //{ */
 
-    ROS_INFO("[OctomapServer]: robot coordinates %.2f, %.2f, %.2f", robot_x, robot_y, robot_z);
+/**
+ * @brief puts the full serialization of the map into the delta message as a keyframe and publishes it, the version has to be filled in
+ */
+void OctomapServer::publishKeyframe(ros::Publisher& publisher, MapMsgCache_t& cache, const std::shared_ptr<const OcTree_t>& octree,
+                                    mrs_octomap_server::OctomapDelta& delta) {
 
-  } else {
+  octomap_msgs::OctomapConstPtr map = getMapMsg(cache, octree, delta.version, false);
 
-    ROS_INFO_THROTTLE(1.0, "[OctomapServer]: waiting for the tf from %s to %s", _world_frame_.c_str(), _robot_frame_.c_str());
+  if (!map) {
+    ROS_ERROR("[OctomapServer]: error serializing the keyframe");
     return;
   }
 
-  auto ground_z = getGroundZ(octree_global_, robot_x, robot_y);
+  delta.header.frame_id = _world_frame_;
+  delta.header.stamp    = ros::Time::now();
+  delta.keyframe        = true;
+  delta.base_version    = delta.version;
+  delta.resolution      = octree->getResolution();
+  delta.octomap         = *map;
 
-  if (!ground_z) {
+  publisher.publish(delta);
+}
 
-    ROS_WARN_THROTTLE(1.0, "[OctomapServer]: could not calculate the Z of the ground below");
+//}
 
-    {
-      std::scoped_lock lock(mutex_octree_global_, mutex_octree_local_);
+/* exportRollingGrid() //{ */
 
-      octree_global_->clear();
-      octree_local_->clear();
+/**
+ * @brief updates octree_local_ from the rolling grid if the grid or the box of the local map has changed since the last export,
+ * mutex_octree_local_ has to be locked
+ *
+ * Only the cells changed since the last export and the cells that entered the box are written into the tree, the tree is
+ * built anew only when the grid does not know its changes (e.g., after it was cleared).
+ */
+void OctomapServer::exportRollingGrid() {
 
-      octrees_initialized_ = true;
-    }
+  if (!_local_map_rolling_grid_enabled_) {
+    return;
+  }
 
-    timer_altitude_alignment_.stop();
+  auto [local_map_width, local_map_height] = mrs_lib::get_mutexed(mutex_local_map_dimensions_, local_map_width_, local_map_height_);
 
-    ROS_INFO("[OctomapServer]: stopping the altitude alignment timer");
+  const float width_2  = local_map_width / float(2.0);
+  const float height_2 = local_map_height / float(2.0);
 
-    return;
-  }
+  const octomap::point3d roi_min = rolling_grid_center_ - octomap::point3d(width_2, width_2, height_2);
+  const octomap::point3d roi_max = rolling_grid_center_ + octomap::point3d(width_2, width_2, height_2);
 
-  double ground_z_should_be = 0;
+  octomap::OcTreeKey min_key, max_key;
 
-  if (align_using_height) {
-    ground_z_should_be = robot_z - sh_height_.getMsg()->value;
-  } else {
-    ground_z_should_be = robot_z - _robot_height_ - 0.5 * octree_global_->getResolution();
+  if (!octree_local_->coordToKeyChecked(roi_min, min_key) || !octree_local_->coordToKeyChecked(roi_max, max_key)) {
+    return;
   }
 
-  double offset = ground_z_should_be - ground_z.value();
+  // the tree holds only the cells of the grid
+  if (!rolling_grid_.intersectWindow(min_key, max_key)) {
+    return;
+  }
 
-  ROS_INFO("[OctomapServer]: ground is at height %.2f m", ground_z.value());
-  ROS_INFO("[OctomapServer]: ground should be at height %.2f m", ground_z_should_be);
-  ROS_INFO("[OctomapServer]: shifting ground by %.2f m", offset);
+  if (rolling_grid_.getVersion() == rolling_grid_exported_version_ && min_key == rolling_grid_exported_min_key_ &&
+      max_key == rolling_grid_exported_max_key_) {
+    return;
+  }
 
-  translateMap(octree_global_, 0, 0, offset);
-  translateMap(octree_local_, 0, 0, offset);
+  mrs_lib::ScopeTimer timer = mrs_lib::ScopeTimer("OctomapServer::exportRollingGrid", scope_timer_logger_, _scope_timer_enabled_);
 
-  octrees_initialized_ = true;
+  if (rolling_grid_.exportChanges(rolling_grid_exported_version_, min_key, max_key, rolling_grid_exported_min_key_, rolling_grid_exported_max_key_,
+                                  rolling_grid_cells_)) {
 
-  timer_altitude_alignment_.stop();
-}
+    // the cells which left the box, then the changed ones and the ones which entered it
+    cropTree(*octree_local_, min_key, max_key);
+    setLeavesBatch(*octree_local_, rolling_grid_cells_);
 
-//}
+    // the receivers of the deltas need the cells which entered the box too, not only the changed ones
+    if (_local_map_delta_enabled_) {
 
-// | ------------------------ routines ------------------------ |
+      for (const KeyUpdate_t& cell : rolling_grid_cells_) {
+        local_map_delta_cells_.push_back(cell.code);
+      }
 
-/* insertPointCloud() //{ */
+      local_map_delta_cells_.sortUnique();
+    }
 
-void OctomapServer::insertPointCloud(const geometry_msgs::Vector3& sensorOriginTf, const PCLPointCloud::ConstPtr& cloud,
-                                     const PCLPointCloud::ConstPtr& free_vectors_cloud, double free_ray_distance, bool unknown_clear_occupied) {
+  } else {
 
-  mrs_lib::ScopeTimer timer = mrs_lib::ScopeTimer("OctomapServer::timerInsertPointCloud", scope_timer_logger_, _scope_timer_enabled_);
+    // the values of the cells are applied as updates of a fresh tree
+    rolling_grid_.exportCells(min_key, max_key, rolling_grid_cells_);
 
-  ros::Time time_start = ros::Time::now();
+    octree_local_->clear();
+    updateNodesBatch(*octree_local_, rolling_grid_cells_);
 
-  std::scoped_lock lock(mutex_octree_local_);
+    // the tree is not a delta of the previous one
+    local_map_keyframe_needed_ = true;
+  }
 
-  auto [local_map_width, local_map_height] = mrs_lib::get_mutexed(mutex_local_map_dimensions_, local_map_width_, local_map_height_);
+  rolling_grid_exported_min_key_ = min_key;
+  rolling_grid_exported_max_key_ = max_key;
+}
 
-  const octomap::point3d sensor_origin = octomap::pointTfToOctomap(sensorOriginTf);
+//}
 
-  const float free_space_ray_len = std::min(float(free_ray_distance), float(sqrt(2 * pow(local_map_width / 2.0, 2) + pow(local_map_height / 2.0, 2))));
+/* getCloudXyzOffsets() //{ */
 
-  octomap::KeySet occupied_cells;
-  octomap::KeySet free_cells;
-  octomap::KeySet free_ends;
+bool OctomapServer::getCloudXyzOffsets(const sensor_msgs::PointCloud2& cloud, uint32_t (&offsets)[3]) {
 
-  // all measured points: make it free on ray, occupied on endpoint:
-  for (PCLPointCloud::const_iterator it = cloud->begin(); it != cloud->end(); ++it) {
+  const char* names[3] = {"x", "y", "z"};
 
-    if (!(std::isfinite(it->x) && std::isfinite(it->y) && std::isfinite(it->z))) {
-      continue;
-    }
+  for (int j = 0; j < 3; j++) {
 
-    octomap::point3d measured_point(it->x, it->y, it->z);
-    const float      point_distance = float((measured_point - sensor_origin).norm());
+    auto field = std::find_if(cloud.fields.begin(), cloud.fields.end(), [&](const sensor_msgs::PointField& f) { return f.name == names[j]; });
 
-    octomap::OcTreeKey key;
-    if (octree_local_->coordToKeyChecked(measured_point, key)) {
-      occupied_cells.insert(key);
+    if (field == cloud.fields.end() || field->datatype != sensor_msgs::PointField::FLOAT32 || field->offset + sizeof(float) > cloud.point_step) {
+      return false;
     }
 
-    // move end point to distance min(free space ray len, current distance)
-    measured_point = sensor_origin + (measured_point - sensor_origin).normalize() * std::min(free_space_ray_len, point_distance);
-
-    octomap::OcTreeKey measured_key = octree_local_->coordToKey(measured_point);
+    offsets[j] = field->offset;
+  }
 
-    free_ends.insert(measured_key);
+  // the points have to fit into the data buffer
+  if (cloud.width > 0 && cloud.height > 0 &&
+      size_t(cloud.height - 1) * cloud.row_step + size_t(cloud.width) * cloud.point_step > cloud.data.size()) {
+    return false;
   }
 
-  // FREE VECTORS
-  for (PCLPointCloud::const_iterator it = free_vectors_cloud->begin(); it != free_vectors_cloud->end(); ++it) {
+  return true;
+}
 
-    if (!(std::isfinite(it->x) && std::isfinite(it->y) && std::isfinite(it->z))) {
-      continue;
-    }
+//}
 
-    octomap::point3d measured_point(it->x, it->y, it->z);
-    const float      point_distance = float((measured_point - sensor_origin).norm());
+/* clipRayToBox() //{ */
 
-    octomap::KeyRay keyRay;
+/**
+ * @brief slab clipping of the segment from the origin to the end against the axis-aligned box
+ *
+ * @param t_min the fraction of the segment where it enters the box
+ * @param t_max the fraction of the segment where it leaves the box, >= 1 if the end is inside of the box
+ *
+ * @return false if the segment misses the box
+ */
+bool OctomapServer::clipRayToBox(const octomap::point3d& origin, const octomap::point3d& end, const octomap::point3d& box_min,
+                                 const octomap::point3d& box_max, float& t_min, float& t_max) {
 
-    // move end point to distance min(free space ray len, current distance)
-    measured_point = sensor_origin + (measured_point - sensor_origin).normalize() * std::min(free_space_ray_len, point_distance);
+  t_min = 0.0f;
+  t_max = std::numeric_limits<float>::max();
 
-    // check if the ray intersects a cell in the occupied list
-    if (octree_local_->computeRayKeys(sensor_origin, measured_point, keyRay)) {
+  for (int j = 0; j < 3; j++) {
 
-      octomap::KeyRay::iterator alterantive_ray_end = keyRay.end();
+    const float d = end(j) - origin(j);
 
-      if (!unknown_clear_occupied) {
+    if (d == 0.0f) {
 
-        for (octomap::KeyRay::iterator it2 = keyRay.begin(), end = keyRay.end(); it2 != end; ++it2) {
+      // parallel with the slab
+      if (origin(j) < box_min(j) || origin(j) > box_max(j)) {
+        return false;
+      }
 
-          // check if the cell is occupied in the map
-          auto node = octree_local_->search(*it2);
+      continue;
+    }
 
-          if (node && octree_local_->isNodeOccupied(node)) {
+    float t0 = (box_min(j) - origin(j)) / d;
+    float t1 = (box_max(j) - origin(j)) / d;
 
-            if (it2 == keyRay.begin()) {
-              alterantive_ray_end = keyRay.begin();  // special case
-            } else {
-              alterantive_ray_end = it2 - 1;
-            }
+    if (t0 > t1) {
+      std::swap(t0, t1);
+    }
 
-            break;
-          }
-        }
-      }
+    t_min = std::max(t_min, t0);
+    t_max = std::min(t_max, t1);
 
-      free_cells.insert(keyRay.begin(), alterantive_ray_end);
+    if (t_min > t_max) {
+      return false;
     }
   }
 
-  // for FREE RAY ENDS
-  for (octomap::KeySet::iterator it = free_ends.begin(), end = free_ends.end(); it != end; ++it) {
+  return true;
+}
 
-    octomap::point3d coords = octree_local_->keyToCoord(*it);
+//}
 
-    octomap::KeyRay key_ray;
-    if (octree_local_->computeRayKeys(sensor_origin, coords, key_ray)) {
+/* downsamplePoints() //{ */
 
-      octomap::KeyRay::iterator alterantive_ray_end = key_ray.end();
+/**
+ * @brief keeps the first of the points falling into each cube of the leaf size, the points are compacted in place
+ *
+ * The cubes are aligned with the origin of the map frame, therefore, the leaf size equal to the map resolution keeps a
+ * single point per voxel.
+ *
+ * @return the number of the remaining points
+ */
+size_t OctomapServer::downsamplePoints(vec3s_t& points, const size_t n_points, const float leaf_size) {
 
-      for (octomap::KeyRay::iterator it2 = key_ray.begin(), end = key_ray.end(); it2 != end; ++it2) {
+  // the cell coordinates are packed into 21 bits each, which covers +-1e6 leaves
+  thread_local std::vector<std::pair<uint64_t, uint32_t>> cells;
 
-        if (occupied_cells.count(*it2)) {
+  cells.resize(n_points);
 
-          if (it2 == key_ray.begin()) {
-            alterantive_ray_end = key_ray.begin();  // special case
-          } else {
-            alterantive_ray_end = it2 - 1;
-          }
+  const float inv_leaf_size = 1.0f / leaf_size;
 
-          break;
-        }
-      }
+  for (size_t i = 0; i < n_points; i++) {
+
+    uint64_t code = 0;
 
-      free_cells.insert(key_ray.begin(), alterantive_ray_end);
+    for (int j = 0; j < 3; j++) {
+      const int64_t c = int64_t(std::floor(points(j, i) * inv_leaf_size)) + (1 << 20);
+      code |= (uint64_t(c) & 0x1fffff) << (21 * j);
     }
+
+    cells[i] = {code, uint32_t(i)};
   }
 
-  octomap::OcTreeNode* root = octree_local_->getRoot();
+  // ties are ordered by the index, the first point of each cell comes first
+  std::sort(cells.begin(), cells.end());
 
-  bool got_root = root ? true : false;
+  size_t n_kept = 0;
 
-  if (!got_root) {
-    octomap::OcTreeKey key = octree_local_->coordToKey(0, 0, 0, octree_local_->getTreeDepth());
-    octree_local_->setNodeValue(key, octomap::logodds(0.0));
-  }
+  for (size_t i = 0; i < n_points; i++) {
 
-  // FREE CELLS
-  for (octomap::KeySet::iterator it = free_cells.begin(), end = free_cells.end(); it != end; ++it) {
+    if (i > 0 && cells[i].first == cells[i - 1].first) {
+      continue;
+    }
 
-    octree_local_->updateNode(*it, octree_local_->getProbMissLog());
+    cells[n_kept++].second = cells[i].second;
   }
 
-  // OCCUPIED CELLS
-  for (octomap::KeySet::iterator it = occupied_cells.begin(), end = occupied_cells.end(); it != end; it++) {
+  // keep the original order of the points, the reads are then always ahead of the writes
+  std::sort(cells.begin(), cells.begin() + n_kept,
+            [](const std::pair<uint64_t, uint32_t>& a, const std::pair<uint64_t, uint32_t>& b) { return a.second < b.second; });
 
-    octree_local_->updateNode(*it, octree_local_->getProbHitLog());
+  for (size_t i = 0; i < n_kept; i++) {
+    points.col(i) = points.col(cells[i].second);
   }
 
-  /* octomap::OcTreeKey robot_key = octree_local_->coordToKey(robotOriginTf.x, robotOriginTf.y, robotOriginTf.z); */
-  /* octree_local_->updateNode(robot_key, false); */
+  return n_kept;
+}
 
-  // CROP THE MAP AROUND THE ROBOT
-  {
+//}
 
-    mrs_lib::ScopeTimer timer = mrs_lib::ScopeTimer("OctomapServer::localMapCopy", scope_timer_logger_, _scope_timer_enabled_);
+/* initialize2DLidarLUT() //{ */
 
-    auto [local_map_width, local_map_height] = mrs_lib::get_mutexed(mutex_local_map_dimensions_, local_map_width_, local_map_height_);
+std::shared_ptr<const Sensor2DLidar_t> OctomapServer::initialize2DLidarLUT(const SensorParams2DLidar_t& sensor_params) {
 
-    float x        = sensor_origin.x();
-    float y        = sensor_origin.y();
-    float z        = sensor_origin.z();
-    float width_2  = local_map_width / float(2.0);
-    float height_2 = local_map_height / float(2.0);
+  auto       sensor = std::make_shared<Sensor2DLidar_t>();
+  xyz_lut_t& lut    = sensor->lut;
 
-    octomap::point3d roi_min(x - width_2, y - width_2, z - height_2);
-    octomap::point3d roi_max(x + width_2, y + width_2, z + height_2);
+  sensor->params = sensor_params;
 
-    std::shared_ptr<OcTree_t> from;
+  const int n_rays = sensor_params.horizontal_rays;
 
-    if (octree_local_idx_ == 0) {
-      from              = octree_local_0_;
-      octree_local_     = octree_local_1_;
-      octree_local_idx_ = 1;
-    } else {
-      from              = octree_local_1_;
-      octree_local_     = octree_local_0_;
-      octree_local_idx_ = 0;
-    }
+  lut.directions.resize(3, n_rays);
+  lut.offsets.resize(3, n_rays);
 
-    octree_local_->clear();
+  // the angles as defined by sensor_msgs::LaserScan
+  for (int i = 0; i < n_rays; i++) {
 
-    copyInsideBBX2(from, octree_local_, roi_min, roi_max);
-  }
+    const double angle = sensor_params.angle_min + i * sensor_params.angle_increment;
 
-  /* set free space in the bounding box specified by clear_box topic */ /*//{*/
-  {
-    // TODO mutex?
-    if (sh_clear_box_.hasMsg()) {
-      mrs_octomap_server::PoseWithSize pws = *sh_clear_box_.getMsg();
-      if ((ros::Time::now() - pws.header.stamp).toSec() < 1.0) {
-        // transform the pose to octomap frame
-        geometry_msgs::PoseStamped pose_stamped;
-        pose_stamped.header = pws.header;
-        pose_stamped.pose   = pws.pose;
-        auto res            = transformer_->transformSingle(pose_stamped, _world_frame_);
-        if (res) {
-          auto pose = res.value();
-          // calculate bounding box around the odometry
-          double resolution = octree_local_->getResolution();
-          double min_x      = pose.pose.position.x - pws.width / 2 - resolution;
-          double max_x      = pose.pose.position.x + pws.width / 2 + resolution;
-          double min_y      = pose.pose.position.y - pws.width / 2 - resolution;
-          double max_y      = pose.pose.position.y + pws.width / 2 + resolution;
-          double min_z      = pose.pose.position.z - pws.height / 2 - resolution;
-          double max_z      = pose.pose.position.z + pws.height / 2 + resolution;
-          double step       = resolution / 2;
-          // set the values in the octree
-          for (double x = min_x; x < max_x; x += step) {
-            for (double y = min_y; y < max_y; y += step) {
-              for (double z = min_z; z < max_z; z += step) {
-                octree_local_->setNodeValue(x, y, z, octomap::logodds(0.0));
-              }
-            }
-          }
-        } else {
-          ROS_WARN_THROTTLE(1.0, "[OctomapServer]: Unable to transform the pose to be cleared from frame %s to frame %s.", pws.header.frame_id.c_str(),
-                            _world_frame_.c_str());
-        }
-      } else {
-        ROS_WARN_THROTTLE(1.0, "[OctomapServer]: Latest pose from clear_box is too old - diff from now: %.3f", (ros::Time::now() - pws.header.stamp).toSec());
-      }
-    }
+    lut.directions.col(i) = vec3_t(float(cos(angle)), float(sin(angle)), 0);
+    lut.offsets.col(i)    = vec3_t(0, 0, 0);
   }
-  /*//}*/
-
-  ros::Time time_end = ros::Time::now();
 
-  {
-    std::scoped_lock lock(mutex_local_map_duty_);
-
-    local_map_duty_ += (time_end - time_start).toSec();
-  }
+  return sensor;
 }
 
 //}
 
 /* initializeLidarLUT() //{ */
 
-void OctomapServer::initialize3DLidarLUT(xyz_lut_t& lut, const SensorParams3DLidar_t sensor_params) {
+std::shared_ptr<const Sensor3DLidar_t> OctomapServer::initialize3DLidarLUT(const SensorParams3DLidar_t& sensor_params) {
+
+  auto       sensor = std::make_shared<Sensor3DLidar_t>();
+  xyz_lut_t& lut    = sensor->lut;
+
+  sensor->params = sensor_params;
 
   const int                                       rangeCount         = sensor_params.horizontal_rays;
   const int                                       verticalRangeCount = sensor_params.vertical_rays;
@@ -1869,13 +4192,20 @@ void OctomapServer::initialize3DLidarLUT(xyz_lut_t& lut, const SensorParams3DLid
       it++;
     }
   }
-}  // namespace mrs_octomap_server
+
+  return sensor;
+}
 
 //}
 
 /* initializeDepthCamLUT() //{ */
 
-void OctomapServer::initializeDepthCamLUT(xyz_lut_t& lut, const SensorParamsDepthCam_t sensor_params) {
+std::shared_ptr<const SensorDepthCam_t> OctomapServer::initializeDepthCamLUT(const SensorParamsDepthCam_t& sensor_params) {
+
+  auto       sensor = std::make_shared<SensorDepthCam_t>();
+  xyz_lut_t& lut    = sensor->lut;
+
+  sensor->params = sensor_params;
 
   const int horizontalRangeCount = sensor_params.horizontal_rays;
   const int verticalRangeCount   = sensor_params.vertical_rays;
@@ -1943,6 +4273,29 @@ void OctomapServer::initializeDepthCamLUT(xyz_lut_t& lut, const SensorParamsDept
       it++;
     }
   }
+
+  // the rays of the depth image pixels, pixel (u, v) at the depth d is d * ((u - cx) / fx, (v - cy) / fy, 1) in the optical frame
+  if (sensor_params.image_width > 0 && sensor_params.image_height > 0 && sensor_params.fx > 0 && sensor_params.fy > 0) {
+
+    const int stride = sensor_params.image_stride;
+    const int n_cols = (sensor_params.image_width + stride - 1) / stride;
+    const int n_rows = (sensor_params.image_height + stride - 1) / stride;
+
+    sensor->image_rays.resize(3, n_cols * n_rows);
+
+    for (int row = 0; row < n_rows; row++) {
+      for (int col = 0; col < n_cols; col++) {
+
+        const double u = col * stride;
+        const double v = row * stride;
+
+        sensor->image_rays.col(row * n_cols + col) =
+            vec3_t(float((u - sensor_params.cx) / sensor_params.fx), float((v - sensor_params.cy) / sensor_params.fy), 1.0f);
+      }
+    }
+  }
+
+  return sensor;
 }
 
 //}
@@ -1973,7 +4326,24 @@ bool OctomapServer::loadFromFile(const std::string& filename) {
       }
 
       OcTree_t* octree = dynamic_cast<OcTree_t*>(tree);
-      octree_global_   = std::shared_ptr<OcTree_t>(octree);
+
+      // a tree of another class with the same serialization (octomap::OcTree for the QuantizedOcTree) is converted through its data
+      if (!octree && tree->getTreeType() == octree_global_->getTreeType()) {
+
+        std::stringstream data;
+        tree->writeData(data);
+
+        octree = new OcTree_t(tree->getResolution());
+        octree->setProbHit(_probHit_);
+        octree->setProbMiss(_probMiss_);
+        octree->setClampingThresMin(_thresMin_);
+        octree->setClampingThresMax(_thresMax_);
+        octree->readData(data);
+
+        delete tree;
+      }
+
+      octree_global_ = std::shared_ptr<OcTree_t>(octree);
 
       if (!octree_global_) {
         ROS_ERROR("[OctomapServer]: could not read OcTree file");
@@ -1985,8 +4355,14 @@ bool OctomapServer::loadFromFile(const std::string& filename) {
     }
 
     octree_resolution_ = octree_global_->getResolution();
+    octree_global_version_++;
   }
 
+  global_map_keyframe_needed_ = true;
+
+  // the local map is not in the new global map yet
+  global_map_full_merge_ = true;
+
   return true;
 }
 
@@ -1996,7 +4372,10 @@ bool OctomapServer::loadFromFile(const std::string& filename) {
 
 bool OctomapServer::saveToFile(const std::string& filename) {
 
-  std::scoped_lock lock(mutex_octree_global_);
+  // written without blocking the map
+  std::shared_ptr<const OcTree_t> octree = getGlobalMapSnapshot();
+
+  std::scoped_lock lock(mutex_map_file_);
 
   std::string file_path        = _map_path_ + "/" + filename + ".ot";
   std::string tmp_file_path    = _map_path_ + "/tmp_" + filename + ".ot";
@@ -2011,7 +4390,7 @@ bool OctomapServer::saveToFile(const std::string& filename) {
 
   std::string suffix = file_path.substr(file_path.length() - 3, 3);
 
-  if (!octree_global_->write(tmp_file_path)) {
+  if (!octree->write(tmp_file_path)) {
     ROS_ERROR("[OctomapServer]: error writing to file '%s'", file_path.c_str());
     return false;
   }
@@ -2028,99 +4407,219 @@ bool OctomapServer::saveToFile(const std::string& filename) {
 
 //}
 
-/* copyInsideBBX2() //{ */
+/* collectNodes() //{ */
 
-bool OctomapServer::copyInsideBBX2(std::shared_ptr<OcTree_t>& from, std::shared_ptr<OcTree_t>& to, const octomap::point3d& p_min,
-                                   const octomap::point3d& p_max) {
+/**
+ * @brief collects the values of the nodes of the tree at the given codes, as the absolute log-odds in the deltas
+ *
+ * A leaf code gets the value of the leaf (or of the pruned node containing it). A node code (mortonEncodeNode())
+ * gets the leaves of the subtree of the node, the codes inside of it are covered by it. The codes not present in the
+ * tree are skipped. The output is sorted by keyUpdateLess().
+ */
+void OctomapServer::collectNodes(std::shared_ptr<OcTree_t>& octree, const KeyBuffer& codes, std::vector<KeyUpdate_t>& nodes) {
 
-  octomap::OcTreeKey minKey, maxKey;
+  nodes.clear();
 
-  if (!from->coordToKeyChecked(p_min, minKey) || !from->coordToKeyChecked(p_max, maxKey)) {
-    return false;
-  }
+  // each node is sorted in front of its leaves (mortonNodeLess()), the leaves it covers are skipped then
+  merge_codes_.assign(codes.begin(), codes.end());
+  std::sort(merge_codes_.begin(), merge_codes_.end(), mortonNodeLess);
+
+  morton_t covered_end = 0;
+
+  for (const morton_t code : merge_codes_) {
 
-  octomap::OcTreeNode* root = to->getRoot();
+    const morton_t     first_leaf = mortonFirstLeaf(code);
+    const unsigned int level      = mortonLevel(code);
 
-  bool got_root = root ? true : false;
+    // inside of a node collected before
+    if (first_leaf < covered_end) {
+      continue;
+    }
+
+    // the node at the depth, or the pruned node containing it
+    OcTreeNode_t* node = octree->search(mortonDecode(first_leaf), octree->getTreeDepth() - level);
+
+    if (!node) {
+      continue;
+    }
+
+    if (level == 0 || !octree->nodeHasChildren(node)) {
+      nodes.push_back({code, node->getLogOdds()});
+    } else {
+      collectNodesRecurs(octree, node, first_leaf, level, nodes);
+    }
 
-  if (!got_root) {
-    octomap::OcTreeKey key = to->coordToKey(0, 0, 0, to->getTreeDepth());
-    to->setNodeValue(key, octomap::logodds(0.0));
+    covered_end = first_leaf + (morton_t(1) << (3 * level));
   }
+}
 
-  for (OcTree_t::leaf_bbx_iterator it = from->begin_leafs_bbx(p_min, p_max), end = from->end_leafs_bbx(); it != end; ++it) {
+//}
 
-    octomap::OcTreeKey   k    = it.getKey();
-    octomap::OcTreeNode* node = touchNode(to, k, it.getDepth());
-    node->setValue(it->getValue());
+/* collectDirtyCells() //{ */
+
+/**
+ * @brief collects the current values of the changed cells of the local map for the merge into the global map
+ *
+ * The rolling grid holds the latest values, also of the cells outside of the exported box, so the cells are read from
+ * it as leaves. The octree is read by collectNodes(). The output is sorted by keyUpdateLess().
+ */
+void OctomapServer::collectDirtyCells(const KeyBuffer& codes, std::vector<KeyUpdate_t>& cells) {
+
+  if (!_local_map_rolling_grid_enabled_) {
+    collectNodes(octree_local_, codes, cells);
+    return;
   }
 
-  return true;
+  cells.clear();
+
+  merge_codes_.assign(codes.begin(), codes.end());
+  std::sort(merge_codes_.begin(), merge_codes_.end(), mortonNodeLess);
+
+  morton_t covered_end = 0;
+
+  for (const morton_t code : merge_codes_) {
+
+    const morton_t     first_leaf = mortonFirstLeaf(code);
+    const unsigned int level      = mortonLevel(code);
+
+    if (first_leaf < covered_end) {
+      continue;
+    }
+
+    const octomap::OcTreeKey min_key = mortonDecode(first_leaf);
+    octomap::OcTreeKey       max_key;
+
+    for (int j = 0; j < 3; j++) {
+      max_key[j] = octomap::key_type(min_key[j] + (1 << level) - 1);
+    }
+
+    // the cubes do not overlap and they follow each other, the leaves stay sorted
+    rolling_grid_.exportCells(min_key, max_key, merge_grid_cells_);
+    cells.insert(cells.end(), merge_grid_cells_.begin(), merge_grid_cells_.end());
+
+    covered_end = first_leaf + (morton_t(1) << (3 * level));
+  }
 }
 
 //}
 
-/* copyLocalMap() //{ */
+/* flushDirtyCells() //{ */
+
+/**
+ * @brief keeps the values of the dirty cells leaving the box for the next merge, called before the local map is cropped
+ *
+ * The codes reaching out of the box are collected and removed from the dirty cells, a later change of their cells
+ * inside of the box marks them dirty again. mutex_octree_local_ has to be locked.
+ */
+void OctomapServer::flushDirtyCells(const octomap::OcTreeKey& min_key, const octomap::OcTreeKey& max_key) {
+
+  if (dirty_cells_.empty()) {
+    return;
+  }
+
+  flush_codes_.clear();
+  kept_cells_.clear();
 
-bool OctomapServer::copyLocalMap(std::shared_ptr<OcTree_t>& from, std::shared_ptr<OcTree_t>& to) {
+  for (const morton_t code : dirty_cells_) {
 
-  octomap::OcTreeKey minKey, maxKey;
+    const octomap::OcTreeKey first = mortonDecode(mortonFirstLeaf(code));
+    const int32_t            last  = (int32_t(1) << mortonLevel(code)) - 1;
 
-  octomap::OcTreeNode* root = to->getRoot();
+    bool inside = true;
+
+    for (int j = 0; j < 3; j++) {
+      if (first[j] < min_key[j] || int32_t(first[j]) + last > int32_t(max_key[j])) {
+        inside = false;
+      }
+    }
 
-  bool got_root = root ? true : false;
+    // the order is kept, both stay sorted
+    if (inside) {
+      kept_cells_.push_back(code);
+    } else {
+      flush_codes_.push_back(code);
+    }
+  }
 
-  if (!got_root) {
-    octomap::OcTreeKey key = to->coordToKey(0, 0, 0, to->getTreeDepth());
-    to->setNodeValue(key, octomap::logodds(0.0));
+  if (flush_codes_.empty()) {
+    return;
   }
 
-  for (OcTree_t::leaf_iterator it = from->begin_leafs(), end = from->end_leafs(); it != end; ++it) {
+  collectDirtyCells(flush_codes_, flush_batch_);
 
-    octomap::OcTreeKey   k    = it.getKey();
-    octomap::OcTreeNode* node = touchNode(to, k, it.getDepth());
-    node->setValue(it->getValue());
+  if (!flush_batch_.empty()) {
+    flushed_cells_.insert(flushed_cells_.end(), flush_batch_.begin(), flush_batch_.end());
+    flushed_ends_.push_back(flushed_cells_.size());
   }
 
-  return true;
+  std::swap(dirty_cells_, kept_cells_);
 }
 
 //}
 
-/* touchNode() //{ */
+/* setFlushedCells() //{ */
+
+/**
+ * @brief sets the flushed batches of cells in the global map in their order, each of them is a version of the map
+ *
+ * mutex_octree_global_ has to be locked.
+ */
+void OctomapServer::setFlushedCells(const std::vector<KeyUpdate_t>& cells, const std::vector<size_t>& ends, const bool deltas) {
+
+  size_t begin = 0;
+
+  for (const size_t end : ends) {
+
+    // the batches may overlap, they are set one by one
+    merge_batch_.assign(cells.begin() + begin, cells.begin() + end);
+    begin = end;
+
+    setNodesBatch(*octree_global_, merge_batch_);
 
-octomap::OcTreeNode* OctomapServer::touchNode(std::shared_ptr<OcTree_t>& octree, const octomap::OcTreeKey& key, unsigned int target_depth = 0) {
+    if (deltas) {
+      queueGlobalMapDelta(merge_batch_);
+    }
 
-  return touchNodeRecurs(octree, octree->getRoot(), key, 0, target_depth);
+    octree_global_version_++;
+  }
 }
 
 //}
 
-/* touchNodeRecurs() //{ */
+/* queueGlobalMapDelta() //{ */
 
-octomap::OcTreeNode* OctomapServer::touchNodeRecurs(std::shared_ptr<OcTree_t>& octree, octomap::OcTreeNode* node, const octomap::OcTreeKey& key,
-                                                    unsigned int depth, unsigned int max_depth = 0) {
+/**
+ * @brief queues the nodes set in the global map as the delta to the next version, mutex_octree_global_ has to be locked
+ */
+void OctomapServer::queueGlobalMapDelta(const std::vector<KeyUpdate_t>& nodes) {
 
-  assert(node);
+  mrs_octomap_server::OctomapDelta delta;
+  delta.header.frame_id = _world_frame_;
+  delta.header.stamp    = ros::Time::now();
+  delta.base_version    = octree_global_version_;
+  delta.version         = octree_global_version_ + 1;
 
-  // follow down to last level
-  if (depth < octree->getTreeDepth() && (max_depth == 0 || depth < max_depth)) {
+  fillDeltaNodes(nodes, delta);
+
+  global_map_deltas_.push_back(std::move(delta));
+}
 
-    unsigned int pos = octomap::computeChildIdx(key, int(octree->getTreeDepth() - depth - 1));
+//}
 
-    /* ROS_INFO("pos: %d", pos); */
-    if (!octree->nodeChildExists(node, pos)) {
+/* collectNodesRecurs() //{ */
 
-      // not a pruned node, create requested child
-      octree->createNodeChild(node, pos);
-    }
+void OctomapServer::collectNodesRecurs(std::shared_ptr<OcTree_t>& octree, OcTreeNode_t* node, const morton_t first_leaf, const unsigned int level,
+                                       std::vector<KeyUpdate_t>& nodes) {
 
-    return touchNodeRecurs(octree, octree->getNodeChild(node, pos), key, depth + 1, max_depth);
+  if (!octree->nodeHasChildren(node)) {
+    nodes.push_back({level == 0 ? first_leaf : mortonEncodeNode(first_leaf, level), node->getLogOdds()});
+    return;
   }
 
-  // at last level, update node, end of recursion
-  else {
-    return node;
+  for (unsigned int i = 0; i < 8; i++) {
+    if (octree->nodeChildExists(node, i)) {
+      collectNodesRecurs(octree, octree->getNodeChild(node, i), first_leaf + (morton_t(i) << (3 * (level - 1))), level - 1, nodes);
+    }
   }
 }
 
@@ -2128,7 +4627,7 @@ octomap::OcTreeNode* OctomapServer::touchNodeRecurs(std::shared_ptr<OcTree_t>& o
 
 /* expandNodeRecursive() //{ */
 
-void OctomapServer::expandNodeRecursive(std::shared_ptr<OcTree_t>& octree, octomap::OcTreeNode* node, const unsigned int node_depth) {
+void OctomapServer::expandNodeRecursive(std::shared_ptr<OcTree_t>& octree, OcTreeNode_t* node, const unsigned int node_depth) {
 
   if (node_depth < octree->getTreeDepth()) {
 
@@ -2157,7 +4656,7 @@ std::optional<double> OctomapServer::getGroundZ(std::shared_ptr<OcTree_t>& octre
   for (OcTree_t::leaf_bbx_iterator it = octree->begin_leafs_bbx(p_min, p_max), end = octree->end_leafs_bbx(); it != end; ++it) {
 
     octomap::OcTreeKey   k    = it.getKey();
-    octomap::OcTreeNode* node = octree->search(k);
+    OcTreeNode_t* node = octree->search(k);
 
     expandNodeRecursive(octree, node, it.getDepth());
   }
@@ -0,0 +1,139 @@
+#include <mrs_octomap_server/quantized_octree.h>
+
+#include <limits>
+
+namespace mrs_octomap_server
+{
+
+/* QuantizedOcTreeNode::getMaxChildQuantizedLogOdds() //{ */
+
+int16_t QuantizedOcTreeNode::getMaxChildQuantizedLogOdds() const {
+
+  int16_t max = std::numeric_limits<int16_t>::min();
+
+  if (children != NULL) {
+    for (unsigned int i = 0; i < 8; i++) {
+      if (children[i] != NULL) {
+        max = std::max(max, static_cast<const QuantizedOcTreeNode*>(children[i])->getQuantizedLogOdds());
+      }
+    }
+  }
+
+  return max;
+}
+
+//}
+
+/* QuantizedOcTreeNode::readData() //{ */
+
+std::istream& QuantizedOcTreeNode::readData(std::istream& s) {
+
+  float log_odds;
+  s.read((char*)&log_odds, sizeof(log_odds));
+
+  setLogOdds(log_odds);
+
+  return s;
+}
+
+//}
+
+/* QuantizedOcTree() //{ */
+
+QuantizedOcTree::QuantizedOcTree(const double resolution) : octomap::OccupancyOcTreeBase<QuantizedOcTreeNode>(resolution) {
+
+  updateQuantizedModel();
+}
+
+//}
+
+/* setters of the sensor model //{ */
+
+void QuantizedOcTree::setProbHit(const double prob) {
+
+  octomap::OccupancyOcTreeBase<QuantizedOcTreeNode>::setProbHit(prob);
+  updateQuantizedModel();
+}
+
+void QuantizedOcTree::setProbMiss(const double prob) {
+
+  octomap::OccupancyOcTreeBase<QuantizedOcTreeNode>::setProbMiss(prob);
+  updateQuantizedModel();
+}
+
+void QuantizedOcTree::setClampingThresMin(const double thres) {
+
+  octomap::OccupancyOcTreeBase<QuantizedOcTreeNode>::setClampingThresMin(thres);
+  updateQuantizedModel();
+}
+
+void QuantizedOcTree::setClampingThresMax(const double thres) {
+
+  octomap::OccupancyOcTreeBase<QuantizedOcTreeNode>::setClampingThresMax(thres);
+  updateQuantizedModel();
+}
+
+//}
+
+/* updateQuantizedModel() //{ */
+
+void QuantizedOcTree::updateQuantizedModel() {
+
+  // the model is snapped with the same rounding as the values of the nodes, a clamped node equals the threshold
+  quantized_min_ = QuantizedOcTreeNode::quantize(clamping_thres_min);
+  quantized_max_ = QuantizedOcTreeNode::quantize(clamping_thres_max);
+
+  clamping_thres_min = QuantizedOcTreeNode::dequantize(quantized_min_);
+  clamping_thres_max = QuantizedOcTreeNode::dequantize(quantized_max_);
+
+  const int16_t hit  = QuantizedOcTreeNode::quantize(prob_hit_log);
+  const int16_t miss = QuantizedOcTreeNode::quantize(prob_miss_log);
+
+  prob_hit_log  = QuantizedOcTreeNode::dequantize(hit);
+  prob_miss_log = QuantizedOcTreeNode::dequantize(miss);
+
+  const int n_values = std::max(0, int(quantized_max_) - int(quantized_min_) + 1);
+
+  hit_table_.resize(n_values);
+  miss_table_.resize(n_values);
+
+  for (int i = 0; i < n_values; i++) {
+
+    const int value = int(quantized_min_) + i;
+
+    hit_table_[i]  = QuantizedOcTreeNode::dequantize(int16_t(std::max(int(quantized_min_), std::min(int(quantized_max_), value + hit))));
+    miss_table_[i] = QuantizedOcTreeNode::dequantize(int16_t(std::max(int(quantized_min_), std::min(int(quantized_max_), value + miss))));
+  }
+}
+
+//}
+
+/* updateNodeLogOdds() //{ */
+
+void QuantizedOcTree::updateNodeLogOdds(QuantizedOcTreeNode* node, const float& update) const {
+
+  const int value = node->getQuantizedLogOdds();
+  const int idx   = value - int(quantized_min_);
+
+  // the nodes outside of the clamping range (e.g., set directly) take the arithmetic path
+  if (idx >= 0 && idx < int(hit_table_.size())) {
+
+    if (update == prob_hit_log) {
+      node->setValue(hit_table_[idx]);
+      return;
+    }
+
+    if (update == prob_miss_log) {
+      node->setValue(miss_table_[idx]);
+      return;
+    }
+  }
+
+  const int updated = value + int(QuantizedOcTreeNode::quantize(update));
+
+  node->setQuantizedLogOdds(int16_t(std::max(int(quantized_min_), std::min(int(quantized_max_), updated))));
+}
+
+//}
+
+}  // namespace mrs_octomap_server
@@ -0,0 +1,668 @@
+#include <mrs_octomap_server/ray_tracer.h>
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace mrs_octomap_server
+{
+
+// the keys of the octree of depth 16
+static const int32_t TREE_MAX_VAL = 32768;
+
+/* RayTracer() //{ */
+
+RayTracer::RayTracer() : RayTracer(0.1) {
+}
+
+RayTracer::RayTracer(const double resolution) {
+
+  resolution_ = resolution;
+  simd_level_ = detectSimdLevel();
+
+  setLevel(0);
+}
+
+//}
+
+/* setResolution() //{ */
+
+void RayTracer::setResolution(const double resolution) {
+
+  resolution_ = resolution;
+  node_size_  = resolution_ * double(1 << level_);
+}
+
+//}
+
+/* setLevel() //{ */
+
+void RayTracer::setLevel(const unsigned int level) {
+
+  level_      = level;
+  node_size_  = resolution_ * double(1 << level_);
+  key_offset_ = TREE_MAX_VAL >> level_;
+}
+
+//}
+
+/* setSimdLevel() //{ */
+
+void RayTracer::setSimdLevel(const SimdLevel_t simd_level) {
+
+  // do not allow to pick instructions that the cpu does not support
+  simd_level_ = std::min(simd_level, detectSimdLevel());
+}
+
+//}
+
+/* detectSimdLevel() //{ */
+
+RayTracer::SimdLevel_t RayTracer::detectSimdLevel() {
+
+#if defined(__x86_64__)
+
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2")) {
+    return SIMD_AVX2;
+  }
+
+  // SSE2 is a part of the x86-64 baseline
+  return SIMD_SSE2;
+
+#else
+
+  return SIMD_NONE;
+
+#endif
+}
+
+//}
+
+/* simdLevelName() //{ */
+
+const char* RayTracer::simdLevelName(const SimdLevel_t simd_level) {
+
+  switch (simd_level) {
+    case SIMD_AVX2:
+      return "AVX2";
+    case SIMD_SSE2:
+      return "SSE2";
+    default:
+      return "scalar";
+  }
+}
+
+//}
+
+/* coordToKeyChecked() //{ */
+
+bool RayTracer::coordToKeyChecked(const float coord, int32_t& key) const {
+
+  const int scaled_coord = int(floor((1.0 / node_size_) * coord)) + key_offset_;
+
+  if (scaled_coord >= 0 && scaled_coord < 2 * key_offset_) {
+    key = scaled_coord;
+    return true;
+  }
+
+  return false;
+}
+
+bool RayTracer::coordToKeyChecked(const octomap::point3d& coord, octomap::OcTreeKey& key) const {
+
+  int32_t k[3];
+
+  if (!coordToKeyChecked(coord.x(), k[0]) || !coordToKeyChecked(coord.y(), k[1]) || !coordToKeyChecked(coord.z(), k[2])) {
+    return false;
+  }
+
+  key = octomap::OcTreeKey(octomap::key_type(k[0]), octomap::key_type(k[1]), octomap::key_type(k[2]));
+
+  return true;
+}
+
+//}
+
+/* keyToCoord() //{ */
+
+double RayTracer::keyToCoord(const int32_t key) const {
+
+  return (double(key - key_offset_) + 0.5) * node_size_;
+}
+
+octomap::point3d RayTracer::keyToCoord(const octomap::OcTreeKey& key) const {
+
+  return octomap::point3d(float(keyToCoord(int32_t(key[0]))), float(keyToCoord(int32_t(key[1]))), float(keyToCoord(int32_t(key[2]))));
+}
+
+//}
+
+/* traceRays() //{ */
+
+void RayTracer::traceRays(const octomap::point3d& origin, const octomap::point3d* ends, const size_t n_rays, RayBatch& batch) const {
+
+  traceRays(&origin, 0, ends, n_rays, batch);
+}
+
+void RayTracer::traceRays(const octomap::point3d* origins, const octomap::point3d* ends, const size_t n_rays, RayBatch& batch) const {
+
+  traceRays(origins, 1, ends, n_rays, batch);
+}
+
+void RayTracer::traceRays(const octomap::point3d* origins, const size_t origin_step, const octomap::point3d* ends, const size_t n_rays,
+                          RayBatch& batch) const {
+
+  batch.inits.resize(n_rays);
+  batch.begins.resize(n_rays);
+  batch.counts.resize(n_rays);
+
+  // | ------------------- initialization phase ------------------- |
+
+  uint32_t n_keys = 0;
+
+  for (size_t i = 0; i < n_rays; i++) {
+
+    RayBatch::RayInit_t& init = batch.inits[i];
+
+    init.capacity = 0;
+
+    const octomap::point3d& origin = origins[i * origin_step];
+
+    int32_t key_origin[3] = {0, 0, 0};
+
+    const bool origin_valid = coordToKeyChecked(origin.x(), key_origin[0]) && coordToKeyChecked(origin.y(), key_origin[1]) &&
+                              coordToKeyChecked(origin.z(), key_origin[2]);
+
+    int32_t key_end[3];
+
+    if (!origin_valid || !coordToKeyChecked(ends[i].x(), key_end[0]) || !coordToKeyChecked(ends[i].y(), key_end[1]) ||
+        !coordToKeyChecked(ends[i].z(), key_end[2])) {
+      batch.begins[i] = n_keys;
+      continue;
+    }
+
+    // same tree cell, the ray is empty
+    if (key_origin[0] == key_end[0] && key_origin[1] == key_end[1] && key_origin[2] == key_end[2]) {
+      batch.begins[i] = n_keys;
+      continue;
+    }
+
+    // the direction and the length are single precision as in computeRayKeys(), the rest of the traversal is double
+    float direction[3] = {ends[i].x() - origin.x(), ends[i].y() - origin.y(), ends[i].z() - origin.z()};
+
+    const float length = float(std::sqrt(double(direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2])));
+
+    int32_t manhattan = 0;
+
+    for (int j = 0; j < 3; j++) {
+
+      direction[j] /= length;
+
+      init.key[j] = key_origin[j];
+      init.end[j] = key_end[j];
+
+      if (direction[j] > 0.0f) {
+        init.step[j] = 1;
+      } else if (direction[j] < 0.0f) {
+        init.step[j] = -1;
+      } else {
+        init.step[j] = 0;
+      }
+
+      if (init.step[j] != 0) {
+
+        // corner point of voxel (in direction of ray)
+        const double voxel_border = keyToCoord(key_origin[j]) + double(float(init.step[j] * node_size_ * 0.5));
+
+        init.t_max[j]   = (voxel_border - double(origin(j))) / double(direction[j]);
+        init.t_delta[j] = node_size_ / double(std::fabs(direction[j]));
+
+      } else {
+
+        init.t_max[j]   = std::numeric_limits<double>::max();
+        init.t_delta[j] = std::numeric_limits<double>::max();
+      }
+
+      manhattan += std::abs(key_end[j] - key_origin[j]);
+    }
+
+    init.length = length;
+
+    // the ray visits at most one voxel per step, a small margin covers the rounding
+    init.capacity = uint32_t(manhattan) + 2;
+
+    batch.begins[i] = n_keys;
+    n_keys += init.capacity;
+  }
+
+  batch.keys.resize(n_keys);
+
+  // the origin voxel is the first key of each non-empty ray
+  for (size_t i = 0; i < n_rays; i++) {
+
+    const RayBatch::RayInit_t& init = batch.inits[i];
+
+    if (init.capacity > 0) {
+      batch.keys[batch.begins[i]] = mortonEncode(init.key[0], init.key[1], init.key[2]);
+      batch.counts[i]             = 1;
+    } else {
+      batch.counts[i] = 0;
+    }
+  }
+
+  // | -------------------- incremental phase ------------------- |
+
+  switch (simd_level_) {
+
+    case SIMD_AVX2: {
+      traceAvx2(batch);
+      break;
+    }
+
+    case SIMD_SSE2: {
+      traceSse2(batch);
+      break;
+    }
+
+    default: {
+      traceScalar(batch);
+      break;
+    }
+  }
+
+  // the keys of the nodes to the codes of their first leaves
+  if (level_ > 0) {
+
+    for (size_t i = 0; i < n_rays; i++) {
+
+      morton_t* keys = batch.keys.data() + batch.begins[i];
+
+      for (uint32_t k = 0; k < batch.counts[i]; k++) {
+        keys[k] = mortonEncodeNode(keys[k] << (3 * level_), level_);
+      }
+    }
+  }
+}
+
+//}
+
+/* traceScalar() //{ */
+
+void RayTracer::traceScalar(RayBatch& batch) const {
+
+  for (size_t i = 0; i < batch.size(); i++) {
+
+    const RayBatch::RayInit_t& init = batch.inits[i];
+
+    morton_t* keys  = batch.keys.data() + batch.begins[i];
+    uint32_t  count = batch.counts[i];
+
+    int32_t key[3]   = {init.key[0], init.key[1], init.key[2]};
+    double  t_max[3] = {init.t_max[0], init.t_max[1], init.t_max[2]};
+
+    while (count < init.capacity) {
+
+      // find minimum t_max
+      int dim;
+      if (t_max[0] < t_max[1]) {
+        dim = t_max[0] < t_max[2] ? 0 : 2;
+      } else {
+        dim = t_max[1] < t_max[2] ? 1 : 2;
+      }
+
+      // advance in direction "dim"
+      key[dim] += init.step[dim];
+      t_max[dim] += init.t_delta[dim];
+
+      // reached the end point voxel
+      if (key[0] == init.end[0] && key[1] == init.end[1] && key[2] == init.end[2]) {
+        break;
+      }
+
+      // leaving the valid range of the ray
+      if (std::min(std::min(t_max[0], t_max[1]), t_max[2]) > init.length) {
+        break;
+      }
+
+      keys[count++] = mortonEncode(key[0], key[1], key[2]);
+    }
+
+    batch.counts[i] = count;
+  }
+}
+
+//}
+
+#if defined(__x86_64__)
+
+/* spreadBitsSse2() //{ */
+
+/**
+ * @brief spreadBits() of two 64-bit lanes
+ */
+static inline __m128i spreadBitsSse2(__m128i x) {
+
+  x = _mm_and_si128(_mm_or_si128(x, _mm_slli_epi64(x, 16)), _mm_set1_epi64x(0x0000ff0000ff));
+  x = _mm_and_si128(_mm_or_si128(x, _mm_slli_epi64(x, 8)), _mm_set1_epi64x(0x00f00f00f00f));
+  x = _mm_and_si128(_mm_or_si128(x, _mm_slli_epi64(x, 4)), _mm_set1_epi64x(0x0c30c30c30c3));
+  x = _mm_and_si128(_mm_or_si128(x, _mm_slli_epi64(x, 2)), _mm_set1_epi64x(0x249249249249));
+
+  return x;
+}
+
+//}
+
+/* mortonEncodeSse2() //{ */
+
+/**
+ * @brief mortonEncode() of four 32-bit lanes, the codes are stored to the output array
+ */
+static inline void mortonEncodeSse2(const __m128i x, const __m128i y, const __m128i z, morton_t* codes) {
+
+  const __m128i zero = _mm_setzero_si128();
+
+  const __m128i lo = _mm_or_si128(spreadBitsSse2(_mm_unpacklo_epi32(x, zero)),
+                                  _mm_or_si128(_mm_slli_epi64(spreadBitsSse2(_mm_unpacklo_epi32(y, zero)), 1),
+                                               _mm_slli_epi64(spreadBitsSse2(_mm_unpacklo_epi32(z, zero)), 2)));
+
+  const __m128i hi = _mm_or_si128(spreadBitsSse2(_mm_unpackhi_epi32(x, zero)),
+                                  _mm_or_si128(_mm_slli_epi64(spreadBitsSse2(_mm_unpackhi_epi32(y, zero)), 1),
+                                               _mm_slli_epi64(spreadBitsSse2(_mm_unpackhi_epi32(z, zero)), 2)));
+
+  _mm_storeu_si128((__m128i*)codes, lo);
+  _mm_storeu_si128((__m128i*)(codes + 2), hi);
+}
+
+//}
+
+/* packMasksSse2() //{ */
+
+/**
+ * @brief the masks of the four lanes held in two double vectors (lanes 0-1 and 2-3) as 32-bit masks
+ */
+static inline __m128i packMasksSse2(const __m128d lo, const __m128d hi) {
+
+  return _mm_castps_si128(_mm_shuffle_ps(_mm_castpd_ps(lo), _mm_castpd_ps(hi), _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+//}
+
+/* spreadBitsAvx2() //{ */
+
+/**
+ * @brief spreadBits() of four 64-bit lanes
+ */
+__attribute__((target("avx2"))) static inline __m256i spreadBitsAvx2(__m256i x) {
+
+  x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 16)), _mm256_set1_epi64x(0x0000ff0000ff));
+  x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 8)), _mm256_set1_epi64x(0x00f00f00f00f));
+  x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 4)), _mm256_set1_epi64x(0x0c30c30c30c3));
+  x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 2)), _mm256_set1_epi64x(0x249249249249));
+
+  return x;
+}
+
+//}
+
+/* mortonEncodeAvx2() //{ */
+
+/**
+ * @brief mortonEncode() of four 32-bit lanes, the codes are stored to the output array
+ */
+__attribute__((target("avx2"))) static inline void mortonEncodeAvx2(const __m128i x, const __m128i y, const __m128i z, morton_t* codes) {
+
+  const __m256i code = _mm256_or_si256(spreadBitsAvx2(_mm256_cvtepu32_epi64(x)),
+                                       _mm256_or_si256(_mm256_slli_epi64(spreadBitsAvx2(_mm256_cvtepu32_epi64(y)), 1),
+                                                       _mm256_slli_epi64(spreadBitsAvx2(_mm256_cvtepu32_epi64(z)), 2)));
+
+  _mm256_storeu_si256((__m256i*)codes, code);
+}
+
+//}
+
+/* packMasksAvx2() //{ */
+
+/**
+ * @brief the 64-bit masks of four double lanes as 32-bit masks
+ */
+__attribute__((target("avx2"))) static inline __m128i packMasksAvx2(const __m256d mask) {
+
+  return _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(_mm256_castpd_si256(mask), _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6)));
+}
+
+//}
+
+/* traceSse2() //{ */
+
+void RayTracer::traceSse2(RayBatch& batch) const {
+
+  const size_t n_rays = batch.size();
+
+  for (size_t first = 0; first < n_rays; first += 4) {
+
+    const int n_lanes = int(std::min(size_t(4), n_rays - first));
+
+    // the unused lanes stay inactive, their capacity is 0
+    alignas(16) int32_t kx[4] = {}, ky[4] = {}, kz[4] = {}, ex[4] = {}, ey[4] = {}, ez[4] = {}, sx[4] = {}, sy[4] = {}, sz[4] = {}, count[4] = {},
+                        capacity[4] = {};
+    alignas(16) double tx[4] = {}, ty[4] = {}, tz[4] = {}, dx[4] = {}, dy[4] = {}, dz[4] = {}, length[4] = {};
+
+    for (int l = 0; l < n_lanes; l++) {
+
+      const RayBatch::RayInit_t& init = batch.inits[first + l];
+
+      kx[l]       = init.key[0];
+      ky[l]       = init.key[1];
+      kz[l]       = init.key[2];
+      ex[l]       = init.end[0];
+      ey[l]       = init.end[1];
+      ez[l]       = init.end[2];
+      sx[l]       = init.step[0];
+      sy[l]       = init.step[1];
+      sz[l]       = init.step[2];
+      tx[l]       = init.t_max[0];
+      ty[l]       = init.t_max[1];
+      tz[l]       = init.t_max[2];
+      dx[l]       = init.t_delta[0];
+      dy[l]       = init.t_delta[1];
+      dz[l]       = init.t_delta[2];
+      length[l]   = init.length;
+      count[l]    = int32_t(batch.counts[first + l]);
+      capacity[l] = int32_t(init.capacity);
+    }
+
+    // the keys are in 32-bit lanes, the parameters of the ray in two double vectors, lanes 0-1 and 2-3
+    __m128i v_kx = _mm_load_si128((const __m128i*)kx), v_ky = _mm_load_si128((const __m128i*)ky), v_kz = _mm_load_si128((const __m128i*)kz);
+    __m128d v_tx[2] = {_mm_load_pd(tx), _mm_load_pd(tx + 2)}, v_ty[2] = {_mm_load_pd(ty), _mm_load_pd(ty + 2)},
+            v_tz[2] = {_mm_load_pd(tz), _mm_load_pd(tz + 2)};
+
+    const __m128i v_ex = _mm_load_si128((const __m128i*)ex), v_ey = _mm_load_si128((const __m128i*)ey), v_ez = _mm_load_si128((const __m128i*)ez);
+    const __m128i v_sx = _mm_load_si128((const __m128i*)sx), v_sy = _mm_load_si128((const __m128i*)sy), v_sz = _mm_load_si128((const __m128i*)sz);
+    const __m128d v_dx[2] = {_mm_load_pd(dx), _mm_load_pd(dx + 2)}, v_dy[2] = {_mm_load_pd(dy), _mm_load_pd(dy + 2)},
+                  v_dz[2]     = {_mm_load_pd(dz), _mm_load_pd(dz + 2)};
+    const __m128d v_length[2] = {_mm_load_pd(length), _mm_load_pd(length + 2)};
+    const __m128i v_capacity  = _mm_load_si128((const __m128i*)capacity);
+
+    __m128i v_count  = _mm_load_si128((const __m128i*)count);
+    __m128i v_active = _mm_cmpgt_epi32(v_capacity, v_count);
+
+    while (_mm_movemask_ps(_mm_castsi128_ps(v_active)) != 0) {
+
+      // find minimum t_max, the ties are resolved as in the scalar version
+      const __m128i lt_xy = packMasksSse2(_mm_cmplt_pd(v_tx[0], v_ty[0]), _mm_cmplt_pd(v_tx[1], v_ty[1]));
+      const __m128i lt_xz = packMasksSse2(_mm_cmplt_pd(v_tx[0], v_tz[0]), _mm_cmplt_pd(v_tx[1], v_tz[1]));
+      const __m128i lt_yz = packMasksSse2(_mm_cmplt_pd(v_ty[0], v_tz[0]), _mm_cmplt_pd(v_ty[1], v_tz[1]));
+      const __m128i sel_x = _mm_and_si128(v_active, _mm_and_si128(lt_xy, lt_xz));
+      const __m128i sel_y = _mm_and_si128(v_active, _mm_andnot_si128(lt_xy, lt_yz));
+      const __m128i sel_z = _mm_andnot_si128(_mm_or_si128(sel_x, sel_y), v_active);
+
+      // advance in the selected direction
+      v_kx = _mm_add_epi32(v_kx, _mm_and_si128(v_sx, sel_x));
+      v_ky = _mm_add_epi32(v_ky, _mm_and_si128(v_sy, sel_y));
+      v_kz = _mm_add_epi32(v_kz, _mm_and_si128(v_sz, sel_z));
+
+      // the 32-bit masks widened to the double lanes
+      const __m128d sel_x_pd[2] = {_mm_castsi128_pd(_mm_unpacklo_epi32(sel_x, sel_x)), _mm_castsi128_pd(_mm_unpackhi_epi32(sel_x, sel_x))};
+      const __m128d sel_y_pd[2] = {_mm_castsi128_pd(_mm_unpacklo_epi32(sel_y, sel_y)), _mm_castsi128_pd(_mm_unpackhi_epi32(sel_y, sel_y))};
+      const __m128d sel_z_pd[2] = {_mm_castsi128_pd(_mm_unpacklo_epi32(sel_z, sel_z)), _mm_castsi128_pd(_mm_unpackhi_epi32(sel_z, sel_z))};
+
+      for (int h = 0; h < 2; h++) {
+        v_tx[h] = _mm_add_pd(v_tx[h], _mm_and_pd(v_dx[h], sel_x_pd[h]));
+        v_ty[h] = _mm_add_pd(v_ty[h], _mm_and_pd(v_dy[h], sel_y_pd[h]));
+        v_tz[h] = _mm_add_pd(v_tz[h], _mm_and_pd(v_dz[h], sel_z_pd[h]));
+      }
+
+      // reached the end point voxel or leaving the valid range of the ray
+      const __m128i reached = _mm_and_si128(_mm_cmpeq_epi32(v_kx, v_ex), _mm_and_si128(_mm_cmpeq_epi32(v_ky, v_ey), _mm_cmpeq_epi32(v_kz, v_ez)));
+      const __m128i beyond  = packMasksSse2(_mm_cmpgt_pd(_mm_min_pd(_mm_min_pd(v_tx[0], v_ty[0]), v_tz[0]), v_length[0]),
+                                           _mm_cmpgt_pd(_mm_min_pd(_mm_min_pd(v_tx[1], v_ty[1]), v_tz[1]), v_length[1]));
+
+      const __m128i emit      = _mm_andnot_si128(_mm_or_si128(reached, beyond), v_active);
+      const int     emit_mask = _mm_movemask_ps(_mm_castsi128_ps(emit));
+
+      if (emit_mask != 0) {
+
+        morton_t codes[4];
+        mortonEncodeSse2(v_kx, v_ky, v_kz, codes);
+
+        for (int mask = emit_mask; mask != 0; mask &= mask - 1) {
+          const int l = __builtin_ctz(mask);
+          batch.keys[batch.begins[first + l] + count[l]++] = codes[l];
+        }
+      }
+
+      // the emitting lanes are -1, which increments their count
+      v_count  = _mm_sub_epi32(v_count, emit);
+      v_active = _mm_and_si128(emit, _mm_cmpgt_epi32(v_capacity, v_count));
+    }
+
+    for (int l = 0; l < n_lanes; l++) {
+      batch.counts[first + l] = uint32_t(count[l]);
+    }
+  }
+}
+
+//}
+
+/* traceAvx2() //{ */
+
+__attribute__((target("avx2"))) void RayTracer::traceAvx2(RayBatch& batch) const {
+
+  const size_t n_rays = batch.size();
+
+  for (size_t first = 0; first < n_rays; first += 4) {
+
+    const int n_lanes = int(std::min(size_t(4), n_rays - first));
+
+    // the unused lanes stay inactive, their capacity is 0
+    alignas(32) int32_t kx[4] = {}, ky[4] = {}, kz[4] = {}, ex[4] = {}, ey[4] = {}, ez[4] = {}, sx[4] = {}, sy[4] = {}, sz[4] = {}, count[4] = {},
+                        capacity[4] = {};
+    alignas(32) double tx[4] = {}, ty[4] = {}, tz[4] = {}, dx[4] = {}, dy[4] = {}, dz[4] = {}, length[4] = {};
+
+    for (int l = 0; l < n_lanes; l++) {
+
+      const RayBatch::RayInit_t& init = batch.inits[first + l];
+
+      kx[l]       = init.key[0];
+      ky[l]       = init.key[1];
+      kz[l]       = init.key[2];
+      ex[l]       = init.end[0];
+      ey[l]       = init.end[1];
+      ez[l]       = init.end[2];
+      sx[l]       = init.step[0];
+      sy[l]       = init.step[1];
+      sz[l]       = init.step[2];
+      tx[l]       = init.t_max[0];
+      ty[l]       = init.t_max[1];
+      tz[l]       = init.t_max[2];
+      dx[l]       = init.t_delta[0];
+      dy[l]       = init.t_delta[1];
+      dz[l]       = init.t_delta[2];
+      length[l]   = init.length;
+      count[l]    = int32_t(batch.counts[first + l]);
+      capacity[l] = int32_t(init.capacity);
+    }
+
+    // the keys are in 32-bit lanes, the parameters of the ray in double lanes
+    __m128i v_kx = _mm_load_si128((const __m128i*)kx), v_ky = _mm_load_si128((const __m128i*)ky), v_kz = _mm_load_si128((const __m128i*)kz);
+    __m256d v_tx = _mm256_load_pd(tx), v_ty = _mm256_load_pd(ty), v_tz = _mm256_load_pd(tz);
+
+    const __m128i v_ex = _mm_load_si128((const __m128i*)ex), v_ey = _mm_load_si128((const __m128i*)ey), v_ez = _mm_load_si128((const __m128i*)ez);
+    const __m128i v_sx = _mm_load_si128((const __m128i*)sx), v_sy = _mm_load_si128((const __m128i*)sy), v_sz = _mm_load_si128((const __m128i*)sz);
+    const __m256d v_dx = _mm256_load_pd(dx), v_dy = _mm256_load_pd(dy), v_dz = _mm256_load_pd(dz);
+    const __m256d v_length   = _mm256_load_pd(length);
+    const __m128i v_capacity = _mm_load_si128((const __m128i*)capacity);
+
+    __m128i v_count  = _mm_load_si128((const __m128i*)count);
+    __m128i v_active = _mm_cmpgt_epi32(v_capacity, v_count);
+
+    while (_mm_movemask_ps(_mm_castsi128_ps(v_active)) != 0) {
+
+      const __m256d active = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(v_active));
+
+      // find minimum t_max, the ties are resolved as in the scalar version
+      const __m256d lt_xy = _mm256_cmp_pd(v_tx, v_ty, _CMP_LT_OQ);
+      const __m256d lt_xz = _mm256_cmp_pd(v_tx, v_tz, _CMP_LT_OQ);
+      const __m256d lt_yz = _mm256_cmp_pd(v_ty, v_tz, _CMP_LT_OQ);
+      const __m256d sel_x = _mm256_and_pd(active, _mm256_and_pd(lt_xy, lt_xz));
+      const __m256d sel_y = _mm256_and_pd(active, _mm256_andnot_pd(lt_xy, lt_yz));
+      const __m256d sel_z = _mm256_andnot_pd(_mm256_or_pd(sel_x, sel_y), active);
+
+      // advance in the selected direction
+      v_kx = _mm_add_epi32(v_kx, _mm_and_si128(v_sx, packMasksAvx2(sel_x)));
+      v_ky = _mm_add_epi32(v_ky, _mm_and_si128(v_sy, packMasksAvx2(sel_y)));
+      v_kz = _mm_add_epi32(v_kz, _mm_and_si128(v_sz, packMasksAvx2(sel_z)));
+      v_tx = _mm256_add_pd(v_tx, _mm256_and_pd(v_dx, sel_x));
+      v_ty = _mm256_add_pd(v_ty, _mm256_and_pd(v_dy, sel_y));
+      v_tz = _mm256_add_pd(v_tz, _mm256_and_pd(v_dz, sel_z));
+
+      // reached the end point voxel or leaving the valid range of the ray
+      const __m128i reached = _mm_and_si128(_mm_cmpeq_epi32(v_kx, v_ex), _mm_and_si128(_mm_cmpeq_epi32(v_ky, v_ey), _mm_cmpeq_epi32(v_kz, v_ez)));
+      const __m128i beyond  = packMasksAvx2(_mm256_cmp_pd(_mm256_min_pd(_mm256_min_pd(v_tx, v_ty), v_tz), v_length, _CMP_GT_OQ));
+
+      const __m128i emit      = _mm_andnot_si128(_mm_or_si128(reached, beyond), v_active);
+      const int     emit_mask = _mm_movemask_ps(_mm_castsi128_ps(emit));
+
+      if (emit_mask != 0) {
+
+        morton_t codes[4];
+        mortonEncodeAvx2(v_kx, v_ky, v_kz, codes);
+
+        for (int mask = emit_mask; mask != 0; mask &= mask - 1) {
+          const int l = __builtin_ctz(mask);
+          batch.keys[batch.begins[first + l] + count[l]++] = codes[l];
+        }
+      }
+
+      // the emitting lanes are -1, which increments their count
+      v_count  = _mm_sub_epi32(v_count, emit);
+      v_active = _mm_and_si128(emit, _mm_cmpgt_epi32(v_capacity, v_count));
+    }
+
+    for (int l = 0; l < n_lanes; l++) {
+      batch.counts[first + l] = uint32_t(count[l]);
+    }
+  }
+}
+
+//}
+
+#else
+
+void RayTracer::traceSse2(RayBatch& batch) const {
+  traceScalar(batch);
+}
+
+void RayTracer::traceAvx2(RayBatch& batch) const {
+  traceScalar(batch);
+}
+
+#endif
+
+}  // namespace mrs_octomap_server
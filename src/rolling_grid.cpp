@@ -0,0 +1,687 @@
+#include <mrs_octomap_server/rolling_grid.h>
+
+#include <algorithm>
+
+namespace mrs_octomap_server
+{
+
+// the value of the cells that have not been observed
+static const float UNKNOWN = std::numeric_limits<float>::quiet_NaN();
+
+/* RollingGrid() //{ */
+
+RollingGrid::RollingGrid() {
+
+  for (int j = 0; j < 3; j++) {
+    size_[j]   = 0;
+    origin_[j] = 0;
+    offset_[j] = 0;
+  }
+
+  clamping_min_        = 0;
+  clamping_max_        = 0;
+  occupancy_threshold_ = 0;
+
+  version_     = 0;
+  initialized_ = false;
+
+  changes_since_   = 0;
+  changes_tracked_ = false;
+}
+
+//}
+
+/* initialize() //{ */
+
+void RollingGrid::initialize(const int size_xy, const int size_z, const float clamping_min, const float clamping_max, const float occupancy_threshold,
+                             const unsigned int n_levels) {
+
+  const int sizes[3] = {size_xy, size_xy, size_z};
+
+  for (int j = 0; j < 3; j++) {
+    size_[j]   = std::max(1, sizes[j]);
+    origin_[j] = 0;
+    offset_[j] = 0;
+  }
+
+  clamping_min_        = clamping_min;
+  clamping_max_        = clamping_max;
+  occupancy_threshold_ = occupancy_threshold;
+
+  cells_.assign(size_t(size_[0]) * size_[1] * size_[2], UNKNOWN);
+
+  changed_flags_.assign((cells_.size() + 63) / 64, 0);
+  changed_cells_.clear();
+
+  // the window overlaps at most (size - 1) / 2^level + 2 cubes along each axis, they get distinct positions in the ring
+  levels_.resize(std::min(n_levels, MAX_LEVELS));
+
+  for (size_t l = 0; l < levels_.size(); l++) {
+
+    for (int j = 0; j < 3; j++) {
+      levels_[l].size[j] = ((size_[j] - 1) >> (l + 1)) + 2;
+    }
+
+    levels_[l].cubes.assign(size_t(levels_[l].size[0]) * levels_[l].size[1] * levels_[l].size[2], Summary_t{0, 0});
+  }
+
+  version_++;
+  initialized_ = false;
+
+  resetChanges(false);
+}
+
+//}
+
+/* clear() //{ */
+
+void RollingGrid::clear() {
+
+  std::fill(cells_.begin(), cells_.end(), UNKNOWN);
+
+  clearSummaries();
+
+  version_++;
+
+  resetChanges(false);
+}
+
+//}
+
+/* moveTo() //{ */
+
+void RollingGrid::moveTo(const octomap::OcTreeKey& center) {
+
+  int32_t origin[3];
+
+  for (int j = 0; j < 3; j++) {
+    origin[j] = int32_t(center[j]) - size_[j] / 2;
+  }
+
+  if (origin[0] == origin_[0] && origin[1] == origin_[1] && origin[2] == origin_[2]) {
+    return;
+  }
+
+  // the first placement or a jump over the whole window, nothing can be kept
+  bool clear_all = !initialized_;
+
+  for (int j = 0; j < 3; j++) {
+    if (std::abs(origin[j] - origin_[j]) >= size_[j]) {
+      clear_all = true;
+    }
+  }
+
+  if (clear_all) {
+
+    std::fill(cells_.begin(), cells_.end(), UNKNOWN);
+
+    clearSummaries();
+
+    resetChanges(false);
+
+  } else {
+
+    // clear the slabs that leave the window, the ring index of a slab is reused by the slab that enters
+    for (int j = 0; j < 3; j++) {
+
+      if (origin[j] > origin_[j]) {
+
+        for (int32_t c = origin_[j]; c < origin[j]; c++) {
+          clearSlab(j, c);
+        }
+
+      } else {
+
+        for (int32_t c = origin[j] + size_[j]; c < origin_[j] + size_[j]; c++) {
+          clearSlab(j, c);
+        }
+      }
+    }
+  }
+
+  // the slabs entering the window take the ring positions of the ones that left it, the ring follows the move
+  // (not the key itself, translate() shifts the keys of the ring)
+  for (int j = 0; j < 3; j++) {
+    offset_[j] = (((offset_[j] + (origin[j] - origin_[j])) % size_[j]) + size_[j]) % size_[j];
+    origin_[j] = origin[j];
+  }
+
+  initialized_ = true;
+  version_++;
+}
+
+//}
+
+/* translate() //{ */
+
+void RollingGrid::translate(const int32_t (&shift)[3]) {
+
+  if (!initialized_ || (shift[0] == 0 && shift[1] == 0 && shift[2] == 0)) {
+    return;
+  }
+
+  // the cells which would get outside of the key space
+  for (int j = 0; j < 3; j++) {
+    for (int32_t c = origin_[j]; c < origin_[j] + size_[j]; c++) {
+      if (c + shift[j] < 0 || c + shift[j] > 65535) {
+        clearSlab(j, c);
+      }
+    }
+  }
+
+  // the ring positions are kept, only the keys of the window change
+  for (int j = 0; j < 3; j++) {
+    origin_[j] += shift[j];
+  }
+
+  // the cubes of the summaries are aligned in the key space, the shifted cells are summarized anew
+  clearSummaries();
+
+  if (!levels_.empty()) {
+
+    for (int32_t x = origin_[0]; x < origin_[0] + size_[0]; x++) {
+      for (int32_t y = origin_[1]; y < origin_[1] + size_[1]; y++) {
+        for (int32_t z = origin_[2]; z < origin_[2] + size_[2]; z++) {
+
+          const float value = cells_[index(x, y, z)];
+
+          if (!std::isnan(value)) {
+            summarize(x, y, z, UNKNOWN, value);
+          }
+        }
+      }
+    }
+  }
+
+  version_++;
+
+  resetChanges(false);
+}
+
+//}
+
+/* clearSlab() //{ */
+
+void RollingGrid::clearSlab(const int axis, const int32_t coord) {
+
+  switch (axis) {
+
+    case 0: {
+
+      for (int32_t y = origin_[1]; y < origin_[1] + size_[1]; y++) {
+        for (int32_t z = origin_[2]; z < origin_[2] + size_[2]; z++) {
+          clearCell(coord, y, z);
+        }
+      }
+      break;
+    }
+
+    case 1: {
+
+      for (int32_t x = origin_[0]; x < origin_[0] + size_[0]; x++) {
+        for (int32_t z = origin_[2]; z < origin_[2] + size_[2]; z++) {
+          clearCell(x, coord, z);
+        }
+      }
+      break;
+    }
+
+    default: {
+
+      for (int32_t x = origin_[0]; x < origin_[0] + size_[0]; x++) {
+        for (int32_t y = origin_[1]; y < origin_[1] + size_[1]; y++) {
+          clearCell(x, y, coord);
+        }
+      }
+      break;
+    }
+  }
+}
+
+//}
+
+/* clearCell() //{ */
+
+void RollingGrid::clearCell(const int32_t x, const int32_t y, const int32_t z) {
+
+  float& cell = cells_[index(x, y, z)];
+
+  if (std::isnan(cell)) {
+    return;
+  }
+
+  summarize(x, y, z, cell, UNKNOWN);
+
+  cell = UNKNOWN;
+}
+
+//}
+
+/* contains() //{ */
+
+bool RollingGrid::contains(const octomap::OcTreeKey& key) const {
+
+  if (!initialized_) {
+    return false;
+  }
+
+  for (int j = 0; j < 3; j++) {
+
+    const int32_t d = int32_t(key[j]) - origin_[j];
+
+    if (d < 0 || d >= size_[j]) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+//}
+
+/* getWindow() //{ */
+
+void RollingGrid::getWindow(const octomap::OcTreeKey& center, octomap::OcTreeKey& min_key, octomap::OcTreeKey& max_key) const {
+
+  for (int j = 0; j < 3; j++) {
+
+    const int32_t origin = int32_t(center[j]) - size_[j] / 2;
+
+    min_key[j] = octomap::key_type(std::max(origin, int32_t(0)));
+    max_key[j] = octomap::key_type(std::min(origin + size_[j] - 1, int32_t(std::numeric_limits<octomap::key_type>::max())));
+  }
+}
+
+//}
+
+/* intersectWindow() //{ */
+
+bool RollingGrid::intersectWindow(octomap::OcTreeKey& min_key, octomap::OcTreeKey& max_key) const {
+
+  if (!initialized_) {
+    return false;
+  }
+
+  for (int j = 0; j < 3; j++) {
+
+    const int32_t from = std::max(int32_t(min_key[j]), origin_[j]);
+    const int32_t to   = std::min(int32_t(max_key[j]), origin_[j] + size_[j] - 1);
+
+    if (from > to) {
+      return false;
+    }
+
+    min_key[j] = octomap::key_type(from);
+    max_key[j] = octomap::key_type(to);
+  }
+
+  return true;
+}
+
+//}
+
+/* isOccupied() //{ */
+
+bool RollingGrid::isOccupied(const octomap::OcTreeKey& key) const {
+
+  if (!contains(key)) {
+    return false;
+  }
+
+  // false for the unknown cells
+  return cells_[index(key[0], key[1], key[2])] >= occupancy_threshold_;
+}
+
+bool RollingGrid::isOccupied(const octomap::OcTreeKey& key, const unsigned int level) const {
+
+  if (level == 0) {
+    return isOccupied(key);
+  }
+
+  const int32_t size = 1 << level;
+
+  if (level <= levels_.size()) {
+
+    // a cube outside of the window has no known cell
+    const Summary_t* cube = summary(key, level);
+
+    return cube && cube->n_occupied > 0;
+  }
+
+  for (int32_t x = 0; x < size; x++) {
+    for (int32_t y = 0; y < size; y++) {
+      for (int32_t z = 0; z < size; z++) {
+        if (isOccupied(octomap::OcTreeKey(key[0] + x, key[1] + y, key[2] + z))) {
+          return true;
+        }
+      }
+    }
+  }
+
+  return false;
+}
+
+//}
+
+/* update() //{ */
+
+void RollingGrid::update(const octomap::OcTreeKey& key, const float delta) {
+
+  if (!contains(key)) {
+    return;
+  }
+
+  const size_t idx = index(key[0], key[1], key[2]);
+
+  float& cell = cells_[idx];
+
+  const float value = std::min(std::max(std::isnan(cell) ? delta : cell + delta, clamping_min_), clamping_max_);
+
+  // a clamped cell does not change, an unknown one always does
+  if (value == cell) {
+    return;
+  }
+
+  summarize(key[0], key[1], key[2], cell, value);
+
+  cell = value;
+
+  markChanged(idx);
+  version_++;
+}
+
+void RollingGrid::update(const octomap::OcTreeKey& key, const float delta, const unsigned int level) {
+
+  const int size = 1 << level;
+
+  // all the cells of the cube are clamped at the minimum already, a free update would not change any of them
+  if (delta <= 0 && level > 0 && level <= levels_.size()) {
+
+    const Summary_t* cube = summary(key, level);
+
+    if (cube && cube->n_saturated == size * size * size) {
+      return;
+    }
+  }
+
+  for (int x = 0; x < size; x++) {
+    for (int y = 0; y < size; y++) {
+      for (int z = 0; z < size; z++) {
+        update(octomap::OcTreeKey(key[0] + x, key[1] + y, key[2] + z), delta);
+      }
+    }
+  }
+}
+
+//}
+
+/* setValue() //{ */
+
+void RollingGrid::setValue(const octomap::OcTreeKey& key, const float value) {
+
+  if (!contains(key)) {
+    return;
+  }
+
+  const size_t idx = index(key[0], key[1], key[2]);
+
+  const float clamped = std::min(std::max(value, clamping_min_), clamping_max_);
+
+  if (clamped == cells_[idx]) {
+    return;
+  }
+
+  summarize(key[0], key[1], key[2], cells_[idx], clamped);
+
+  cells_[idx] = clamped;
+
+  markChanged(idx);
+  version_++;
+}
+
+//}
+
+/* exportCells() //{ */
+
+void RollingGrid::exportCells(const octomap::OcTreeKey& min_key, const octomap::OcTreeKey& max_key, std::vector<KeyUpdate_t>& cells) const {
+
+  cells.clear();
+
+  octomap::OcTreeKey from_key = min_key;
+  octomap::OcTreeKey to_key   = max_key;
+
+  if (!intersectWindow(from_key, to_key)) {
+    return;
+  }
+
+  const int32_t from[3] = {from_key[0], from_key[1], from_key[2]};
+  const int32_t to[3]   = {to_key[0], to_key[1], to_key[2]};
+
+  appendCells(from, to, cells);
+
+  std::sort(cells.begin(), cells.end(), [](const KeyUpdate_t& a, const KeyUpdate_t& b) { return a.code < b.code; });
+}
+
+//}
+
+/* exportChanges() //{ */
+
+bool RollingGrid::exportChanges(uint64_t& version, const octomap::OcTreeKey& min_key, const octomap::OcTreeKey& max_key,
+                                const octomap::OcTreeKey& prev_min_key, const octomap::OcTreeKey& prev_max_key, std::vector<KeyUpdate_t>& cells) {
+
+  cells.clear();
+
+  const bool known = changes_tracked_ && version == changes_since_;
+
+  octomap::OcTreeKey from_key = min_key;
+  octomap::OcTreeKey to_key   = max_key;
+
+  if (known && intersectWindow(from_key, to_key)) {
+
+    // the changed cells inside of the box, the index of the ring is split into the positions along the axes
+    for (const uint32_t idx : changed_cells_) {
+
+      const int32_t pos[3] = {int32_t(idx / (size_t(size_[1]) * size_[2])), int32_t((idx / size_[2]) % size_[1]), int32_t(idx % size_[2])};
+
+      int32_t key[3];
+      bool    inside = true;
+
+      for (int j = 0; j < 3; j++) {
+
+        const int32_t d = pos[j] - offset_[j];
+
+        key[j] = origin_[j] + (d < 0 ? d + size_[j] : d);
+
+        if (key[j] < from_key[j] || key[j] > to_key[j]) {
+          inside = false;
+        }
+      }
+
+      if (inside) {
+        cells.push_back({mortonEncode(uint32_t(key[0]), uint32_t(key[1]), uint32_t(key[2])), cells_[idx]});
+      }
+    }
+
+    // the part of the box outside of the previous box, as disjoint slabs along each of the axes
+    int32_t from[3] = {from_key[0], from_key[1], from_key[2]};
+    int32_t to[3]   = {to_key[0], to_key[1], to_key[2]};
+
+    for (int j = 0; j < 3; j++) {
+
+      if (from[j] < int32_t(prev_min_key[j])) {
+
+        int32_t slab_to[3] = {to[0], to[1], to[2]};
+        slab_to[j]         = std::min(to[j], int32_t(prev_min_key[j]) - 1);
+
+        appendCells(from, slab_to, cells);
+      }
+
+      if (to[j] > int32_t(prev_max_key[j])) {
+
+        int32_t slab_from[3] = {from[0], from[1], from[2]};
+        slab_from[j]         = std::max(from[j], int32_t(prev_max_key[j]) + 1);
+
+        appendCells(slab_from, to, cells);
+      }
+
+      // the rest lies within the previous box along this axis
+      from[j] = std::max(from[j], int32_t(prev_min_key[j]));
+      to[j]   = std::min(to[j], int32_t(prev_max_key[j]));
+
+      if (from[j] > to[j]) {
+        break;
+      }
+    }
+
+    // a changed cell which entered the box is listed twice, with the same value
+    std::sort(cells.begin(), cells.end(), [](const KeyUpdate_t& a, const KeyUpdate_t& b) { return a.code < b.code; });
+    cells.erase(std::unique(cells.begin(), cells.end(), [](const KeyUpdate_t& a, const KeyUpdate_t& b) { return a.code == b.code; }), cells.end());
+  }
+
+  // the next export continues from here
+  resetChanges(true);
+
+  version = version_;
+
+  return known;
+}
+
+//}
+
+/* appendCells() //{ */
+
+/**
+ * @brief appends the known cells of the box, the box has to be inside of the window
+ */
+void RollingGrid::appendCells(const int32_t (&from)[3], const int32_t (&to)[3], std::vector<KeyUpdate_t>& cells) const {
+
+  for (int32_t x = from[0]; x <= to[0]; x++) {
+    for (int32_t y = from[1]; y <= to[1]; y++) {
+      for (int32_t z = from[2]; z <= to[2]; z++) {
+
+        const float value = cells_[index(x, y, z)];
+
+        if (!std::isnan(value)) {
+          cells.push_back({mortonEncode(uint32_t(x), uint32_t(y), uint32_t(z)), value});
+        }
+      }
+    }
+  }
+}
+
+//}
+
+/* markChanged() //{ */
+
+void RollingGrid::markChanged(const size_t idx) {
+
+  if (!changes_tracked_) {
+    return;
+  }
+
+  uint64_t&      flags = changed_flags_[idx / 64];
+  const uint64_t bit   = uint64_t(1) << (idx % 64);
+
+  if (flags & bit) {
+    return;
+  }
+
+  flags |= bit;
+  changed_cells_.push_back(uint32_t(idx));
+
+  // nobody has been exporting for long, the whole grid will be exported when it is needed
+  if (changed_cells_.size() > cells_.size() / 16) {
+    resetChanges(false);
+  }
+}
+
+//}
+
+/* summary() //{ */
+
+const RollingGrid::Summary_t* RollingGrid::summary(const octomap::OcTreeKey& key, const unsigned int level) const {
+
+  if (!initialized_ || level == 0 || level > levels_.size()) {
+    return nullptr;
+  }
+
+  const Level_t& summaries = levels_[level - 1];
+
+  size_t idx = 0;
+
+  for (int j = 0; j < 3; j++) {
+
+    const int32_t cube = int32_t(key[j]) >> level;
+
+    // the ring holds only the cubes overlapping the window
+    if (((cube + 1) << level) <= origin_[j] || (cube << level) >= origin_[j] + size_[j]) {
+      return nullptr;
+    }
+
+    idx = idx * summaries.size[j] + size_t(cube % summaries.size[j]);
+  }
+
+  return &summaries.cubes[idx];
+}
+
+//}
+
+/* summarize() //{ */
+
+void RollingGrid::summarize(const int32_t x, const int32_t y, const int32_t z, const float old_value, const float new_value) {
+
+  // false for the unknown values
+  const int d_occupied  = int(new_value >= occupancy_threshold_) - int(old_value >= occupancy_threshold_);
+  const int d_saturated = int(new_value <= clamping_min_) - int(old_value <= clamping_min_);
+
+  if (d_occupied == 0 && d_saturated == 0) {
+    return;
+  }
+
+  // the known cells are inside of the key space, their keys are not negative
+  for (size_t l = 0; l < levels_.size(); l++) {
+
+    Level_t&       summaries = levels_[l];
+    const unsigned level     = unsigned(l + 1);
+
+    const size_t idx = (size_t((x >> level) % summaries.size[0]) * summaries.size[1] + size_t((y >> level) % summaries.size[1])) * summaries.size[2] +
+                       size_t((z >> level) % summaries.size[2]);
+
+    summaries.cubes[idx].n_occupied  = uint16_t(summaries.cubes[idx].n_occupied + d_occupied);
+    summaries.cubes[idx].n_saturated = uint16_t(summaries.cubes[idx].n_saturated + d_saturated);
+  }
+}
+
+//}
+
+/* clearSummaries() //{ */
+
+void RollingGrid::clearSummaries() {
+
+  for (Level_t& summaries : levels_) {
+    std::fill(summaries.cubes.begin(), summaries.cubes.end(), Summary_t{0, 0});
+  }
+}
+
+//}
+
+/* resetChanges() //{ */
+
+/**
+ * @param tracked whether the changes are tracked from now on, otherwise the next exportChanges() fails
+ */
+void RollingGrid::resetChanges(const bool tracked) {
+
+  for (const uint32_t idx : changed_cells_) {
+    changed_flags_[idx / 64] = 0;
+  }
+
+  changed_cells_.clear();
+
+  changes_since_   = version_;
+  changes_tracked_ = tracked;
+}
+
+//}
+
+}  // namespace mrs_octomap_server
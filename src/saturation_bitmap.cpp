@@ -0,0 +1,213 @@
+#include <mrs_octomap_server/saturation_bitmap.h>
+
+#include <algorithm>
+
+namespace mrs_octomap_server
+{
+
+/* SaturationBitmap() //{ */
+
+SaturationBitmap::SaturationBitmap() {
+
+  for (int j = 0; j < 3; j++) {
+    size_[j] = 0;
+    mask_[j] = 0;
+    min_[j]  = 0;
+    max_[j]  = -1;
+  }
+
+  valid_ = false;
+}
+
+//}
+
+/* initialize() //{ */
+
+void SaturationBitmap::initialize(const int size_xy, const int size_z) {
+
+  const int sizes[3] = {size_xy, size_xy, size_z};
+
+  for (int j = 0; j < 3; j++) {
+
+    // the ring addressing uses the lower bits of the keys
+    size_[j] = 1;
+
+    while (size_[j] < sizes[j]) {
+      size_[j] *= 2;
+    }
+
+    mask_[j] = size_[j] - 1;
+  }
+
+  words_.assign((size_t(size_[0]) * size_[1] * size_[2] + 63) / 64, 0);
+
+  valid_ = false;
+}
+
+//}
+
+/* clear() //{ */
+
+void SaturationBitmap::clear() {
+
+  std::fill(words_.begin(), words_.end(), 0);
+}
+
+//}
+
+/* moveTo() //{ */
+
+void SaturationBitmap::moveTo(const octomap::OcTreeKey& min_key, const octomap::OcTreeKey& max_key) {
+
+  int32_t min[3], max[3];
+
+  // the new box has to fit into the bitmap, the bits of the voxels that stay in the box must not alias
+  bool fits       = !words_.empty();
+  bool overlapped = valid_;
+
+  for (int j = 0; j < 3; j++) {
+
+    min[j] = int32_t(min_key[j]);
+    max[j] = int32_t(max_key[j]);
+
+    if (max[j] - min[j] + 1 > size_[j]) {
+      fits = false;
+    }
+
+    if (max[j] < min_[j] || min[j] > max_[j]) {
+      overlapped = false;
+    }
+  }
+
+  if (!fits || !overlapped) {
+
+    clear();
+
+  } else {
+
+    // clear the slabs that leave the box, the ring index of a slab is reused by the slab that enters
+    for (int j = 0; j < 3; j++) {
+
+      for (int32_t c = min_[j]; c < min[j]; c++) {
+        clearSlab(j, c);
+      }
+
+      for (int32_t c = max[j] + 1; c <= max_[j]; c++) {
+        clearSlab(j, c);
+      }
+    }
+  }
+
+  for (int j = 0; j < 3; j++) {
+    min_[j] = min[j];
+    max_[j] = max[j];
+  }
+
+  valid_ = fits;
+}
+
+//}
+
+/* clearSlab() //{ */
+
+void SaturationBitmap::clearSlab(const int axis, const int32_t coord) {
+
+  switch (axis) {
+
+    case 0: {
+
+      for (int32_t y = 0; y < size_[1]; y++) {
+        for (int32_t z = 0; z < size_[2]; z++) {
+          resetBit(index(coord, y, z));
+        }
+      }
+      break;
+    }
+
+    case 1: {
+
+      for (int32_t x = 0; x < size_[0]; x++) {
+        for (int32_t z = 0; z < size_[2]; z++) {
+          resetBit(index(x, coord, z));
+        }
+      }
+      break;
+    }
+
+    default: {
+
+      for (int32_t x = 0; x < size_[0]; x++) {
+        for (int32_t y = 0; y < size_[1]; y++) {
+          resetBit(index(x, y, coord));
+        }
+      }
+      break;
+    }
+  }
+}
+
+//}
+
+/* inside() //{ */
+
+bool SaturationBitmap::inside(const octomap::OcTreeKey& key) const {
+
+  if (!valid_) {
+    return false;
+  }
+
+  for (int j = 0; j < 3; j++) {
+    if (int32_t(key[j]) < min_[j] || int32_t(key[j]) > max_[j]) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+//}
+
+/* test() //{ */
+
+bool SaturationBitmap::test(const octomap::OcTreeKey& key) const {
+
+  if (!inside(key)) {
+    return false;
+  }
+
+  const size_t idx = index(key[0], key[1], key[2]);
+
+  return (words_[idx >> 6] >> (idx & 63)) & 1;
+}
+
+//}
+
+/* set() //{ */
+
+void SaturationBitmap::set(const octomap::OcTreeKey& key) {
+
+  if (!inside(key)) {
+    return;
+  }
+
+  const size_t idx = index(key[0], key[1], key[2]);
+
+  words_[idx >> 6] |= uint64_t(1) << (idx & 63);
+}
+
+//}
+
+/* reset() //{ */
+
+void SaturationBitmap::reset(const octomap::OcTreeKey& key) {
+
+  if (!inside(key)) {
+    return;
+  }
+
+  resetBit(index(key[0], key[1], key[2]));
+}
+
+//}
+
+}  // namespace mrs_octomap_server
@@ -0,0 +1,129 @@
+#include <gtest/gtest.h>
+
+#include <mrs_octomap_server/bounded_queue.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <memory>
+
+using namespace mrs_octomap_server;
+
+/* tests //{ */
+
+TEST(BoundedQueue, CapacityIsRoundedUpToPowerOfTwo) {
+
+  EXPECT_EQ(BoundedQueue<int>(1).capacity(), 2u);
+  EXPECT_EQ(BoundedQueue<int>(8).capacity(), 8u);
+  EXPECT_EQ(BoundedQueue<int>(9).capacity(), 16u);
+}
+
+TEST(BoundedQueue, FifoFullAndEmpty) {
+
+  BoundedQueue<std::unique_ptr<int>> queue(4);
+
+  std::unique_ptr<int> item;
+
+  EXPECT_TRUE(queue.empty());
+  EXPECT_FALSE(queue.pop(item));
+
+  // several laps around the ring
+  for (int lap = 0; lap < 3; lap++) {
+
+    for (int i = 0; i < 4; i++) {
+      EXPECT_TRUE(queue.push(std::make_unique<int>(lap * 4 + i)));
+    }
+
+    // the item of a failed push is left to the caller
+    item = std::make_unique<int>(-1);
+    EXPECT_FALSE(queue.push(std::move(item)));
+    ASSERT_TRUE(item);
+
+    for (int i = 0; i < 4; i++) {
+      ASSERT_TRUE(queue.pop(item));
+      EXPECT_EQ(*item, lap * 4 + i);
+    }
+
+    EXPECT_TRUE(queue.empty());
+    EXPECT_FALSE(queue.pop(item));
+  }
+}
+
+/**
+ * @brief the callbacks of several sensors pushing the scans and several integrators popping them, every item is popped
+ * exactly once and the items of one producer keep their order
+ */
+TEST(BoundedQueue, MultipleProducersAndConsumers) {
+
+  const int n_producers = 4;
+  const int n_consumers = 3;
+  const int n_items     = 100000;
+
+  BoundedQueue<int> queue(8);
+
+  std::vector<std::vector<int>> popped(n_consumers);
+  std::atomic<int>              n_popped(0);
+
+  std::vector<std::thread> threads;
+
+  for (int p = 0; p < n_producers; p++) {
+    threads.emplace_back([&queue, p]() {
+      for (int i = 0; i < n_items; i++) {
+        int item = p * n_items + i;
+        while (!queue.push(std::move(item))) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  for (int c = 0; c < n_consumers; c++) {
+    threads.emplace_back([&queue, &popped, &n_popped, c]() {
+      int item;
+      while (n_popped.load() < n_producers * n_items) {
+        if (queue.pop(item)) {
+          popped[c].push_back(item);
+          n_popped++;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  std::vector<int> count(n_producers * n_items, 0);
+
+  for (int c = 0; c < n_consumers; c++) {
+
+    std::vector<int> last(n_producers, -1);
+
+    for (const int item : popped[c]) {
+
+      count[item]++;
+
+      const int p = item / n_items;
+
+      EXPECT_GT(item, last[p]);
+      last[p] = item;
+    }
+  }
+
+  for (const int n : count) {
+    ASSERT_EQ(n, 1);
+  }
+
+  EXPECT_TRUE(queue.empty());
+}
+
+//}
+
+int main(int argc, char** argv) {
+
+  testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,174 @@
+#include <gtest/gtest.h>
+
+#include <octomap/OcTree.h>
+#include <octomap_msgs/conversions.h>
+
+#include <mrs_octomap_server/key_buffer.h>
+#include <mrs_octomap_server/tree_batch.h>
+#include <mrs_octomap_server/map_serializer.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+#include <cstdio>
+#include <algorithm>
+
+using namespace mrs_octomap_server;
+
+namespace
+{
+
+const double RESOLUTION = 0.1;
+
+/* randomTree() //{ */
+
+/**
+ * @brief a tree of random hits and misses in a box of the given size (in leaves), the dense parts get pruned
+ */
+void randomTree(octomap::OcTree& octree, const int n, const int size, const unsigned int seed) {
+
+  std::mt19937                       generator(seed);
+  std::uniform_int_distribution<int> coord(-size / 2, size / 2 - 1);
+  std::uniform_int_distribution<int> hit(0, 3);
+
+  const octomap::OcTreeKey center = octree.coordToKey(0.0, 0.0, 0.0);
+
+  std::vector<KeyUpdate_t> batch;
+
+  for (int i = 0; i < n; i++) {
+
+    // every other update lands in a thin slab around z = 0, its leaves get clamped and pruned
+    const int z = coord(generator) / (i % 2 ? 1 : 8);
+
+    octomap::OcTreeKey key(octomap::key_type(center[0] + coord(generator)), octomap::key_type(center[1] + coord(generator)),
+                           octomap::key_type(center[2] + z));
+
+    batch.push_back({mortonEncode(key), hit(generator) == 0 ? octree.getProbHitLog() : octree.getProbMissLog()});
+  }
+
+  std::stable_sort(batch.begin(), batch.end(), [](const KeyUpdate_t& a, const KeyUpdate_t& b) { return a.code < b.code; });
+
+  updateNodesBatch(octree, batch);
+}
+
+//}
+
+/* expectSameMsg() //{ */
+
+void expectSameMsg(const octomap_msgs::Octomap& msg, const octomap_msgs::Octomap& reference) {
+
+  EXPECT_EQ(msg.binary, reference.binary);
+  EXPECT_EQ(msg.id, reference.id);
+  EXPECT_EQ(msg.resolution, reference.resolution);
+
+  ASSERT_EQ(msg.data.size(), reference.data.size());
+
+  EXPECT_TRUE(msg.data == reference.data);
+}
+
+//}
+
+}  // namespace
+
+/* tests //{ */
+
+TEST(MapSerializer, SameBytesAsOctomapMsgs) {
+
+  octomap::OcTree octree(RESOLUTION);
+
+  randomTree(octree, 200000, 256, 1);
+
+  octomap_msgs::Octomap full_reference, binary_reference;
+
+  ASSERT_TRUE(octomap_msgs::fullMapToMsg(octree, full_reference));
+  ASSERT_TRUE(octomap_msgs::binaryMapToMsg(octree, binary_reference));
+
+  ASSERT_FALSE(full_reference.data.empty());
+  ASSERT_FALSE(binary_reference.data.empty());
+
+  // the split depth 0 writes the whole tree by one worker, the deep splits cut through the pruned nodes and the leaves
+  for (const int n_threads : {1, 2, 4, 7}) {
+    for (const unsigned int split_depth : {0u, 1u, 3u, 5u, 12u}) {
+
+      SCOPED_TRACE("n_threads " + std::to_string(n_threads) + ", split_depth " + std::to_string(split_depth));
+
+      MapSerializer<octomap::OcTree> serializer(n_threads, split_depth);
+
+      octomap_msgs::Octomap full, binary;
+
+      ASSERT_TRUE(serializer.fullMapToMsg(octree, full));
+      ASSERT_TRUE(serializer.binaryMapToMsg(octree, binary));
+
+      expectSameMsg(full, full_reference);
+      expectSameMsg(binary, binary_reference);
+    }
+  }
+}
+
+TEST(MapSerializer, EmptyTree) {
+
+  octomap::OcTree octree(RESOLUTION);
+
+  octomap_msgs::Octomap full_reference, binary_reference, full, binary;
+
+  ASSERT_TRUE(octomap_msgs::fullMapToMsg(octree, full_reference));
+  ASSERT_TRUE(octomap_msgs::binaryMapToMsg(octree, binary_reference));
+
+  MapSerializer<octomap::OcTree> serializer(4);
+
+  ASSERT_TRUE(serializer.fullMapToMsg(octree, full));
+  ASSERT_TRUE(serializer.binaryMapToMsg(octree, binary));
+
+  expectSameMsg(full, full_reference);
+  expectSameMsg(binary, binary_reference);
+}
+
+/**
+ * @brief the serialization times of a large map, run with --gtest_also_run_disabled_tests
+ */
+TEST(MapSerializer, DISABLED_Benchmark) {
+
+  octomap::OcTree octree(RESOLUTION);
+
+  randomTree(octree, 1000000, 512, 2);
+
+  const int n_repeats = 10;
+
+  auto measure = [&](auto serialize) {
+
+    octomap_msgs::Octomap msg;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < n_repeats; i++) {
+      serialize(msg);
+    }
+
+    const auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::milli>(end - start).count() / n_repeats;
+  };
+
+  printf("nodes: %zu\n", octree.size());
+
+  printf("octomap_msgs: full %.1f ms, binary %.1f ms\n", measure([&](octomap_msgs::Octomap& msg) { octomap_msgs::fullMapToMsg(octree, msg); }),
+         measure([&](octomap_msgs::Octomap& msg) { octomap_msgs::binaryMapToMsg(octree, msg); }));
+
+  for (const int n_threads : {1, 2, 4, 8}) {
+
+    MapSerializer<octomap::OcTree> serializer(n_threads);
+
+    printf("MapSerializer, %d threads: full %.1f ms, binary %.1f ms\n", n_threads,
+           measure([&](octomap_msgs::Octomap& msg) { serializer.fullMapToMsg(octree, msg); }),
+           measure([&](octomap_msgs::Octomap& msg) { serializer.binaryMapToMsg(octree, msg); }));
+  }
+}
+
+//}
+
+int main(int argc, char** argv) {
+
+  testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,215 @@
+#include <gtest/gtest.h>
+
+#include <octomap/OcTree.h>
+
+#include <mrs_octomap_server/quantized_octree.h>
+
+#include <random>
+#include <sstream>
+#include <string>
+#include <type_traits>
+
+using namespace mrs_octomap_server;
+
+namespace
+{
+
+const double RESOLUTION = 0.1;
+
+/* setModel() //{ */
+
+template <class T>
+void setModel(T& octree) {
+
+  octree.setProbHit(0.7);
+  octree.setProbMiss(0.4);
+  octree.setClampingThresMin(0.12);
+  octree.setClampingThresMax(0.97);
+}
+
+//}
+
+/* class ReferenceOcTree //{ */
+
+/**
+ * @brief octomap::OcTree given the log-odds of the sensor model directly, a conversion through the probabilities could miss them by an ulp
+ */
+class ReferenceOcTree : public octomap::OcTree {
+
+public:
+  explicit ReferenceOcTree(const double resolution) : octomap::OcTree(resolution) {
+  }
+
+  void setModelLog(const float hit, const float miss, const float min, const float max) {
+
+    prob_hit_log       = hit;
+    prob_miss_log      = miss;
+    clamping_thres_min = min;
+    clamping_thres_max = max;
+  }
+};
+
+//}
+
+/* randomUpdates() //{ */
+
+/**
+ * @brief hits, misses and other updates of the keys of a small box, dense enough to clamp the leaves and prune the tree
+ */
+template <class T>
+void randomUpdates(T& octree, const int n, const unsigned int seed) {
+
+  std::mt19937                       generator(seed);
+  std::uniform_int_distribution<int> coord(-8, 7);
+  std::uniform_int_distribution<int> event(0, 9);
+
+  const octomap::OcTreeKey center = octree.coordToKey(0.0, 0.0, 0.0);
+
+  for (int i = 0; i < n; i++) {
+
+    const octomap::OcTreeKey key(center[0] + coord(generator), center[1] + coord(generator), center[2] + coord(generator) / 4);
+
+    const int e = event(generator);
+
+    // the other updates are sums of the steps, the float arithmetic of the reference stays exact
+    const float update = e < 2 ? octree.getProbHitLog() : e < 9 ? octree.getProbMissLog() : octree.getProbHitLog() + octree.getProbMissLog();
+
+    octree.updateNode(key, update);
+  }
+}
+
+//}
+
+}  // namespace
+
+/* tests //{ */
+
+TEST(QuantizedOcTree, NodeIsAnOcTreeNode) {
+
+  static_assert(std::is_base_of<octomap::OcTreeNode, QuantizedOcTreeNode>::value, "the node has to be an octomap::OcTreeNode");
+  static_assert(std::is_same<QuantizedOcTree::NodeType, QuantizedOcTreeNode>::value, "the tree has to use the quantized node");
+
+  // the layout of octomap's nodes is kept
+  EXPECT_EQ(sizeof(QuantizedOcTreeNode), sizeof(octomap::OcTreeNode));
+}
+
+TEST(QuantizedOcTree, ModelIsSnappedToTheSteps) {
+
+  QuantizedOcTree octree(RESOLUTION);
+
+  setModel(octree);
+
+  const float values[4] = {octree.getProbHitLog(), octree.getProbMissLog(), octree.getClampingThresMinLog(), octree.getClampingThresMaxLog()};
+
+  for (const float value : values) {
+    EXPECT_EQ(value, QuantizedOcTreeNode::dequantize(QuantizedOcTreeNode::quantize(value)));
+  }
+
+  // within a step of the continuous model
+  EXPECT_NEAR(octree.getProbHitLog(), octomap::logodds(0.7), QuantizedOcTreeNode::LOG_ODDS_STEP / 2);
+  EXPECT_NEAR(octree.getClampingThresMinLog(), octomap::logodds(0.12), QuantizedOcTreeNode::LOG_ODDS_STEP / 2);
+}
+
+/**
+ * @brief a node clamped by the misses equals the threshold reported by the tree, the saturation checks compare them
+ */
+TEST(QuantizedOcTree, ClampedNodesEqualTheThresholds) {
+
+  QuantizedOcTree octree(RESOLUTION);
+
+  setModel(octree);
+
+  const octomap::OcTreeKey key = octree.coordToKey(0.0, 0.0, 0.0);
+
+  for (int i = 0; i < 100; i++) {
+    octree.updateNode(key, octree.getProbMissLog());
+  }
+
+  EXPECT_EQ(octree.search(key)->getLogOdds(), octree.getClampingThresMinLog());
+
+  for (int i = 0; i < 100; i++) {
+    octree.updateNode(key, octree.getProbHitLog());
+  }
+
+  EXPECT_EQ(octree.search(key)->getLogOdds(), octree.getClampingThresMaxLog());
+}
+
+/**
+ * @brief the table lookups and the integer updates equal the clamped integer sums of the steps
+ */
+TEST(QuantizedOcTree, UpdatesEqualTheIntegerSums) {
+
+  QuantizedOcTree octree(RESOLUTION);
+
+  setModel(octree);
+
+  const int min = QuantizedOcTreeNode::quantize(octree.getClampingThresMinLog());
+  const int max = QuantizedOcTreeNode::quantize(octree.getClampingThresMaxLog());
+
+  const float updates[4] = {octree.getProbHitLog(), octree.getProbMissLog(), 0.3f * octree.getProbHitLog(), -1.7f};
+
+  for (const float update : updates) {
+    for (int value = min - 100; value <= max + 100; value++) {
+
+      QuantizedOcTreeNode node;
+      node.setQuantizedLogOdds(int16_t(value));
+
+      octree.updateNodeLogOdds(&node, update);
+
+      const int expected = std::max(min, std::min(max, value + QuantizedOcTreeNode::quantize(update)));
+
+      ASSERT_EQ(node.getQuantizedLogOdds(), expected) << "value " << value << ", update " << update;
+      ASSERT_EQ(node.getLogOdds(), QuantizedOcTreeNode::dequantize(int16_t(expected)));
+    }
+  }
+}
+
+/**
+ * @brief the inner nodes hold the maximum of their children, the tree is written as an octomap::OcTree of the same values
+ */
+TEST(QuantizedOcTree, WrittenAsOcTree) {
+
+  QuantizedOcTree octree(RESOLUTION);
+  ReferenceOcTree reference(RESOLUTION);
+
+  setModel(octree);
+
+  // the reference runs the float arithmetic on the snapped model, all its values are exact multiples of the step
+  reference.setModelLog(octree.getProbHitLog(), octree.getProbMissLog(), octree.getClampingThresMinLog(), octree.getClampingThresMaxLog());
+
+  randomUpdates(octree, 20000, 1);
+  randomUpdates(reference, 20000, 1);
+
+  EXPECT_EQ(octree.getTreeType(), reference.getTreeType());
+  EXPECT_EQ(octree.size(), reference.size());
+
+  std::stringstream data, reference_data;
+
+  octree.writeData(data);
+  reference.writeData(reference_data);
+
+  ASSERT_FALSE(reference_data.str().empty());
+  EXPECT_TRUE(data.str() == reference_data.str());
+
+  // the data of an octomap::OcTree read back into the quantized tree
+  QuantizedOcTree read(RESOLUTION);
+
+  setModel(read);
+
+  read.readData(reference_data);
+
+  std::stringstream read_data;
+  read.writeData(read_data);
+
+  EXPECT_EQ(read.size(), reference.size());
+  EXPECT_TRUE(read_data.str() == data.str());
+}
+
+//}
+
+int main(int argc, char** argv) {
+
+  testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,145 @@
+#include <gtest/gtest.h>
+
+#include <octomap/OcTree.h>
+
+#include <mrs_octomap_server/key_buffer.h>
+#include <mrs_octomap_server/ray_tracer.h>
+
+#include <random>
+#include <vector>
+
+using namespace mrs_octomap_server;
+
+namespace
+{
+
+/* randomRays() //{ */
+
+/**
+ * @brief rays from random origins in all directions up to the range, a part of them starts on the voxel borders or is
+ * parallel to the axes
+ */
+void randomRays(const double resolution, const double range, const size_t n_rays, const unsigned int seed, std::vector<octomap::point3d>& origins,
+                std::vector<octomap::point3d>& ends) {
+
+  std::mt19937                           generator(seed);
+  std::uniform_real_distribution<double> position(-20.0, 20.0);
+  std::uniform_real_distribution<double> offset(-range, range);
+  std::uniform_int_distribution<int>     kind(0, 9);
+  std::uniform_int_distribution<int>     axis(0, 2);
+
+  origins.resize(n_rays);
+  ends.resize(n_rays);
+
+  for (size_t i = 0; i < n_rays; i++) {
+
+    octomap::point3d origin(float(position(generator)), float(position(generator)), float(position(generator)));
+    octomap::point3d delta(float(offset(generator)), float(offset(generator)), float(offset(generator)));
+
+    switch (kind(generator)) {
+
+      // the origin on the voxel borders
+      case 0: {
+        for (int j = 0; j < 3; j++) {
+          origin(j) = float(std::round(origin(j) / resolution) * resolution);
+        }
+        break;
+      }
+
+      // parallel to a plane of the axes
+      case 1: {
+        delta(axis(generator)) = 0.0f;
+        break;
+      }
+
+      // parallel to an axis
+      case 2: {
+        const int a = axis(generator);
+        for (int j = 0; j < 3; j++) {
+          if (j != a) {
+            delta(j) = 0.0f;
+          }
+        }
+        break;
+      }
+
+      default:
+        break;
+    }
+
+    origins[i] = origin;
+    ends[i]    = origin + delta;
+  }
+}
+
+//}
+
+/* expectSameKeys() //{ */
+
+/**
+ * @brief traces the rays by all the instruction sets supported by the cpu, the keys have to be the same as computeRayKeys()
+ */
+void expectSameKeys(const double resolution, const double range, const size_t n_rays, const unsigned int seed) {
+
+  octomap::OcTree octree(resolution);
+
+  std::vector<octomap::point3d> origins, ends;
+  randomRays(resolution, range, n_rays, seed, origins, ends);
+
+  // the reference rays
+  std::vector<std::vector<morton_t>> reference(n_rays);
+
+  octomap::KeyRay key_ray;
+
+  for (size_t i = 0; i < n_rays; i++) {
+
+    if (octree.computeRayKeys(origins[i], ends[i], key_ray)) {
+      for (auto it = key_ray.begin(); it != key_ray.end(); ++it) {
+        reference[i].push_back(mortonEncode(*it));
+      }
+    }
+  }
+
+  RayTracer ray_tracer(resolution);
+
+  for (int simd_level = RayTracer::SIMD_NONE; simd_level <= int(RayTracer::detectSimdLevel()); simd_level++) {
+
+    ray_tracer.setSimdLevel(RayTracer::SimdLevel_t(simd_level));
+
+    RayBatch batch;
+    ray_tracer.traceRays(origins.data(), ends.data(), n_rays, batch);
+
+    size_t n_different = 0;
+
+    for (size_t i = 0; i < n_rays; i++) {
+      if (std::vector<morton_t>(batch.rayBegin(i), batch.rayEnd(i)) != reference[i]) {
+        n_different++;
+      }
+    }
+
+    EXPECT_EQ(n_different, 0u) << RayTracer::simdLevelName(RayTracer::SimdLevel_t(simd_level)) << ", resolution " << resolution << ", range " << range;
+  }
+}
+
+//}
+
+}  // namespace
+
+TEST(RayTracer, SameKeysAsComputeRayKeysCoarse) {
+  expectSameKeys(0.4, 15.0, 200000, 1);
+}
+
+TEST(RayTracer, SameKeysAsComputeRayKeysFine) {
+  expectSameKeys(0.1, 30.0, 200000, 2);
+}
+
+TEST(RayTracer, SameKeysAsComputeRayKeysVeryFine) {
+  expectSameKeys(0.05, 10.0, 100000, 3);
+}
+
+int main(int argc, char** argv) {
+
+  testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+}
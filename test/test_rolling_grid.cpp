@@ -0,0 +1,501 @@
+#include <gtest/gtest.h>
+
+#include <octomap/OcTree.h>
+
+#include <mrs_octomap_server/key_buffer.h>
+#include <mrs_octomap_server/tree_batch.h>
+#include <mrs_octomap_server/rolling_grid.h>
+
+#include <random>
+#include <algorithm>
+#include <vector>
+
+using namespace mrs_octomap_server;
+
+namespace
+{
+
+const double RESOLUTION = 0.2;
+
+/* Export_t //{ */
+
+/**
+ * @brief a tree kept up to date from the grid by the exports of the changes, as OctomapServer::exportRollingGrid() does
+ */
+typedef struct
+{
+  uint64_t           version = 0;
+  octomap::OcTreeKey min_key = octomap::OcTreeKey(0, 0, 0);
+  octomap::OcTreeKey max_key = octomap::OcTreeKey(0, 0, 0);
+  int                n_full  = 0;
+} Export_t;
+
+void exportChanges(RollingGrid& grid, octomap::OcTree& octree, Export_t& exported, octomap::OcTreeKey min_key, octomap::OcTreeKey max_key) {
+
+  if (!grid.intersectWindow(min_key, max_key)) {
+    return;
+  }
+
+  std::vector<KeyUpdate_t> cells;
+
+  if (grid.exportChanges(exported.version, min_key, max_key, exported.min_key, exported.max_key, cells)) {
+
+    cropTree(octree, min_key, max_key);
+    setLeavesBatch(octree, cells);
+
+  } else {
+
+    grid.exportCells(min_key, max_key, cells);
+
+    octree.clear();
+    updateNodesBatch(octree, cells);
+
+    exported.n_full++;
+  }
+
+  exported.min_key = min_key;
+  exported.max_key = max_key;
+}
+
+//}
+
+/* exportAll() //{ */
+
+/**
+ * @brief the tree built from all the cells of the box
+ */
+void exportAll(const RollingGrid& grid, octomap::OcTree& octree, octomap::OcTreeKey min_key, octomap::OcTreeKey max_key) {
+
+  octree.clear();
+
+  if (!grid.intersectWindow(min_key, max_key)) {
+    return;
+  }
+
+  std::vector<KeyUpdate_t> cells;
+
+  grid.exportCells(min_key, max_key, cells);
+
+  updateNodesBatch(octree, cells);
+}
+
+//}
+
+}  // namespace
+
+/* window //{ */
+
+TEST(RollingGrid, WindowHasTheGivenSize) {
+
+  RollingGrid grid;
+
+  grid.initialize(301, 101, -2.0f, 3.5f, 0.0f);
+
+  const octomap::OcTreeKey center(32768, 32768, 32768);
+
+  grid.moveTo(center);
+
+  // the window is not rounded up to a power of two
+  const int32_t first[3] = {32768 - 150, 32768 - 150, 32768 - 50};
+  const int32_t last[3]  = {32768 + 150, 32768 + 150, 32768 + 50};
+
+  for (int j = 0; j < 3; j++) {
+
+    octomap::OcTreeKey key = center;
+
+    key[j] = octomap::key_type(first[j]);
+    EXPECT_TRUE(grid.contains(key));
+
+    key[j] = octomap::key_type(first[j] - 1);
+    EXPECT_FALSE(grid.contains(key));
+
+    key[j] = octomap::key_type(last[j]);
+    EXPECT_TRUE(grid.contains(key));
+
+    key[j] = octomap::key_type(last[j] + 1);
+    EXPECT_FALSE(grid.contains(key));
+  }
+
+  // the window of a move is known before the move
+  const octomap::OcTreeKey next(32768 + 40, 32768 - 7, 32768 + 3);
+
+  octomap::OcTreeKey min_key, max_key;
+
+  grid.getWindow(next, min_key, max_key);
+
+  grid.moveTo(next);
+
+  for (int j = 0; j < 3; j++) {
+
+    octomap::OcTreeKey key = next;
+
+    key[j] = min_key[j];
+    EXPECT_TRUE(grid.contains(key));
+
+    key[j] = octomap::key_type(min_key[j] - 1);
+    EXPECT_FALSE(grid.contains(key));
+
+    key[j] = max_key[j];
+    EXPECT_TRUE(grid.contains(key));
+
+    key[j] = octomap::key_type(max_key[j] + 1);
+    EXPECT_FALSE(grid.contains(key));
+  }
+}
+
+TEST(RollingGrid, CellsMoveWithTheWindow) {
+
+  RollingGrid grid;
+
+  grid.initialize(37, 11, -2.0f, 3.5f, 0.0f);
+
+  octomap::OcTreeKey center(1000, 2000, 3000);
+
+  grid.moveTo(center);
+
+  const octomap::OcTreeKey key(1010, 1995, 3002);
+
+  grid.update(key, 1.0f);
+
+  // the cell stays until it leaves the window, over several laps of the ring
+  bool left = false;
+
+  for (int i = 0; i < 100; i++) {
+
+    center[0] += i % 2 ? 13 : -13;
+    center[1] += 1;
+    center[2] += i % 3 == 0 ? 1 : -1;
+
+    grid.moveTo(center);
+
+    left = left || !grid.contains(key);
+
+    EXPECT_EQ(grid.isOccupied(key), !left) << "step " << i;
+  }
+
+  EXPECT_TRUE(left);
+}
+
+//}
+
+/* translate //{ */
+
+/**
+ * @brief the altitude alignment shifts the cells, the window moves with them and the coarse summaries follow
+ */
+TEST(RollingGrid, TranslateMovesTheCells) {
+
+  RollingGrid grid;
+
+  grid.initialize(37, 15, -2.0f, 3.5f, 0.0f, 3);
+
+  octomap::OcTreeKey center(32768, 32768, 32768);
+
+  grid.moveTo(center);
+
+  std::mt19937                       generator(4);
+  std::uniform_int_distribution<int> offset(-20, 20);
+
+  for (int u = 0; u < 2000; u++) {
+
+    const octomap::OcTreeKey key(center[0] + offset(generator), center[1] + offset(generator), center[2] + offset(generator) / 2);
+
+    grid.update(key, u % 3 ? -0.4f : 0.85f);
+  }
+
+  const octomap::OcTreeKey all_min(0, 0, 0);
+  const octomap::OcTreeKey all_max(65535, 65535, 65535);
+
+  std::vector<KeyUpdate_t> before, after;
+
+  grid.exportCells(all_min, all_max, before);
+
+  uint64_t version = 0;
+  grid.exportChanges(version, all_min, all_max, all_min, all_max, after);
+
+  const int32_t shift[3] = {3, -2, 5};
+
+  grid.translate(shift);
+
+  // the changes since the export are not known anymore
+  EXPECT_FALSE(grid.exportChanges(version, all_min, all_max, all_min, all_max, after));
+
+  grid.exportCells(all_min, all_max, after);
+
+  ASSERT_EQ(after.size(), before.size());
+
+  std::vector<KeyUpdate_t> expected;
+
+  for (const KeyUpdate_t& cell : before) {
+
+    const octomap::OcTreeKey key = mortonDecode(cell.code);
+
+    expected.push_back({mortonEncode(octomap::OcTreeKey(key[0] + shift[0], key[1] + shift[1], key[2] + shift[2])), cell.delta});
+  }
+
+  std::sort(expected.begin(), expected.end(), [](const KeyUpdate_t& a, const KeyUpdate_t& b) { return a.code < b.code; });
+
+  for (size_t c = 0; c < after.size(); c++) {
+    ASSERT_EQ(after[c].code, expected[c].code);
+    ASSERT_EQ(after[c].delta, expected[c].delta);
+  }
+
+  // the coarse queries equal the checks of the cells
+  for (unsigned int level = 1; level <= 3; level++) {
+
+    const int size = 1 << level;
+
+    for (int x = -24; x < 24; x += size) {
+      for (int y = -24; y < 24; y += size) {
+        for (int z = -12; z < 12; z += size) {
+
+          const octomap::OcTreeKey key(((center[0] + x) >> level) << level, ((center[1] + y) >> level) << level, ((center[2] + z) >> level) << level);
+
+          bool occupied = false;
+
+          for (int cx = 0; cx < size; cx++) {
+            for (int cy = 0; cy < size; cy++) {
+              for (int cz = 0; cz < size; cz++) {
+                occupied = occupied || grid.isOccupied(octomap::OcTreeKey(key[0] + cx, key[1] + cy, key[2] + cz));
+              }
+            }
+          }
+
+          ASSERT_EQ(grid.isOccupied(key, level), occupied) << "level " << level;
+        }
+      }
+    }
+  }
+
+  // moving the window back over the shifted cells keeps the ones which stay inside of it
+  grid.moveTo(center);
+
+  for (const KeyUpdate_t& cell : expected) {
+
+    const octomap::OcTreeKey key = mortonDecode(cell.code);
+
+    if (grid.contains(key)) {
+      EXPECT_EQ(grid.isOccupied(key), cell.delta >= 0.0f);
+    }
+  }
+
+  grid.exportCells(all_min, all_max, after);
+
+  for (const KeyUpdate_t& cell : after) {
+    EXPECT_TRUE(std::find_if(expected.begin(), expected.end(), [&cell](const KeyUpdate_t& e) { return e.code == cell.code && e.delta == cell.delta; }) !=
+                expected.end());
+  }
+}
+
+//}
+
+/* exportChanges //{ */
+
+TEST(RollingGrid, ExportOfChangesEqualsFullExport) {
+
+  octomap::OcTree octree(RESOLUTION);
+  octomap::OcTree reference(RESOLUTION);
+
+  RollingGrid grid;
+
+  grid.initialize(41, 23, octree.getClampingThresMinLog(), octree.getClampingThresMaxLog(), octree.getOccupancyThresLog());
+
+  std::mt19937                       generator(1);
+  std::uniform_int_distribution<int> offset(-24, 24);
+  std::uniform_int_distribution<int> step(-2, 2);
+  std::uniform_int_distribution<int> half_size(4, 20);
+  std::uniform_int_distribution<int> event(0, 99);
+
+  octomap::OcTreeKey center(32768, 32768, 32768);
+
+  Export_t exported;
+
+  for (int i = 0; i < 300; i++) {
+
+    const int e = event(generator);
+
+    if (e == 0) {
+
+      grid.clear();
+
+    } else if (e == 1) {
+
+      // a jump over the whole window
+      center[0] += 100;
+      grid.moveTo(center);
+
+    } else {
+
+      for (int j = 0; j < 3; j++) {
+        center[j] += step(generator);
+      }
+
+      grid.moveTo(center);
+    }
+
+    // the updates around the center, dense enough to clamp the cells and prune the tree
+    for (int u = 0; u < 2000; u++) {
+
+      const octomap::OcTreeKey key(center[0] + offset(generator) / 2, center[1] + offset(generator) / 2, center[2] + offset(generator) / 4);
+
+      grid.update(key, u % 5 ? octree.getProbMissLog() : octree.getProbHitLog());
+    }
+
+    // a block of free cells, the tree gets pruned nodes crossing the boundaries of the boxes
+    for (int x = 0; x < 8; x++) {
+      for (int y = 0; y < 8; y++) {
+        for (int z = 0; z < 4; z++) {
+          grid.setValue(octomap::OcTreeKey((center[0] & ~7) + x, (center[1] & ~7) + y, (center[2] & ~3) + z), octree.getClampingThresMinLog());
+        }
+      }
+    }
+
+    // the box of the local map changes its size too
+    const int          hs = half_size(generator);
+    octomap::OcTreeKey min_key(center[0] - hs, center[1] - hs, center[2] - hs / 2);
+    octomap::OcTreeKey max_key(center[0] + hs, center[1] + hs, center[2] + hs / 2);
+
+    exportChanges(grid, octree, exported, min_key, max_key);
+    exportAll(grid, reference, min_key, max_key);
+
+    ASSERT_TRUE(octree == reference) << "step " << i;
+  }
+
+  // most of the exports are incremental
+  EXPECT_LT(exported.n_full, 20);
+}
+
+//}
+
+/* coarse levels //{ */
+
+/**
+ * @brief the coarse queries answered from the summaries equal the checks of all the cells of the cubes
+ */
+TEST(RollingGrid, CoarseOccupancyEqualsTheCells) {
+
+  RollingGrid grid;
+
+  grid.initialize(45, 19, -2.0f, 3.5f, 0.0f, 3);
+
+  std::mt19937                       generator(2);
+  std::uniform_int_distribution<int> offset(-30, 30);
+  std::uniform_int_distribution<int> step(-5, 5);
+
+  octomap::OcTreeKey center(32768, 32768, 32768);
+
+  for (int i = 0; i < 60; i++) {
+
+    for (int j = 0; j < 3; j++) {
+      center[j] += step(generator);
+    }
+
+    grid.moveTo(center);
+
+    // the occupied cells are sparse, most of the cubes have none
+    for (int u = 0; u < 300; u++) {
+
+      const octomap::OcTreeKey key(center[0] + offset(generator), center[1] + offset(generator), center[2] + offset(generator) / 2);
+
+      grid.update(key, u % 4 ? -0.4f : 0.85f);
+    }
+
+    // the cubes around the window, including the ones crossing its boundary and the ones outside of it
+    for (unsigned int level = 1; level <= 4; level++) {
+
+      const int size = 1 << level;
+
+      for (int x = -32; x < 32; x += size) {
+        for (int y = -32; y < 32; y += size) {
+          for (int z = -16; z < 16; z += size) {
+
+            const octomap::OcTreeKey key(((center[0] + x) >> level) << level, ((center[1] + y) >> level) << level, ((center[2] + z) >> level) << level);
+
+            bool occupied = false;
+
+            for (int cx = 0; cx < size; cx++) {
+              for (int cy = 0; cy < size; cy++) {
+                for (int cz = 0; cz < size; cz++) {
+                  occupied = occupied || grid.isOccupied(octomap::OcTreeKey(key[0] + cx, key[1] + cy, key[2] + cz));
+                }
+              }
+            }
+
+            ASSERT_EQ(grid.isOccupied(key, level), occupied) << "step " << i << ", level " << level;
+          }
+        }
+      }
+    }
+  }
+}
+
+/**
+ * @brief the coarse updates, some of them skipped as the cubes are saturated, equal the updates of all the cells
+ */
+TEST(RollingGrid, CoarseUpdateEqualsUpdatesOfTheCells) {
+
+  RollingGrid grid;
+  RollingGrid reference;
+
+  grid.initialize(45, 19, -2.0f, 3.5f, 0.0f, 3);
+  reference.initialize(45, 19, -2.0f, 3.5f, 0.0f);
+
+  std::mt19937                       generator(3);
+  std::uniform_int_distribution<int> offset(-24, 24);
+  std::uniform_int_distribution<int> step(-3, 3);
+  std::uniform_int_distribution<int> level_distribution(0, 3);
+
+  octomap::OcTreeKey center(32768, 32768, 32768);
+
+  for (int i = 0; i < 60; i++) {
+
+    for (int j = 0; j < 3; j++) {
+      center[j] += step(generator);
+    }
+
+    grid.moveTo(center);
+    reference.moveTo(center);
+
+    // mostly free updates, which saturate the cubes
+    for (int u = 0; u < 500; u++) {
+
+      const unsigned int level = level_distribution(generator);
+      const int          size  = 1 << level;
+      const float        delta = u % 10 ? -0.4f : 0.85f;
+
+      const octomap::OcTreeKey key(((center[0] + offset(generator)) >> level) << level, ((center[1] + offset(generator)) >> level) << level,
+                                   ((center[2] + offset(generator) / 2) >> level) << level);
+
+      grid.update(key, delta, level);
+
+      for (int x = 0; x < size; x++) {
+        for (int y = 0; y < size; y++) {
+          for (int z = 0; z < size; z++) {
+            reference.update(octomap::OcTreeKey(key[0] + x, key[1] + y, key[2] + z), delta);
+          }
+        }
+      }
+    }
+
+    std::vector<KeyUpdate_t> cells, reference_cells;
+
+    grid.exportCells(octomap::OcTreeKey(0, 0, 0), octomap::OcTreeKey(65535, 65535, 65535), cells);
+    reference.exportCells(octomap::OcTreeKey(0, 0, 0), octomap::OcTreeKey(65535, 65535, 65535), reference_cells);
+
+    ASSERT_EQ(cells.size(), reference_cells.size()) << "step " << i;
+
+    for (size_t c = 0; c < cells.size(); c++) {
+      ASSERT_EQ(cells[c].code, reference_cells[c].code) << "step " << i;
+      ASSERT_EQ(cells[c].delta, reference_cells[c].delta) << "step " << i;
+    }
+  }
+}
+
+//}
+
+int main(int argc, char** argv) {
+
+  testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+}
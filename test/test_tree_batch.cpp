@@ -0,0 +1,266 @@
+#include <gtest/gtest.h>
+
+#include <octomap/OcTree.h>
+
+#include <mrs_octomap_server/key_buffer.h>
+#include <mrs_octomap_server/tree_batch.h>
+
+#include <random>
+#include <set>
+#include <vector>
+#include <algorithm>
+
+using namespace mrs_octomap_server;
+
+namespace
+{
+
+const double RESOLUTION = 0.2;
+
+/* randomBatch() //{ */
+
+/**
+ * @brief log-odds updates of random leaves in a cube of the given size (in leaves) placed away from the origin
+ */
+std::vector<KeyUpdate_t> randomBatch(const octomap::OcTree& octree, const int n, const int size, const unsigned int seed) {
+
+  std::mt19937                       generator(seed);
+  std::uniform_int_distribution<int> coord(0, size - 1);
+  std::uniform_int_distribution<int> hit(0, 3);
+
+  const octomap::OcTreeKey corner = octree.coordToKey(5.0, -3.0, 2.0);
+
+  std::vector<KeyUpdate_t> batch;
+
+  for (int i = 0; i < n; i++) {
+
+    octomap::OcTreeKey key(octomap::key_type(corner[0] + coord(generator)), octomap::key_type(corner[1] + coord(generator)),
+                           octomap::key_type(corner[2] + coord(generator)));
+
+    batch.push_back({mortonEncode(key), hit(generator) == 0 ? octree.getProbHitLog() : octree.getProbMissLog()});
+  }
+
+  // the updates of the same leaf keep their order
+  std::stable_sort(batch.begin(), batch.end(), [](const KeyUpdate_t& a, const KeyUpdate_t& b) { return a.code < b.code; });
+
+  return batch;
+}
+
+//}
+
+/* leafVolume() //{ */
+
+/**
+ * @brief the number of the leaves at the maximum depth covered by the leaves of the tree, the pruned nodes count as all their leaves
+ */
+size_t leafVolume(const octomap::OcTree& octree) {
+
+  size_t volume = 0;
+
+  for (auto it = octree.begin_leafs(), end = octree.end_leafs(); it != end; ++it) {
+    volume += size_t(1) << (3 * (octree.getTreeDepth() - it.getDepth()));
+  }
+
+  return volume;
+}
+
+//}
+
+/* expectExactlyKeys() //{ */
+
+/**
+ * @brief the known leaves of the tree are exactly the keys of the batch
+ */
+void expectExactlyKeys(const octomap::OcTree& octree, const std::vector<KeyUpdate_t>& batch) {
+
+  std::set<morton_t> codes;
+
+  for (const KeyUpdate_t& update : batch) {
+    codes.insert(update.code);
+  }
+
+  for (const morton_t code : codes) {
+    EXPECT_NE(octree.search(mortonDecode(code)), nullptr);
+  }
+
+  EXPECT_EQ(leafVolume(octree), codes.size());
+
+  // no leaf at the origin, it is not part of the batch
+  EXPECT_EQ(octree.search(octree.coordToKey(0.0, 0.0, 0.0)), nullptr);
+}
+
+//}
+
+}  // namespace
+
+/* updateNodesBatch //{ */
+
+TEST(TreeBatch, UpdateEmptyTreeContainsExactlyTheBatch) {
+
+  octomap::OcTree octree(RESOLUTION);
+
+  const std::vector<KeyUpdate_t> batch = randomBatch(octree, 2000, 16, 1);
+
+  updateNodesBatch(octree, batch);
+
+  expectExactlyKeys(octree, batch);
+}
+
+TEST(TreeBatch, UpdateEqualsUpdateNode) {
+
+  octomap::OcTree octree(RESOLUTION);
+  octomap::OcTree reference(RESOLUTION);
+
+  // the dense batches get the leaves clamped and the nodes pruned
+  for (unsigned int seed = 0; seed < 10; seed++) {
+
+    const std::vector<KeyUpdate_t> batch = randomBatch(octree, 3000, seed % 2 ? 8 : 32, seed);
+
+    updateNodesBatch(octree, batch);
+
+    for (const KeyUpdate_t& update : batch) {
+      reference.updateNode(mortonDecode(update.code), update.delta);
+    }
+
+    EXPECT_TRUE(octree == reference) << "seed " << seed;
+  }
+}
+
+TEST(TreeBatch, UpdateClearedTree) {
+
+  octomap::OcTree octree(RESOLUTION);
+
+  updateNodesBatch(octree, randomBatch(octree, 500, 16, 2));
+
+  octree.clear();
+
+  const std::vector<KeyUpdate_t> batch = randomBatch(octree, 500, 16, 3);
+
+  updateNodesBatch(octree, batch);
+
+  expectExactlyKeys(octree, batch);
+}
+
+//}
+
+/* setNodesBatch //{ */
+
+TEST(TreeBatch, SetEmptyTreeContainsExactlyTheBatch) {
+
+  octomap::OcTree octree(RESOLUTION);
+
+  std::vector<KeyUpdate_t> batch = randomBatch(octree, 2000, 16, 4);
+
+  batch.erase(std::unique(batch.begin(), batch.end(), [](const KeyUpdate_t& a, const KeyUpdate_t& b) { return a.code == b.code; }), batch.end());
+
+  setNodesBatch(octree, batch);
+
+  expectExactlyKeys(octree, batch);
+
+  for (const KeyUpdate_t& update : batch) {
+    EXPECT_FLOAT_EQ(octree.search(mortonDecode(update.code))->getLogOdds(), update.delta);
+  }
+}
+
+//}
+
+/* mergeTree //{ */
+
+TEST(TreeBatch, MergeIntoEmptyTreeCopiesTheSource) {
+
+  octomap::OcTree from(RESOLUTION);
+  octomap::OcTree to(RESOLUTION);
+
+  const std::vector<KeyUpdate_t> batch = randomBatch(from, 2000, 16, 5);
+
+  updateNodesBatch(from, batch);
+
+  mergeTree(from, to);
+
+  expectExactlyKeys(to, batch);
+
+  EXPECT_TRUE(to == from);
+}
+
+//}
+
+/* copyBox //{ */
+
+TEST(TreeBatch, CopyBoxPastTheMapBounds) {
+
+  octomap::OcTree from(RESOLUTION);
+  octomap::OcTree to(RESOLUTION);
+
+  std::vector<KeyUpdate_t> batch = randomBatch(from, 2000, 16, 6);
+
+  // the leaves in the corners of the map
+  batch.push_back({mortonEncode(octomap::OcTreeKey(0, 0, 0)), from.getProbHitLog()});
+  batch.push_back({mortonEncode(octomap::OcTreeKey(65535, 65535, 65535)), from.getProbHitLog()});
+
+  std::stable_sort(batch.begin(), batch.end(), [](const KeyUpdate_t& a, const KeyUpdate_t& b) { return a.code < b.code; });
+  batch.erase(std::unique(batch.begin(), batch.end(), [](const KeyUpdate_t& a, const KeyUpdate_t& b) { return a.code == b.code; }), batch.end());
+
+  setNodesBatch(from, batch);
+
+  // the box reaches far beyond the map on all sides
+  copyBox(from, octomap::point3d(-1e5, -1e5, -1e5), octomap::point3d(1e5, 1e5, 1e5), to);
+
+  expectExactlyKeys(to, batch);
+
+  EXPECT_TRUE(to == from);
+}
+
+TEST(TreeBatch, CopyBoxContainsExactlyTheLeavesInside) {
+
+  octomap::OcTree from(RESOLUTION);
+  octomap::OcTree to(RESOLUTION);
+
+  std::vector<KeyUpdate_t> batch = randomBatch(from, 2000, 16, 7);
+
+  batch.erase(std::unique(batch.begin(), batch.end(), [](const KeyUpdate_t& a, const KeyUpdate_t& b) { return a.code == b.code; }), batch.end());
+
+  setNodesBatch(from, batch);
+
+  // the centers of the corner leaves of the box, a few leaves inside of the cube of the batch
+  const octomap::OcTreeKey corner = from.coordToKey(5.0, -3.0, 2.0);
+  const octomap::OcTreeKey min_key(corner[0] + 3, corner[1] + 5, corner[2] + 2);
+  const octomap::OcTreeKey max_key(corner[0] + 12, corner[1] + 9, corner[2] + 14);
+
+  copyBox(from, from.keyToCoord(min_key), from.keyToCoord(max_key), to);
+
+  std::vector<KeyUpdate_t> inside;
+
+  for (const KeyUpdate_t& update : batch) {
+
+    const octomap::OcTreeKey key = mortonDecode(update.code);
+
+    if (key[0] >= min_key[0] && key[0] <= max_key[0] && key[1] >= min_key[1] && key[1] <= max_key[1] && key[2] >= min_key[2] && key[2] <= max_key[2]) {
+      inside.push_back(update);
+    }
+  }
+
+  ASSERT_FALSE(inside.empty());
+
+  expectExactlyKeys(to, inside);
+}
+
+TEST(TreeBatch, CopyBoxOutsideOfTheMap) {
+
+  octomap::OcTree from(RESOLUTION);
+  octomap::OcTree to(RESOLUTION);
+
+  setNodesBatch(from, randomBatch(from, 100, 16, 8));
+
+  copyBox(from, octomap::point3d(1e5, 0.0, 0.0), octomap::point3d(2e5, 1.0, 1.0), to);
+
+  EXPECT_EQ(to.getRoot(), nullptr);
+}
+
+//}
+
+int main(int argc, char** argv) {
+
+  testing::InitGoogleTest(&argc, argv);
+
+  return RUN_ALL_TESTS();
+}